@@ -53,6 +53,12 @@ CONFIG(debug, debug|release) {
 #	uncomment this if you want the text stats gl option
 #	DEFINES += USE_GL_QPAINTER
 
+# Count memory allocations in the -no-gui --benchmark mode
+# (Add `countAllocations` to CONFIG to use)
+countAllocations {
+	DEFINES += NIFSKOPE_COUNT_ALLOCATIONS
+}
+
 #TRANSLATIONS += \
 #	res/lang/NifSkope_de.ts \
 #	res/lang/NifSkope_fr.ts
@@ -166,6 +172,7 @@ HEADERS += \
 	src/gl/marker/furniture.h \
 	src/gl/BSMesh.h \
 	src/gl/bsshape.h \
+	src/gl/bvh.h \
 	src/gl/controllers.h \
 	src/gl/glcontroller.h \
 	src/gl/glmarker.h \
@@ -182,6 +189,7 @@ HEADERS += \
 	src/gl/renderer.h \
 	src/io/material.h \
 	src/io/MeshFile.h \
+	src/io/nifindex.h \
 	src/io/nifstream.h \
 	src/lib/importex/3ds.h \
 	src/lib/nvtristripwrapper.h \
@@ -192,6 +200,7 @@ HEADERS += \
 	src/model/nifproxymodel.h \
 	src/model/undocommands.h \
 	src/spells/blocks.h \
+	src/spells/fileextract.h \
 	src/spells/mesh.h \
 	src/spells/misc.h \
 	src/spells/sanitize.h \
@@ -226,6 +235,7 @@ HEADERS += \
 	src/glview.h \
 	src/message.h \
 	src/nifskope.h \
+	src/selftest.h \
 	src/qtcompat.h \
 	src/spellbook.h \
 	src/version.h \
@@ -245,6 +255,7 @@ SOURCES += \
 	src/data/nifvalue.cpp \
 	src/gl/BSMesh.cpp \
 	src/gl/bsshape.cpp \
+	src/gl/bvh.cpp \
 	src/gl/controllers.cpp \
 	src/gl/glcontroller.cpp \
 	src/gl/glmarker.cpp \
@@ -260,6 +271,7 @@ SOURCES += \
 	src/gl/renderer.cpp \
 	src/io/materialfile.cpp \
 	src/io/MeshFile.cpp \
+	src/io/nifindex.cpp \
 	src/io/nifstream.cpp \
 	src/lib/importex/3ds.cpp \
 	src/lib/importex/importex.cpp \
@@ -332,6 +344,7 @@ SOURCES += \
 	src/message.cpp \
 	src/nifskope.cpp \
 	src/nifskope_ui.cpp \
+	src/selftest.cpp \
 	src/spellbook.cpp \
 	src/version.cpp \
 	lib/half.cpp \
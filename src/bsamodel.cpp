@@ -31,169 +31,470 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***** END LICENCE BLOCK *****/
 
 #include "bsamodel.h"
-#include "qtcompat.h"
 
 #include <QByteArray>
-#include <QDateTime>
 #include <QStringBuilder>
 
+#include <algorithm>
 
-BSAModel::BSAModel( QObject * parent )
-	: QStandardItemModel( parent )
+
+//! Number of rows added to a folder by each call to fetchMore()
+static constexpr std::int32_t fetchBatchSize = 1000;
+
+struct BSAModel::ScanData
 {
+	FileIndex *	fileIndex;
+	std::unordered_map< std::string, std::int32_t >	folderMap;
+	std::string	path;
+	std::vector< std::string >	fileTypes;
+};
 
+BSAModel::BSAModel( QObject * parent )
+	: QAbstractItemModel( parent )
+{
+	filterPool.setMaxThreadCount( 1 );
 }
 
-void BSAModel::init()
+BSAModel::~BSAModel()
 {
-	setColumnCount( 3 );
-	setHorizontalHeaderLabels( { "File", "Path", "Size" } );
+	filterGeneration++;
+	filterPool.waitForDone();
 }
 
-Qt::ItemFlags BSAModel::flags( const QModelIndex & index ) const
+void BSAModel::clear()
 {
-	return QStandardItemModel::flags( index ) ^ Qt::ItemIsEditable;
+	beginResetModel();
+	filterGeneration++;
+	fileIndex.reset();
+	view.reset();
+	fetched.clear();
+	lastPattern.clear();
+	endResetModel();
 }
 
-bool BSAModel::fillModel( const BA2File * bsa, const QString & folder )
+bool BSAModel::fillModel( const BA2File * bsa, const QString & folder, const QStringList & fileTypes )
 {
+	clear();
 	if ( !bsa )
 		return false;
 
-	FileScanFuncData	data;
-	data.p = this;
-	data.bsa = bsa;
-	data.path = folder.toStdString();
+	auto	newIndex = std::make_shared< FileIndex >();
+	newIndex->folders.push_back( Folder{ std::string(), -1, {} } );
+
+	ScanData	data;
+	data.fileIndex = newIndex.get();
+	data.path = folder.toLower().toStdString();
 	if ( !data.path.empty() && !data.path.ends_with( '/' ) )
 		data.path += '/';
+	for ( const auto & t : fileTypes )
+		data.fileTypes.push_back( t.toLower().toStdString() );
 
 	// List files
 	bsa->scanFileList( &fileListScanFunction, &data );
 
-	return ( rowCount() > 0 );
+	// Sort folders first, then by name
+	const FileIndex &	idx = *newIndex;
+	auto	rowName = [&idx]( const Row & r ) -> std::string_view {
+		if ( r.isFolder )
+			return idx.folders[r.id].name;
+		const File &	f = idx.files[r.id];
+		return std::string_view( f.lowerPath ).substr( size_t(f.nameOffset) );
+	};
+	for ( auto & f : newIndex->folders ) {
+		std::sort( f.children.begin(), f.children.end(), [&rowName]( const Row & a, const Row & b ) {
+			if ( a.isFolder != b.isFolder )
+				return a.isFolder;
+			return rowName( a ) < rowName( b );
+		} );
+	}
+
+	beginResetModel();
+	fileIndex = newIndex;
+	view = filterFiles( *fileIndex, std::string(), false, sortColumn, sortOrder, nullptr, nullptr, 0 );
+	fetched.assign( fileIndex->folders.size(), 0 );
+	endResetModel();
+
+	if ( !filterPattern.isEmpty() )
+		startFilter();
+
+	return !fileIndex->files.empty();
 }
 
 bool BSAModel::fileListScanFunction( void * p, const BA2File::FileInfo & fd )
 {
-	FileScanFuncData & o = *( reinterpret_cast< FileScanFuncData * >( p ) );
+	ScanData & o = *( reinterpret_cast< ScanData * >( p ) );
 
 	if ( fd.fileName.length() <= o.path.length() || !( o.path.empty() || fd.fileName.starts_with( o.path ) ) )
 		return false;
 
-	qsizetype	bytes = qsizetype( fd.archiveType < 64 || fd.packedSize == 0 ? fd.unpackedSize : fd.packedSize );
-	QString	fileSize( (bytes > 1024) ? QString::number( bytes / 1024 ) + "KB" : QString::number( bytes ) + "B" );
-
-	QString	fullPath( QString::fromLatin1( fd.fileName.data(), qsizetype(fd.fileName.length()) ) );
-	qsizetype	dirNameLen = fullPath.lastIndexOf( QChar( '/' ) );
-	QString	baseName( fullPath.mid( dirNameLen + 1 ) );
-	auto	folderItem = o.p->insertFolder( fullPath, o.path.length(), dirNameLen, o.folderMap );
+	File	f;
+	f.path = fd.fileName;
+	f.lowerPath = f.path;
+	for ( auto & c : f.lowerPath ) {
+		if ( c >= 'A' && c <= 'Z' )
+			c = c + ( 'a' - 'A' );
+	}
+	if ( !o.fileTypes.empty() ) {
+		if ( std::find_if( o.fileTypes.begin(), o.fileTypes.end(),
+							[&f]( const std::string & t ) { return f.lowerPath.ends_with( t ); } ) == o.fileTypes.end() ) {
+			return false;
+		}
+	}
 
-	auto	fileItem = new QStandardItem( baseName );
-	auto	pathItem = new QStandardItem( fullPath );
-	auto	sizeItem = new QStandardItem( fileSize );
+	size_t	dirNameLen = f.path.rfind( '/' );
+	if ( dirNameLen == std::string::npos || dirNameLen < o.path.length() )
+		dirNameLen = o.path.length() - 1;
+	f.nameOffset = std::int32_t( dirNameLen + 1 );
+	f.folder = insertFolder( *o.fileIndex, o.folderMap, f.lowerPath, o.path.length(), dirNameLen );
+	f.size = qint64( fd.archiveType < 64 || fd.packedSize == 0 ? fd.unpackedSize : fd.packedSize );
 
-	folderItem->appendRow( { fileItem, pathItem, sizeItem } );
+	std::int32_t	id = std::int32_t( o.fileIndex->files.size() );
+	o.fileIndex->folders[f.folder].children.push_back( Row{ id, false } );
+	o.fileIndex->files.push_back( std::move( f ) );
 
 	return false;
 }
 
-QStandardItem * BSAModel::insertFolder( const QString & path, qsizetype pos1, qsizetype pos2, QHash< QString, QStandardItem * > & folderMap )
+std::int32_t BSAModel::insertFolder( FileIndex & fileIndex, std::unordered_map< std::string, std::int32_t > & folderMap,
+										const std::string & path, size_t pos1, size_t pos2 )
 {
-	if ( pos2 <= pos1 )
-		return invisibleRootItem();
+	if ( pos2 <= pos1 || pos2 == std::string::npos )
+		return 0;
 
-	QString	key( path.left( pos2 ) );
-	for ( auto i = folderMap.find( key ); i != folderMap.end(); )
-		return i.value();
+	std::string	key( path, 0, pos2 );
+	auto	i = folderMap.find( key );
+	if ( i != folderMap.end() )
+		return i->second;
 
-	qsizetype	i1 = path.lastIndexOf( QChar('/'), pos2 - 1 );
-	QStandardItem *	parent;
+	size_t	i1 = path.rfind( '/', pos2 - 1 );
 	// Recurse through folders
-	if ( i1 > pos1 )
-		parent = insertFolder( path, pos1, i1, folderMap );
+	std::int32_t	parent = 0;
+	if ( i1 != std::string::npos && i1 > pos1 )
+		parent = insertFolder( fileIndex, folderMap, path, pos1, i1 );
 	else
-		parent = invisibleRootItem();
-	QStandardItem *	folderItem = new QStandardItem( path.mid( i1 + 1, pos2 - ( i1 + 1 ) ) );
-	auto pathDummy = new QStandardItem();
-	auto sizeDummy = new QStandardItem();
+		i1 = pos1 - 1;
 
-	parent->appendRow( { folderItem, pathDummy, sizeDummy } );
-	folderMap.insert( key, folderItem );
+	std::int32_t	id = std::int32_t( fileIndex.folders.size() );
+	fileIndex.folders.push_back( Folder{ path.substr( i1 + 1, pos2 - ( i1 + 1 ) ), parent, {} } );
+	fileIndex.folders[parent].children.push_back( Row{ id, true } );
+	folderMap.emplace( std::move( key ), id );
 
-	return folderItem;
+	return id;
 }
 
+bool BSAModel::wildcardMatch( const std::string_view & text, const std::string_view & pattern )
+{
+	// Match any part of 'text', as if 'pattern' began and ended with '*'
+	size_t	t = 0;
+	size_t	p = 0;
+	size_t	starP = 0;
+	size_t	starT = 0;
+	while ( true ) {
+		if ( p == pattern.length() )
+			return true;
+		if ( t == text.length() )
+			break;
+		if ( pattern[p] == '*' ) {
+			starP = ++p;
+			starT = t;
+		} else if ( pattern[p] == '?' || pattern[p] == text[t] ) {
+			p++;
+			t++;
+		} else {
+			p = starP;
+			t = ++starT;
+		}
+	}
+	while ( p < pattern.length() && pattern[p] == '*' )
+		p++;
+	return ( p == pattern.length() );
+}
 
-BSAProxyModel::BSAProxyModel( QObject * parent )
-	: QSortFilterProxyModel( parent )
+std::shared_ptr< BSAModel::View > BSAModel::filterFiles(
+	const FileIndex & fileIndex, const std::string & pattern, bool nameOnly, int column, Qt::SortOrder order,
+	const std::vector< std::int32_t > * candidates, const std::atomic< int > * generation, int jobGeneration )
 {
+	const auto &	files = fileIndex.files;
+	const auto &	folders = fileIndex.folders;
+	bool	isPlain = ( pattern.find_first_of( "*?" ) == std::string::npos );
+
+	auto	v = std::make_shared< View >();
+	std::vector< char >	fileVisible( files.size(), char(pattern.empty()) );
+	std::vector< char >	folderVisible( folders.size(), char(pattern.empty()) );
+	if ( !folders.empty() )
+		folderVisible[0] = 1;
+
+	if ( !pattern.empty() ) {
+		auto	checkFile = [&]( std::int32_t i ) {
+			const File &	f = files[i];
+			std::string_view	s( f.lowerPath );
+			if ( nameOnly )
+				s = s.substr( size_t(f.nameOffset) );
+			if ( isPlain ? ( s.find( pattern ) == std::string_view::npos ) : !wildcardMatch( s, pattern ) )
+				return;
+			fileVisible[i] = 1;
+			v->matches.push_back( i );
+			for ( std::int32_t d = f.folder; !folderVisible[d]; d = folders[d].parent )
+				folderVisible[d] = 1;
+		};
+
+		size_t	n = ( candidates ? candidates->size() : files.size() );
+		for ( size_t i = 0; i < n; i++ ) {
+			// give up if the filter has been changed again
+			if ( generation && !( i & 4095 ) && *generation != jobGeneration )
+				return nullptr;
+			checkFile( candidates ? (*candidates)[i] : std::int32_t(i) );
+		}
+	}
+
+	// the children of each folder are already sorted by name, folders first
+	bool	descending = ( order == Qt::DescendingOrder );
+	auto	lessThan = [&]( const Row & a, const Row & b ) {
+		if ( a.isFolder != b.isFolder )
+			return a.isFolder;
+		if ( a.isFolder || column == 0 )
+			return false;
+		const File &	f1 = files[a.id];
+		const File &	f2 = files[b.id];
+		if ( column == 2 )
+			return ( f1.size < f2.size );
+		return ( f1.lowerPath < f2.lowerPath );
+	};
+
+	v->visible.resize( folders.size() );
+	v->folderRow.assign( folders.size(), -1 );
+	for ( size_t d = 0; d < folders.size(); d++ ) {
+		if ( !folderVisible[d] )
+			continue;
+		auto &	rows = v->visible[d];
+		for ( const Row & r : folders[d].children ) {
+			if ( !( r.isFolder ? folderVisible[r.id] : fileVisible[r.id] ) )
+				continue;
+			rows.push_back( r );
+		}
+		if ( column != 0 )
+			std::stable_sort( rows.begin(), rows.end(), lessThan );
+		if ( descending ) {
+			// keep the folders first
+			auto	i = std::find_if( rows.begin(), rows.end(), []( const Row & r ) { return !r.isFolder; } );
+			std::reverse( rows.begin(), i );
+			std::reverse( i, rows.end() );
+		}
+		for ( size_t i = 0; i < rows.size(); i++ ) {
+			if ( rows[i].isFolder )
+				v->folderRow[rows[i].id] = std::int32_t( i );
+		}
+	}
 
+	return v;
 }
 
-void BSAProxyModel::setFiletypes( QStringList types )
+void BSAModel::setFilter( const QString & pattern )
 {
-	filetypes = types;
+	// fillModel() applies the current filter to a new archive
+	if ( pattern == filterPattern )
+		return;
+	filterPattern = pattern;
+	startFilter();
 }
 
-void BSAProxyModel::setFilterByNameOnly( bool nameOnly )
+void BSAModel::setFilterByNameOnly( bool nameOnly )
 {
+	if ( nameOnly == filterByNameOnly )
+		return;
 	filterByNameOnly = nameOnly;
+	startFilter();
+}
 
-	setFilterRegExp( filterRegExp() );
+void BSAModel::sort( int column, Qt::SortOrder order )
+{
+	if ( column == sortColumn && order == sortOrder )
+		return;
+	sortColumn = column;
+	sortOrder = order;
+	startFilter();
 }
 
-void BSAProxyModel::resetFilter()
+void BSAModel::startFilter()
 {
-	setFilterRegExp( QRegExp( "*", Qt::CaseInsensitive, QRegExp::Wildcard ) );
+	// abandon the job that is running, if any
+	filterGeneration++;
+	if ( filterQueued )
+		return;
+	filterQueued = true;
+	QMetaObject::invokeMethod( this, [this]() {
+		filterQueued = false;
+		runFilter();
+	}, Qt::QueuedConnection );
 }
 
-bool BSAProxyModel::filterAcceptsRow( int sourceRow, const QModelIndex & sourceParent ) const
+void BSAModel::runFilter()
 {
-	if ( !filterRegExp().isEmpty() ) {
+	int	jobGeneration = ++filterGeneration;
+	if ( !fileIndex )
+		return;
+
+	std::string	pattern( filterPattern.toLower().toStdString() );
+	// a pattern consisting of only '*' matches everything
+	if ( pattern.find_first_not_of( '*' ) == std::string::npos )
+		pattern.clear();
+	bool	nameOnly = filterByNameOnly;
+	int	column = sortColumn;
+	Qt::SortOrder	order = sortOrder;
+
+	// Refine the previous results if the new pattern is a longer version of it, e.g. while it is being typed
+	std::shared_ptr< View >	base;
+	if ( view && !lastPattern.empty() && nameOnly == lastNameOnly && pattern.find( lastPattern ) != std::string::npos
+		&& pattern.find_first_of( "*?" ) == std::string::npos && lastPattern.find_first_of( "*?" ) == std::string::npos ) {
+		base = view;
+	}
 
-		QModelIndex sourceIndex0 = sourceModel()->index( sourceRow, 0, sourceParent );
-		QModelIndex sourceIndex1 = sourceModel()->index( sourceRow, 1, sourceParent );
-		if ( sourceIndex0.isValid() ) {
-			// If children match, parent matches
-			int c = sourceModel()->rowCount( sourceIndex0 );
-			for ( int i = 0; i < c; ++i ) {
-				if ( filterAcceptsRow( i, sourceIndex0 ) )
-					return true;
-			}
+	std::shared_ptr< const FileIndex >	idx( fileIndex );
+	filterPool.start( [this, idx, base, pattern, nameOnly, column, order, jobGeneration]() {
+		auto	v = filterFiles( *idx, pattern, nameOnly, column, order,
+								( base ? &(base->matches) : nullptr ), &filterGeneration, jobGeneration );
+		if ( !v )
+			return;
+		QMetaObject::invokeMethod( this, [this, v, jobGeneration, pattern, nameOnly]() {
+			applyFilter( v, jobGeneration, pattern, nameOnly );
+		}, Qt::QueuedConnection );
+	} );
+}
 
-			QString key0 = sourceModel()->data( sourceIndex0, filterRole() ).toString();
-			QString key1 = sourceModel()->data( sourceIndex1, filterRole() ).toString();
+void BSAModel::applyFilter( std::shared_ptr< View > newView, int jobGeneration, const std::string & pattern, bool nameOnly )
+{
+	if ( jobGeneration != filterGeneration || !fileIndex )
+		return;
 
-			bool typeMatch = true;
-			if ( filetypes.count() ) {
-				typeMatch = false;
-				for ( auto f : filetypes ) {
-					typeMatch |= key1.endsWith( f, Qt::CaseInsensitive );
-				}
-			}
+	beginResetModel();
+	view = newView;
+	fetched.assign( fileIndex->folders.size(), 0 );
+	lastPattern = pattern;
+	lastNameOnly = nameOnly;
+	endResetModel();
 
-			bool stringMatch = (filterByNameOnly) ? key0.contains( filterRegExp() ) : key1.contains( filterRegExp() );
+	emit filterApplied( !pattern.empty() );
+}
 
-			return typeMatch && stringMatch;
-		}
-	}
+const BSAModel::Row * BSAModel::row( const QModelIndex & index ) const
+{
+	if ( !( index.isValid() && view ) )
+		return nullptr;
+	return &( view->visible[index.internalId()][index.row()] );
+}
 
-	return QSortFilterProxyModel::filterAcceptsRow( sourceRow, sourceParent );
+std::int32_t BSAModel::folderId( const QModelIndex & index ) const
+{
+	if ( !view )
+		return -1;
+	if ( !index.isValid() )
+		return 0;
+	if ( index.column() != 0 )
+		return -1;
+	const Row *	r = row( index );
+	return ( r->isFolder ? r->id : -1 );
 }
 
-bool BSAProxyModel::lessThan( const QModelIndex & left, const QModelIndex & right ) const
+QModelIndex BSAModel::index( int row, int column, const QModelIndex & parent ) const
 {
-	QString leftString = sourceModel()->data( left ).toString();
-	QString rightString = sourceModel()->data( right ).toString();
+	std::int32_t	f = folderId( parent );
+	if ( f < 0 || row < 0 || row >= fetched[f] || column < 0 || column >= 3 )
+		return QModelIndex();
+	return createIndex( row, column, quintptr( f ) );
+}
 
-	QModelIndex leftChild = QModelIndex_child( left );
-	QModelIndex rightChild = QModelIndex_child( right );
+QModelIndex BSAModel::parent( const QModelIndex & index ) const
+{
+	if ( !( index.isValid() && view ) )
+		return QModelIndex();
+	std::int32_t	f = std::int32_t( index.internalId() );
+	if ( f == 0 )
+		return QModelIndex();
+	return createIndex( view->folderRow[f], 0, quintptr( fileIndex->folders[f].parent ) );
+}
 
-	if ( !leftChild.isValid() && rightChild.isValid() )
-		return false;
+int BSAModel::rowCount( const QModelIndex & parent ) const
+{
+	std::int32_t	f = folderId( parent );
+	return ( f >= 0 ? int( fetched[f] ) : 0 );
+}
 
-	if ( leftChild.isValid() && !rightChild.isValid() )
-		return true;
+int BSAModel::columnCount( const QModelIndex & ) const
+{
+	return 3;
+}
+
+bool BSAModel::hasChildren( const QModelIndex & parent ) const
+{
+	std::int32_t	f = folderId( parent );
+	return ( f >= 0 && !view->visible[f].empty() );
+}
+
+bool BSAModel::canFetchMore( const QModelIndex & parent ) const
+{
+	std::int32_t	f = folderId( parent );
+	return ( f >= 0 && size_t( fetched[f] ) < view->visible[f].size() );
+}
 
-	return leftString < rightString;
+void BSAModel::fetchMore( const QModelIndex & parent )
+{
+	std::int32_t	f = folderId( parent );
+	if ( f < 0 )
+		return;
+	std::int32_t	n = std::min( std::int32_t( view->visible[f].size() ) - fetched[f], fetchBatchSize );
+	if ( n <= 0 )
+		return;
+	beginInsertRows( parent, fetched[f], fetched[f] + n - 1 );
+	fetched[f] += n;
+	endInsertRows();
+}
+
+QVariant BSAModel::data( const QModelIndex & index, int role ) const
+{
+	if ( !( role == Qt::DisplayRole || role == Qt::EditRole ) )
+		return QVariant();
+	const Row *	r = row( index );
+	if ( !r )
+		return QVariant();
+
+	if ( r->isFolder ) {
+		if ( index.column() == 0 ) {
+			const std::string &	name = fileIndex->folders[r->id].name;
+			return QString::fromLatin1( name.data(), qsizetype(name.length()) );
+		}
+		return QVariant();
+	}
+
+	const File &	f = fileIndex->files[r->id];
+	switch ( index.column() ) {
+	case 0:
+		return QString::fromLatin1( f.path.data() + f.nameOffset, qsizetype(f.path.length()) - f.nameOffset );
+	case 1:
+		return QString::fromLatin1( f.path.data(), qsizetype(f.path.length()) );
+	case 2:
+		return ( f.size > 1024 ) ? QString::number( f.size / 1024 ) + "KB" : QString::number( f.size ) + "B";
+	}
+	return QVariant();
+}
+
+QVariant BSAModel::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+	if ( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QVariant();
+	switch ( section ) {
+	case 0:
+		return QString( "File" );
+	case 1:
+		return QString( "Path" );
+	case 2:
+		return QString( "Size" );
+	}
+	return QVariant();
+}
+
+Qt::ItemFlags BSAModel::flags( const QModelIndex & index ) const
+{
+	if ( !index.isValid() )
+		return Qt::NoItemFlags;
+	return Qt::ItemIsEnabled | Qt::ItemIsSelectable;
 }
@@ -35,54 +35,133 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "libfo76utils/src/ba2file.hpp"
 
-#include <QStandardItemModel>
-#include <QSortFilterProxyModel>
-#include <QHash>
-
-class BSAModel : public QStandardItemModel
+#include <QAbstractItemModel>
+#include <QStringList>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+//! Tree model of the files in an archive set, for the archive browser
+/*!
+ * The file list is stored once in an immutable index of interned folders and files with their
+ * lower case paths. Rows are created lazily with canFetchMore() / fetchMore(), and filtering
+ * runs on a worker thread, the model is reset with the results when it finishes.
+ */
+class BSAModel : public QAbstractItemModel
 {
 	Q_OBJECT
 
 public:
 	BSAModel( QObject * parent = nullptr );
-
-	void init();
-
+	~BSAModel();
+
+	void clear();
+	//! Add the files in 'bsa' below 'folder' that end with one of 'fileTypes', replacing the current contents
+	bool fillModel( const BA2File * bsa, const QString & folder, const QStringList & fileTypes = {} );
+
+	QModelIndex index( int row, int column, const QModelIndex & parent = QModelIndex() ) const override;
+	QModelIndex parent( const QModelIndex & index ) const override;
+	int rowCount( const QModelIndex & parent = QModelIndex() ) const override;
+	int columnCount( const QModelIndex & parent = QModelIndex() ) const override;
+	bool hasChildren( const QModelIndex & parent = QModelIndex() ) const override;
+	bool canFetchMore( const QModelIndex & parent ) const override;
+	void fetchMore( const QModelIndex & parent ) override;
+	QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const override;
+	QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const override;
 	Qt::ItemFlags flags( const QModelIndex & index ) const override;
-	bool fillModel( const BA2File * bsa, const QString & folder );
-protected:
-	struct FileScanFuncData {
-		BSAModel * p;
-		const BA2File * bsa;
-		std::string path;
-		QHash< QString, QStandardItem * > folderMap;
-	};
-	static bool fileListScanFunction( void * p, const BA2File::FileInfo & fd );
-	QStandardItem * insertFolder( const QString & path, qsizetype pos1, qsizetype pos2, QHash< QString, QStandardItem * > & folderMap );
-};
+	//! Sort the files of each folder by 'column', folders are always listed first and sorted by name
+	void sort( int column, Qt::SortOrder order = Qt::AscendingOrder ) override;
 
+	//! Number of files matching the current filter, 0 if there is no filter
+	int filterMatches() const { return ( view ? int( view->matches.size() ) : 0 ); }
 
-class BSAProxyModel : public QSortFilterProxyModel
-{
-	Q_OBJECT
+public slots:
+	//! Show only the files matching the wildcard 'pattern' ('*' and '?'), and the folders containing them
+	void setFilter( const QString & pattern );
+	void setFilterByNameOnly( bool nameOnly );
 
-public:
-	BSAProxyModel( QObject * parent = nullptr );
+signals:
+	//! Emitted when the results of setFilter() have been applied to the model
+	void filterApplied( bool filtered );
 
-	void setFiletypes( QStringList types );
+protected:
+	struct Row
+	{
+		std::int32_t	id;
+		bool	isFolder;
+	};
 
-	void resetFilter();
+	struct Folder
+	{
+		std::string	name;
+		std::int32_t	parent;
+		// sorted, folders first
+		std::vector< Row >	children;
+	};
 
-public slots:
-	void setFilterByNameOnly( bool nameOnly );
+	struct File
+	{
+		std::string	path;
+		// lower case path for filtering, and the offset of the file name in it
+		std::string	lowerPath;
+		std::int32_t	nameOffset;
+		std::int32_t	folder;
+		qint64	size;
+	};
 
-protected:
-	bool filterAcceptsRow( int sourceRow, const QModelIndex & sourceParent ) const;
-	bool lessThan( const QModelIndex & left, const QModelIndex & right ) const;
+	//! Immutable after fillModel(), shared with the filter thread
+	struct FileIndex
+	{
+		std::vector< Folder >	folders;
+		std::vector< File >	files;
+	};
 
-private:
-	QStringList filetypes;
-	bool filterByNameOnly = false;
+	//! Rows shown for the current filter
+	struct View
+	{
+		std::vector< std::vector< Row > >	visible;
+		// row of each folder in the visible rows of its parent
+		std::vector< std::int32_t >	folderRow;
+		// files matching the filter, used for refining it
+		std::vector< std::int32_t >	matches;
+	};
+
+	struct ScanData;
+	static bool fileListScanFunction( void * p, const BA2File::FileInfo & fd );
+	static std::int32_t insertFolder( FileIndex & fileIndex, std::unordered_map< std::string, std::int32_t > & folderMap,
+										const std::string & path, size_t pos1, size_t pos2 );
+	static bool wildcardMatch( const std::string_view & text, const std::string_view & pattern );
+	static std::shared_ptr< View > filterFiles(
+		const FileIndex & fileIndex, const std::string & pattern, bool nameOnly, int column, Qt::SortOrder order,
+		const std::vector< std::int32_t > * candidates, const std::atomic< int > * generation, int jobGeneration );
+	void applyFilter( std::shared_ptr< View > newView, int jobGeneration, const std::string & pattern, bool nameOnly );
+	//! Queue a filter job, changes made before returning to the event loop are applied by a single job
+	void startFilter();
+	void runFilter();
+
+	const Row * row( const QModelIndex & index ) const;
+	std::int32_t folderId( const QModelIndex & index ) const;
+
+	std::shared_ptr< const FileIndex >	fileIndex;
+	std::shared_ptr< View >	view;
+	// rows of each folder that have been fetched
+	std::vector< std::int32_t >	fetched;
+
+	QString	filterPattern;
+	bool	filterByNameOnly = false;
+	int	sortColumn = 0;
+	Qt::SortOrder	sortOrder = Qt::AscendingOrder;
+	bool	filterQueued = false;
+	// the filter that produced view->matches
+	std::string	lastPattern;
+	bool	lastNameOnly = false;
+	std::atomic< int >	filterGeneration = 0;
+	QThreadPool	filterPool;
 };
 
 #endif
@@ -1192,6 +1192,12 @@ public:
 		return rotation * v * scale + translation;
 	}
 
+	//! Equality operator
+	bool operator==( const Transform & other ) const
+	{
+		return scale == other.scale && translation == other.translation && rotation == other.rotation;
+	}
+
 	//! Returns a matrix holding the transform
 	Matrix4 toMatrix4() const;
 
@@ -7,11 +7,24 @@
 #include "model/nifmodel.h"
 
 #include <QSettings>
+#include <QApplication>
 #include <QCoreApplication>
+#include <QThread>
 #include <QProgressDialog>
 #include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QStringBuilder>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cstring>
 
 namespace Game
 {
@@ -73,6 +86,13 @@ static const ResourceListMap FOLDERS = {
 };
 
 std::uint64_t	GameManager::material_db_prv_id = 0;
+std::recursive_mutex	GameManager::resourceMutex;
+std::mutex	GameManager::preloadMutex;
+std::shared_mutex	GameManager::archiveMutex;
+std::uint32_t	GameManager::resourceGeneration = 1;
+int	GameManager::fileCacheSize = 256 << 10;
+std::uint64_t	GameManager::fileCacheHits = 0;
+std::uint64_t	GameManager::fileCacheMisses = 0;
 GameManager::GameResources	GameManager::archives[NUM_GAMES];
 std::unordered_map< const NifModel *, GameManager::GameResources * >	GameManager::nifResourceMap;
 QString	GameManager::gamePaths[NUM_GAMES];
@@ -108,6 +128,7 @@ static const auto GAME_PATHS = QString("Game Paths");
 static const auto GAME_FOLDERS = QString("Game Folders");
 static const auto GAME_STATUS = QString("Game Status");
 static const auto GAME_MGR_VER = QString("Game Manager Version");
+static const auto GAME_LAST = QString("Game Manager Last Game");
 
 QString registry_game_path( const QString& key )
 {
@@ -163,6 +184,9 @@ GameMode ModeForString( QString game )
 
 QProgressDialog* prog_dialog( QString title )
 {
+	// no dialog in command line mode
+	if ( !qobject_cast<QApplication*>( QCoreApplication::instance() ) )
+		return nullptr;
 	QProgressDialog* dlg = new QProgressDialog(title, {}, 0, NUM_GAMES);
 	dlg->setAttribute(Qt::WA_DeleteOnClose);
 	dlg->show();
@@ -177,42 +201,501 @@ void process( QProgressDialog* dlg, int i )
 	}
 }
 
+static void resource_error( const QString & msg )
+{
+	// message boxes can only be shown from the GUI thread
+	if ( QThread::currentThread() == QCoreApplication::instance()->thread() )
+		QMessageBox::critical( nullptr, "NifSkope error", msg );
+	else
+		qWarning() << msg;
+}
+
+/*!
+ * Index of all files found in a set of data paths. For each file, the 64-bit hash of its name is stored
+ * with the data path and the archive it is in, and its packed and unpacked size and archive type. The
+ * index is written to the cache folder after the archives are opened, and allows later sessions to look
+ * up files without opening the archives, and to extract a file by opening only the archive that contains
+ * it. It is keyed by the game and the list of data paths, and is discarded if the size or modification
+ * time of any of the paths or of the archives in them has changed.
+ */
+class GameManager::ArchiveIndex
+{
+public:
+	static constexpr std::uint32_t	fileVersion = 2;
+
+	static std::uint64_t hash( const std::string_view & fileName )
+	{
+		// FNV-1a
+		std::uint64_t	h = 0xCBF29CE484222325ULL;
+		for ( unsigned char c : fileName )
+			h = ( h ^ c ) * 0x00000100000001B3ULL;
+		return h;
+	}
+
+	~ArchiveIndex()
+	{
+		for ( BA2File * a : openArchives )
+			delete a;
+	}
+
+	//! Map the index file if it exists and matches the current state of the data paths
+	bool open( GameMode game, const QStringList & paths )
+	{
+		file.setFileName( filePath( game, paths ) );
+		if ( !file.open( QIODevice::ReadOnly ) )
+			return false;
+		QByteArray	stamp( sourceStamp( game, paths ) );
+		qint64	entryOffset = headerSize( stamp );
+		if ( file.size() < entryOffset )
+			return false;
+		const unsigned char *	p = file.map( 0, file.size() );
+		if ( !p )
+			return false;
+		std::uint32_t	h[3];
+		std::memcpy( h, p, sizeof( h ) );
+		if ( h[0] != fileMagic || h[1] != fileVersion || h[2] != std::uint32_t( stamp.size() )
+			|| std::memcmp( p + sizeof( h ), stamp.constData(), size_t( stamp.size() ) ) != 0 ) {
+			return false;
+		}
+		std::uint64_t	n[2];
+		std::memcpy( n, p + entryOffset - 16, 16 );
+		if ( n[0] > std::uint64_t( file.size() - entryOffset ) / sizeof( Entry )
+			|| n[1] != std::uint64_t( file.size() - entryOffset ) - n[0] * sizeof( Entry ) ) {
+			return false;
+		}
+		entries = reinterpret_cast< const Entry * >( p + entryOffset );
+		entryCount = size_t( n[0] );
+		QByteArray	names( QByteArray::fromRawData( reinterpret_cast< const char * >( entries + entryCount ), int( n[1] ) ) );
+		archiveNames = QString::fromUtf8( names ).split( '\n', Qt::SkipEmptyParts );
+		openArchives.assign( size_t( archiveNames.size() ), nullptr );
+		archiveGame = game;
+		return true;
+	}
+
+	bool contains( const std::string_view & fileName ) const
+	{
+		return bool( findEntry( fileName ) );
+	}
+
+	/*! Find an archived file, and open only the archive that contains it if it is not open yet
+	 *
+	 * Returns nullptr if the file is not in the index, it is a loose file, or it was found in more than one
+	 * archive with the same size, or the archive does not match the index. The caller holds resourceMutex,
+	 * and 'archive' can be used for extracting the file while the index is not deleted.
+	 */
+	const BA2File::FileInfo * findFile( const std::string_view & fileName, BA2File *& archive )
+	{
+		const Entry *	e = findEntry( fileName );
+		if ( !e || e->archive >= openArchives.size() )
+			return nullptr;
+		BA2File *&	a = openArchives[e->archive];
+		if ( !a ) {
+			a = new BA2File();
+			try {
+				a->loadArchivePath( archiveNames.at( int( e->archive ) ).toStdString().c_str(), archiveFilterFuncTable[archiveGame] );
+			} catch ( FO76UtilsError & err ) {
+				qWarning() << "Error opening indexed archive" << archiveNames.at( int( e->archive ) ) << err.what();
+			}
+		}
+		const BA2File::FileInfo *	fd = a->findFile( fileName );
+		if ( !( fd && fd->archiveType == e->archiveType && fd->packedSize == e->packedSize
+				&& fd->unpackedSize == e->unpackedSize ) ) {
+			return nullptr;
+		}
+		archive = a;
+		return fd;
+	}
+
+	/*! Return a stamp of a file that changes when its source is modified, without extracting the file
+	 *
+	 * The stamp combines the size and modification time of the archive or loose file the file is loaded from
+	 * with the type and sizes of the file in the archive. It is 0 if the source of the file is not known.
+	 * 'paths' are the data paths the index was opened with.
+	 */
+	std::uint64_t fileStamp( const std::string_view & fileName, const QStringList & paths, qint64 & size )
+	{
+		const Entry *	e = findEntry( fileName );
+		if ( !e || e->dataPath >= std::uint32_t( paths.size() ) )
+			return 0;
+		QFileInfo	f;
+		if ( e->archive < std::uint32_t( archiveNames.size() ) )
+			f.setFile( archiveNames.at( int( e->archive ) ) );
+		else
+			f.setFile( QDir( paths.at( int( e->dataPath ) ) ), QString::fromUtf8( fileName.data(), qsizetype( fileName.length() ) ) );
+		if ( !f.exists() )
+			return 0;
+		std::uint64_t	h = 0xCBF29CE484222325ULL;
+		auto	addValue = [&h]( std::uint64_t v ) {
+			for ( int i = 0; i < 8; i++, v = v >> 8 )
+				h = ( h ^ ( v & 0xFF ) ) * 0x00000100000001B3ULL;
+		};
+		addValue( std::uint64_t( f.size() ) );
+		addValue( std::uint64_t( f.lastModified().toMSecsSinceEpoch() ) );
+		addValue( std::uint32_t( e->archiveType ) );
+		addValue( e->packedSize );
+		addValue( e->unpackedSize );
+		size = e->unpackedSize;
+		return ( h ? h : 1 );
+	}
+
+	static bool isCurrent( GameMode game, const QStringList & paths )
+	{
+		ArchiveIndex	tmp;
+		return tmp.open( game, paths );
+	}
+
+	//! Write the index of 'ba2File', which contains the files of 'paths'. Each archive in the paths is opened
+	// separately to find out which one the files are extracted from.
+	static void save( GameMode game, const QStringList & paths, BA2File & ba2File )
+	{
+		SaveData	tmp;
+		tmp.ba2File = &ba2File;
+		ba2File.scanFileList( &scanFunction, &tmp );
+
+		QStringList	names;
+		for ( int i = 0; i < paths.size(); i++ ) {
+			tmp.dataPath = std::uint32_t( i );
+			if ( QFileInfo( paths.at( i ) ).isDir() ) {
+				// loose files are resolved to the data path if they are found in only one of them
+				for ( auto & [ fileName, e ] : tmp.files ) {
+					if ( e.archiveType == 64 && QFileInfo( QDir( paths.at( i ) ), QString::fromUtf8( fileName.data(), qsizetype( fileName.length() ) ) ).isFile() )
+						tmp.addSource( e, tmp.dataPath, noArchive );
+				}
+			}
+			for ( const QString & a : archiveFiles( paths.at( i ) ) ) {
+				BA2File	archive;
+				try {
+					archive.loadArchivePath( a.toStdString().c_str(), archiveFilterFuncTable[game] );
+				} catch ( FO76UtilsError & ) {
+					continue;
+				}
+				tmp.archive = std::uint32_t( names.size() );
+				names.append( a );
+				archive.scanFileList( &archiveScanFunction, &tmp );
+			}
+		}
+
+		std::vector< Entry >	entries;
+		entries.reserve( tmp.files.size() );
+		for ( auto & [ fileName, e ] : tmp.files ) {
+			if ( e.sourceCount != 1 ) {
+				e.dataPath = noArchive;
+				e.archive = noArchive;
+			}
+			e.sourceCount = 0;
+			entries.push_back( e );
+		}
+		std::sort( entries.begin(), entries.end(), []( const Entry & a, const Entry & b ) {
+			return ( a.hash < b.hash );
+		} );
+		QByteArray	nameData( names.join( '\n' ).toUtf8() );
+
+		QByteArray	stamp( sourceStamp( game, paths ) );
+		QByteArray	header( int( headerSize( stamp ) ), '\0' );
+		std::uint32_t	h[3] = { fileMagic, fileVersion, std::uint32_t( stamp.size() ) };
+		std::uint64_t	n[2] = { entries.size(), std::uint64_t( nameData.size() ) };
+		std::memcpy( header.data(), h, sizeof( h ) );
+		std::memcpy( header.data() + sizeof( h ), stamp.constData(), size_t( stamp.size() ) );
+		std::memcpy( header.data() + header.size() - 16, n, 16 );
+
+		if ( !QDir().mkpath( folder() ) )
+			return;
+		QSaveFile	f( filePath( game, paths ) );
+		if ( !f.open( QIODevice::WriteOnly ) )
+			return;
+		f.write( header );
+		f.write( reinterpret_cast< const char * >( entries.data() ), qint64( entries.size() * sizeof( Entry ) ) );
+		f.write( nameData );
+		f.commit();
+	}
+
+protected:
+	static constexpr std::uint32_t	fileMagic = 0x49415346;	// "FSAI"
+	static constexpr std::uint32_t	noArchive = 0xFFFFFFFFU;
+
+	//! Location and size of a file, packedSize is 0 if the file is not compressed
+	struct Entry
+	{
+		std::uint64_t	hash;
+		//! Index of the data path and of the archive in archiveNames, noArchive if the source is unknown
+		std::uint32_t	dataPath;
+		std::uint32_t	archive;
+		std::int32_t	archiveType;
+		std::uint32_t	packedSize;
+		std::uint32_t	unpackedSize;
+		//! Number of archives or data paths the file was found in while saving, 0 in the file
+		std::uint32_t	sourceCount;
+	};
+	static_assert( sizeof( Entry ) == 32 );
+
+	struct SaveData
+	{
+		BA2File *	ba2File = nullptr;
+		std::unordered_map< std::string_view, Entry >	files;
+		std::uint32_t	dataPath = 0;
+		std::uint32_t	archive = 0;
+
+		void addSource( Entry & e, std::uint32_t dataPath, std::uint32_t archive )
+		{
+			e.dataPath = dataPath;
+			e.archive = archive;
+			e.sourceCount++;
+		}
+	};
+
+	QFile	file;
+	const Entry *	entries = nullptr;
+	size_t	entryCount = 0;
+	QStringList	archiveNames;
+	GameMode	archiveGame = OTHER;
+	//! Archives opened by findFile(), by index in archiveNames
+	std::vector< BA2File * >	openArchives;
+
+	const Entry * findEntry( const std::string_view & fileName ) const
+	{
+		std::uint64_t	h = hash( fileName );
+		const Entry *	e = std::lower_bound( entries, entries + entryCount, h, []( const Entry & a, std::uint64_t b ) {
+			return ( a.hash < b );
+		} );
+		if ( e == entries + entryCount || e->hash != h )
+			return nullptr;
+		return e;
+	}
+
+	//! Add the files that can be extracted from the combined archives
+	static bool scanFunction( void * p, const BA2File::FileInfo & fd )
+	{
+		Entry	e;
+		e.hash = hash( fd.fileName );
+		e.dataPath = noArchive;
+		e.archive = noArchive;
+		e.archiveType = fd.archiveType;
+		e.packedSize = fd.packedSize;
+		e.unpackedSize = fd.unpackedSize;
+		e.sourceCount = 0;
+		reinterpret_cast< SaveData * >( p )->files.emplace( fd.fileName, e );
+		return false;
+	}
+
+	//! Find the files of an archive opened separately that match the ones in the combined archives
+	static bool archiveScanFunction( void * p, const BA2File::FileInfo & fd )
+	{
+		SaveData &	o = *( reinterpret_cast< SaveData * >( p ) );
+		auto	i = o.files.find( fd.fileName );
+		if ( i != o.files.end() && i->second.archiveType == fd.archiveType && i->second.packedSize == fd.packedSize
+			&& i->second.unpackedSize == fd.unpackedSize ) {
+			o.addSource( i->second, o.dataPath, o.archive );
+		}
+		return false;
+	}
+
+	//! Magic, version, stamp size and stamp, padded to a multiple of 8 bytes, followed by the entry count
+	// and the size of the archive names
+	static qint64 headerSize( const QByteArray & stamp )
+	{
+		return ( ( 12 + qint64( stamp.size() ) + 7 ) & ~qint64( 7 ) ) + 16;
+	}
+
+	static QString folder()
+	{
+		return QStandardPaths::writableLocation( QStandardPaths::CacheLocation ) + "/archives";
+	}
+
+	static QString filePath( GameMode game, const QStringList & paths )
+	{
+		QCryptographicHash	h( QCryptographicHash::Md5 );
+		h.addData( QByteArray::number( int( game ) ) );
+		for ( const auto & i : paths ) {
+			h.addData( "\n", 1 );
+			h.addData( i.toUtf8() );
+		}
+		return folder() % "/" % QString::fromLatin1( h.result().toHex() ) % ".idx";
+	}
+
+	//! Archives in a data path including its subfolders, or the path itself if it is an archive
+	static QStringList archiveFiles( const QString & path )
+	{
+		QFileInfo	f( path );
+		if ( !f.isDir() )
+			return { f.absoluteFilePath() };
+		QStringList	tmp;
+		QDirIterator	i( path, { "*.bsa", "*.ba2" }, QDir::Files, QDirIterator::Subdirectories );
+		while ( i.hasNext() )
+			tmp.append( i.next() );
+		tmp.sort();
+		return tmp;
+	}
+
+	//! Game, paths, and the size and modification time of each path and of each archive in folders
+	static QByteArray sourceStamp( GameMode game, const QStringList & paths )
+	{
+		QString	s = QString::number( int( game ) );
+		auto	addFile = [&s]( const QFileInfo & f ) {
+			s += QString( "\n%1|%2|%3" ).arg( f.absoluteFilePath() ).arg( f.isDir() ? -1 : f.size() )
+					.arg( f.lastModified().toMSecsSinceEpoch() );
+		};
+		for ( const auto & i : paths ) {
+			QFileInfo	f( i );
+			addFile( f );
+			if ( !f.isDir() )
+				continue;
+			for ( const auto & a : archiveFiles( i ) )
+				addFile( QFileInfo( a ) );
+		}
+		return s.toUtf8();
+	}
+};
+
+ResourceLoadNotifier * ResourceLoadNotifier::get()
+{
+	static ResourceLoadNotifier *	notifier = new ResourceLoadNotifier();
+	return notifier;
+}
+
 GameManager::GameResources::~GameResources()
 {
 	if ( sfMaterials && !( parent && sfMaterials == parent->sfMaterials ) )
 		delete sfMaterials;
-	if ( ba2File )
+	if ( ba2File ) {
+		std::unique_lock< std::shared_mutex >	archiveLock( archiveMutex );
 		delete ba2File;
+	}
+	close_archive_index();
+	if ( preload.valid() )
+		preload.wait();
+	delete preloadedArchives;
+	delete preloadedMaterials;
+}
+
+void GameManager::GameResources::wait_for_preload() const
+{
+	for ( const GameResources * r = this; r; r = r->parent ) {
+		std::shared_future< void >	f;
+		{
+			std::lock_guard< std::mutex >	lock( preloadMutex );
+			f = r->preload;
+		}
+		if ( f.valid() )
+			f.wait();
+	}
+}
+
+bool GameManager::GameResources::is_loading() const
+{
+	for ( const GameResources * r = this; r; r = r->parent ) {
+		if ( r->preload_pending() )
+			return true;
+	}
+	return false;
+}
+
+bool GameManager::GameResources::preload_pending() const
+{
+	std::lock_guard< std::mutex >	lock( preloadMutex );
+	return ( preload.valid() && preload.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready );
+}
+
+bool GameManager::GameResources::take_preloaded()
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	{
+		std::lock_guard< std::mutex >	lock2( preloadMutex );
+		if ( !( preload.valid() && preload.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready ) )
+			return false;
+		preload = std::shared_future< void >();
+	}
+	BA2File *	a = preloadedArchives;
+	CE2MaterialDB *	m = preloadedMaterials;
+	preloadedArchives = nullptr;
+	preloadedMaterials = nullptr;
+	// the archives may have been opened, or the settings changed, while loading
+	if ( ba2File || preloadPaths != archive_paths() ) {
+		delete m;
+		delete a;
+		return false;
+	}
+
+	invalidate_lookups();
+	clear_file_cache();
+	close_archive_index();
+	ba2File = a;
+	if ( m ) {
+		close_materials();
+		sfMaterials = m;
+		sfMaterialDB_ID = ++GameManager::material_db_prv_id;
+	}
+	return true;
+}
+
+QStringList GameManager::GameResources::archive_paths() const
+{
+	QStringList	tmp;
+	if ( gameStatus[game] ) {
+		tmp = dataPaths;
+		if ( !parent && otherGamesFallback && game != OTHER && gameStatus[OTHER] )
+			tmp.append( archives[OTHER].dataPaths );
+	}
+	return tmp;
+}
+
+bool GameManager::GameResources::open_archive_index()
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	// the data paths or the settings may have changed since the index was opened
+	if ( archiveIndexGeneration != resourceGeneration ) {
+		close_archive_index();
+		archiveIndexGeneration = resourceGeneration;
+		QStringList	tmp( archive_paths() );
+		if ( !tmp.isEmpty() ) {
+			archiveIndex = new ArchiveIndex();
+			if ( !archiveIndex->open( game, tmp ) ) {
+				delete archiveIndex;
+				archiveIndex = nullptr;
+			}
+		}
+	}
+	return bool( archiveIndex );
 }
 
 void GameManager::GameResources::init_archives()
 {
+	// callers that need the archives wait for the background load before locking resourceMutex
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	if ( !ba2File && take_preloaded() )
+		return;
+	invalidate_lookups();
+	clear_file_cache();
 	if ( sfMaterialDB_ID )
 		close_materials();
 	if ( ba2File ) {
+		// wait for files being extracted by other threads
+		std::unique_lock< std::shared_mutex >	archiveLock( archiveMutex );
 		delete ba2File;
 		ba2File = nullptr;
 	}
 
-	if ( parent && !parent->ba2File )
+	close_archive_index();
+
+	// a parent being loaded in the background takes the results on its next lookup
+	if ( parent && !parent->ba2File && !parent->preload_pending() )
 		parent->init_archives();
 
-	QStringList	tmp;
-	if ( gameStatus[game] ) {
-		tmp = dataPaths;
-		if ( !parent && otherGamesFallback && game != OTHER && gameStatus[OTHER] )
-			tmp.append( archives[OTHER].dataPaths );
-	}
+	QStringList	tmp( archive_paths() );
 	if ( tmp.isEmpty() )
 		return;
 	ba2File = new BA2File();
+	bool	haveErrors = false;
 	for ( const auto & i : tmp ) {
 		try {
 			ba2File->loadArchivePath( i.toStdString().c_str(), archiveFilterFuncTable[game] );
 		} catch ( FO76UtilsError & e ) {
-			QMessageBox::critical( nullptr, "NifSkope error", QString("Error opening resource path '%1': %2").arg(i).arg(e.what()) );
+			resource_error( QString("Error opening resource path '%1': %2").arg(i).arg(e.what()) );
+			haveErrors = true;
 		}
 	}
+	// archives that failed to load could be fixed without their modification time changing
+	if ( !haveErrors && ba2File->size() > 0 && !ArchiveIndex::isCurrent( game, tmp ) )
+		ArchiveIndex::save( game, tmp, *ba2File );
 }
 
 static bool archiveScanFunctionMat( [[maybe_unused]] void * p, const BA2File::FileInfo & fd )
@@ -227,6 +710,11 @@ CE2MaterialDB * GameManager::GameResources::init_materials()
 	if ( game != STARFIELD )
 		return nullptr;
 
+	wait_for_preload();
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	// use the database loaded in the background if there is one
+	if ( take_preloaded() && sfMaterialDB_ID )
+		return sfMaterials;
 	close_materials();
 
 	if ( parent && !parent->sfMaterialDB_ID )
@@ -251,7 +739,7 @@ CE2MaterialDB * GameManager::GameResources::init_materials()
 	try {
 		sfMaterials->loadArchives( *ba2File );
 	} catch ( FO76UtilsError & e ) {
-		QMessageBox::critical( nullptr, "NifSkope error", QString("Error loading Starfield material database: %1").arg(e.what()) );
+		resource_error( QString("Error loading Starfield material database: %1").arg(e.what()) );
 	}
 
 	return sfMaterials;
@@ -259,16 +747,33 @@ CE2MaterialDB * GameManager::GameResources::init_materials()
 
 void GameManager::GameResources::close_archives()
 {
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	invalidate_lookups();
+	clear_file_cache();
 	if ( sfMaterialDB_ID )
 		close_materials();
 	if ( ba2File ) {
+		// wait for files being extracted by other threads
+		std::unique_lock< std::shared_mutex >	archiveLock( archiveMutex );
 		delete ba2File;
 		ba2File = nullptr;
 	}
+	close_archive_index();
+}
+
+void GameManager::GameResources::close_archive_index()
+{
+	if ( !archiveIndex )
+		return;
+	// wait for files being extracted by other threads from archives opened by the index
+	std::unique_lock< std::shared_mutex >	archiveLock( archiveMutex );
+	delete archiveIndex;
+	archiveIndex = nullptr;
 }
 
 void GameManager::GameResources::close_materials()
 {
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
 	if ( sfMaterialDB_ID && !parent ) {
 		for ( auto i = GameManager::nifResourceMap.begin(); i != GameManager::nifResourceMap.end(); i++ ) {
 			if ( i->second->parent == this )
@@ -283,12 +788,75 @@ void GameManager::GameResources::close_materials()
 
 QString GameManager::GameResources::find_file( const std::string_view & fullPath )
 {
-	if ( !ba2File && !dataPaths.isEmpty() )
-		init_archives();
-	if ( ba2File && ba2File->findFile( fullPath ) )
-		return QString::fromUtf8( fullPath.data(), qsizetype(fullPath.length()) );
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	if ( findCacheGeneration == resourceGeneration ) {
+		auto	i = findCache.find( std::string( fullPath ) );
+		if ( i != findCache.end() )
+			return i->second;
+	}
+
+	// results found while the archives are still being loaded may be incomplete and are not cached
+	bool	loading = is_loading();
+
+	// use the index saved by a previous session if the archives have not been opened yet
+	if ( !ba2File )
+		take_preloaded();
+	bool	looseFilesOnly = false;
+	if ( !ba2File && !dataPaths.isEmpty() && !open_archive_index() ) {
+		// do not wait for the background load, only loose files can be found until it is finished
+		if ( preload_pending() )
+			looseFilesOnly = true;
+		else
+			init_archives();
+	}
+	bool	found = false;
+	if ( ba2File ) {
+		found = bool( ba2File->findFile( fullPath ) );
+	} else if ( looseFilesOnly ) {
+		found = ( archiveFilterFuncTable[game]( nullptr, fullPath ) && !find_loose_file( fullPath ).isEmpty() );
+	} else if ( archiveIndex ) {
+		// loose files may have been added without changing the modification time of the data path
+		found = archiveIndex->contains( fullPath )
+				|| ( archiveFilterFuncTable[game]( nullptr, fullPath ) && !find_loose_file( fullPath ).isEmpty() );
+	}
+	QString	result;
+	if ( found )
+		result = QString::fromUtf8( fullPath.data(), qsizetype(fullPath.length()) );
+	else if ( parent )
+		result = parent->find_file( fullPath );
+
+	if ( loading )
+		return result;
+	// opening the archives above invalidates the previous results
+	if ( findCacheGeneration != resourceGeneration ) {
+		findCache.clear();
+		findCacheGeneration = resourceGeneration;
+	}
+	findCache.emplace( fullPath, result );
+	return result;
+}
+
+QString GameManager::GameResources::find_loose_file( const std::string_view & fullPath ) const
+{
+	QString	fileName( QString::fromUtf8( fullPath.data(), qsizetype(fullPath.length()) ) );
+	for ( const auto & i : archive_paths() ) {
+		QFileInfo	f( QDir( i ), fileName );
+		if ( f.isFile() )
+			return f.absoluteFilePath();
+	}
+	return QString();
+}
+
+QString GameManager::GameResources::loose_file_path( const std::string_view & fullPath ) const
+{
+	QString	fileName( QString::fromUtf8( fullPath.data(), qsizetype(fullPath.length()) ) );
+	for ( const auto & i : dataPaths ) {
+		QFileInfo	f( QDir( i ), fileName );
+		if ( f.isFile() )
+			return f.absoluteFilePath();
+	}
 	if ( parent )
-		return parent->find_file( fullPath );
+		return parent->loose_file_path( fullPath );
 	return QString();
 }
 
@@ -299,34 +867,131 @@ static unsigned char * byteArrayAllocFunc( void * bufPtr, size_t nBytes )
 	return reinterpret_cast< unsigned char * >( p->data() );
 }
 
-bool GameManager::GameResources::get_file( QByteArray & data, const std::string_view & fullPath )
+bool GameManager::GameResources::get_file( QByteArray & data, const std::string_view & fullPath, std::uint32_t flags )
 {
-	if ( !ba2File && !dataPaths.isEmpty() )
-		init_archives();
+	if ( !can_wait_for_resources() )
+		flags |= FileNoWait;
+
+	// loose files are read without waiting for the archives being loaded in the background
+	if ( is_loading() ) {
+		QString	looseFile;
+		{
+			std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+			looseFile = loose_file_path( fullPath );
+		}
+		QFile	f( looseFile );
+		if ( !looseFile.isEmpty() && f.open( QIODevice::ReadOnly ) ) {
+			data = f.readAll();
+			return true;
+		}
+	}
+	std::unique_lock< std::recursive_mutex >	lock( resourceMutex );
+	QByteArray	key( fullPath.data(), int(fullPath.length()) );
+	if ( !( flags & FileCacheNoLookup ) ) {
+		if ( const QByteArray * p = fileCache.object( key ) ) {
+			data = *p;
+			fileCacheHits++;
+			return true;
+		}
+	}
+
+	BA2File *	archive = nullptr;
 	const BA2File::FileInfo *	fd = nullptr;
-	if ( ba2File )
+	if ( !ba2File && !dataPaths.isEmpty() && !take_preloaded() ) {
+		// use the saved index to extract the file from the only archive that contains it, without waiting
+		// for the background load or opening all archives, unless a loose file may override it
+		bool	haveIndex = open_archive_index();
+		if ( haveIndex && archiveFilterFuncTable[game]( nullptr, fullPath ) ) {
+			QFile	f( find_loose_file( fullPath ) );
+			if ( f.fileName().isEmpty() ) {
+				fd = archiveIndex->findFile( fullPath, archive );
+			} else {
+				lock.unlock();
+				if ( f.open( QIODevice::ReadOnly ) ) {
+					data = f.readAll();
+					return true;
+				}
+				lock.lock();
+			}
+		}
+		// files that are not in the index are looked up in the parent
+		if ( !fd && !( haveIndex && !archiveIndex->contains( fullPath ) ) ) {
+			if ( preload_pending() ) {
+				// the file is pending, callers that cannot wait request it again when the load is finished
+				if ( flags & FileNoWait ) {
+					data.resize( 0 );
+					return false;
+				}
+				lock.unlock();
+				wait_for_preload();
+				lock.lock();
+			}
+			if ( !ba2File )
+				init_archives();
+		}
+	}
+	if ( !fd && ba2File ) {
+		archive = ba2File;
 		fd = ba2File->findFile( fullPath );
+	}
 	if ( !fd ) {
+		// the lock is recursive, holding it while the parent extracts the file would serialize all threads
+		lock.unlock();
 		if ( parent )
-			return parent->get_file( data, fullPath );
+			return parent->get_file( data, fullPath, flags );
 		qWarning() << "File '" << QLatin1String( fullPath.data(), qsizetype(fullPath.length()) ) << "' not found in archives";
 		data.resize( 0 );
 		return false;
 	}
-	try {
-		ba2File->extractFile( &data, &byteArrayAllocFunc, *fd );
-	} catch ( FO76UtilsError & e ) {
-		if ( std::string_view(e.what()).starts_with( "BA2File: unexpected change to size of loose file" ) ) {
+
+	// decompress without holding resourceMutex, so that several threads can extract files at the same time,
+	// archiveMutex prevents the archives from being closed in the meantime
+	std::uint32_t	generation = resourceGeneration;
+	// archive type 64 is a loose file in one of the data paths
+	bool	isLooseFile = ( fd->archiveType == 64 );
+	std::string	errorMessage;
+	{
+		std::shared_lock< std::shared_mutex >	archiveLock( archiveMutex );
+		lock.unlock();
+		try {
+			archive->extractFile( &data, &byteArrayAllocFunc, *fd );
+		} catch ( FO76UtilsError & e ) {
+			errorMessage = e.what();
+		}
+	}
+	lock.lock();
+	if ( !errorMessage.empty() ) {
+		if ( errorMessage.starts_with( "BA2File: unexpected change to size of loose file" ) ) {
 			close_archives();
-			return get_file( data, fullPath );
+			lock.unlock();
+			return get_file( data, fullPath, flags );
 		}
-		QMessageBox::critical( nullptr, "NifSkope error", QString("Error loading resource file '%1': %2").arg( QLatin1String( fullPath.data(), qsizetype(fullPath.length()) ) ).arg( e.what() ) );
+		resource_error( QString("Error loading resource file '%1': %2").arg( QLatin1String( fullPath.data(), qsizetype(fullPath.length()) ) ).arg( errorMessage.c_str() ) );
 		data.resize( 0 );
 		return false;
 	}
+
+	if ( !( flags & FileCacheNoLookup ) )
+		fileCacheMisses++;
+	// loose files are not cached, so that changes to them are picked up; the archives may also have been
+	// reopened while the file was being extracted
+	if ( !( flags & FileCacheNoInsert ) && fileCacheSize > 0 && generation == resourceGeneration && !isLooseFile ) {
+		if ( fileCache.maxCost() != fileCacheSize )
+			fileCache.setMaxCost( fileCacheSize );
+		int	cost = int( ( qint64( data.size() ) + 1023 ) >> 10 );
+		// very large files would evict most of the cache
+		if ( cost <= fileCacheSize / 4 )
+			fileCache.insert( key, new QByteArray( data ), cost );
+	}
 	return true;
 }
 
+void GameManager::GameResources::clear_file_cache()
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	fileCache.clear();
+}
+
 struct list_files_scan_function_data {
 	std::set< std::string_view > * fileSet;
 	bool (*filterFunc)( void * p, const std::string_view & fileName );
@@ -345,6 +1010,8 @@ void GameManager::GameResources::list_files(
 	std::set< std::string_view > & fileSet,
 	bool (*fileListFilterFunc)( void * p, const std::string_view & fileName ), void * fileListFilterFuncData )
 {
+	wait_for_preload();
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
 	if ( parent )
 		parent->list_files( fileSet, fileListFilterFunc, fileListFilterFuncData );
 	// make sure that archives are loaded
@@ -370,7 +1037,8 @@ GameManager::GameManager()
 		auto dlg = prog_dialog( "Initializing the Game Manager" );
 		// Initial game manager settings
 		init_settings( manager_version, dlg );
-		dlg->close();
+		if ( dlg )
+			dlg->close();
 	}
 
 	if ( manager_version == 1 ) {
@@ -378,6 +1046,12 @@ GameManager::GameManager()
 	}
 
 	load();
+
+	// created here so that it belongs to the GUI thread
+	(void) ResourceLoadNotifier::get();
+	// start loading the resources of the game used last
+	if ( settings.contains( GAME_LAST ) )
+		preload( ModeForString( settings.value( GAME_LAST ).toString() ) );
 }
 
 GameMode GameManager::get_game( const NifModel * nif )
@@ -539,7 +1213,10 @@ GameManager::GameResources * GameManager::addNIFResourcePath( const NifModel * n
 	if ( !nif ) [[unlikely]]
 		return &(GameManager::archives[OTHER]);
 
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
 	GameMode	game = get_game( nif );
+	// open the archives while the rest of the file is being loaded
+	preload( game );
 	auto	i = nifResourceMap.find( nif );
 	if ( i != nifResourceMap.end() ) {
 		if ( ( dataPath.isEmpty() && i->second->dataPaths.isEmpty() ) || i->second->dataPaths.startsWith( dataPath ) ) {
@@ -572,6 +1249,7 @@ GameManager::GameResources * GameManager::addNIFResourcePath( const NifModel * n
 
 void GameManager::removeNIFResourcePath( const NifModel * nif )
 {
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
 	auto	i = nifResourceMap.find( nif );
 	if ( i == nifResourceMap.end() )
 		return;
@@ -582,6 +1260,25 @@ void GameManager::removeNIFResourcePath( const NifModel * nif )
 		delete r;
 }
 
+GameManager::GameResources * GameManager::acquireNIFResources( const NifModel * nif )
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	GameResources *	r = &( getNIFResources( nif ) );
+	r->refCnt++;
+	return r;
+}
+
+void GameManager::releaseResources( GameResources * r )
+{
+	if ( !r )
+		return;
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	r->refCnt--;
+	// the resources of the games are never deleted
+	if ( r->refCnt < 0 && r->parent )
+		delete r;
+}
+
 std::string GameManager::get_full_path( const QString & name, const char * archive_folder, const char * extension )
 {
 	if ( name.isEmpty() )
@@ -614,6 +1311,91 @@ std::string GameManager::get_full_path( const QString & name, const char * archi
 	return s;
 }
 
+std::shared_future< void > GameManager::preload( const GameMode game )
+{
+	std::promise< void >	done;
+	std::shared_future< void >	ready( done.get_future().share() );
+	if ( !( game >= OTHER && game < NUM_GAMES ) ) {
+		done.set_value();
+		return ready;
+	}
+
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	GameResources &	r = archives[game];
+	{
+		std::lock_guard< std::mutex >	lock2( preloadMutex );
+		if ( r.preload.valid() )
+			return r.preload;
+	}
+	QStringList	paths( r.archive_paths() );
+	if ( r.ba2File || paths.isEmpty() ) {
+		done.set_value();
+		return ready;
+	}
+
+	{
+		std::lock_guard< std::mutex >	lock2( preloadMutex );
+		r.preload = ready;
+	}
+	r.preloadPaths = paths;
+	auto	p = std::make_shared< std::promise< void > >( std::move( done ) );
+
+	// the loader thread does not lock resourceMutex, it only writes the preloaded* fields of 'r',
+	// which are not accessed by other threads until the future is ready
+	QThreadPool::globalInstance()->start( [&r, game, paths, p]() {
+		ResourceLoadNotifier *	notifier = ResourceLoadNotifier::get();
+		QString	gameName( StringForMode( game ) );
+		int	steps = int( paths.size() ) + ( game == STARFIELD ? 1 : 0 );
+		bool	haveErrors = false;
+		BA2File *	a = new BA2File();
+		for ( int i = 0; i < int( paths.size() ); i++ ) {
+			emit notifier->loadProgress( QString( "Opening %1 archives..." ).arg( gameName ), i, steps );
+			try {
+				a->loadArchivePath( paths[i].toStdString().c_str(), archiveFilterFuncTable[game] );
+			} catch ( FO76UtilsError & e ) {
+				resource_error( QString("Error opening resource path '%1': %2").arg(paths[i]).arg(e.what()) );
+				haveErrors = true;
+			}
+		}
+		if ( !haveErrors && a->size() > 0 && !ArchiveIndex::isCurrent( game, paths ) )
+			ArchiveIndex::save( game, paths, *a );
+
+		CE2MaterialDB *	m = nullptr;
+		if ( game == STARFIELD && a->scanFileList( &archiveScanFunctionMat ) ) {
+			emit notifier->loadProgress( QString( "Loading Starfield material database..." ), steps - 1, steps );
+			m = new CE2MaterialDB();
+			try {
+				m->loadArchives( *a );
+			} catch ( FO76UtilsError & e ) {
+				resource_error( QString("Error loading Starfield material database: %1").arg(e.what()) );
+			}
+		}
+
+		r.preloadedArchives = a;
+		r.preloadedMaterials = m;
+		p->set_value();
+		emit notifier->loadProgress( QString(), steps, steps );
+		emit notifier->loadFinished( int( game ) );
+	} );
+
+	return ready;
+}
+
+bool GameManager::can_wait_for_resources()
+{
+	QCoreApplication *	app = QCoreApplication::instance();
+	return !( qobject_cast< QApplication * >( app ) && QThread::currentThread() == app->thread() );
+}
+
+void GameManager::set_last_game( const GameMode game )
+{
+	if ( !status( game ) )
+		return;
+	QSettings	settings;
+	if ( settings.value( GAME_LAST ).toString() != StringForMode( game ) )
+		settings.setValue( GAME_LAST, StringForMode( game ) );
+}
+
 QString GameManager::find_file(
 	const GameMode game, const QString & path, const char * archiveFolder, const char * extension )
 {
@@ -623,18 +1405,66 @@ QString GameManager::find_file(
 	return archives[game].find_file( fullPath );
 }
 
-bool GameManager::get_file( QByteArray & data, const GameMode game, const std::string_view & fullPath )
+bool GameManager::get_file(
+	QByteArray & data, const GameMode game, const std::string_view & fullPath, std::uint32_t flags )
 {
 	if ( !( game >= OTHER && game < NUM_GAMES ) )
 		return false;
-	return archives[game].get_file( data, fullPath );
+	return archives[game].get_file( data, fullPath, flags );
 }
 
 bool GameManager::get_file(
-	QByteArray & data, const GameMode game, const QString & path, const char * archiveFolder, const char * extension )
+	QByteArray & data, const GameMode game,
+	const QString & path, const char * archiveFolder, const char * extension, std::uint32_t flags )
 {
 	std::string	fullPath( get_full_path(path, archiveFolder, extension) );
-	return archives[game].get_file( data, fullPath );
+	return archives[game].get_file( data, fullPath, flags );
+}
+
+GameManager::FileCacheStats GameManager::file_cache_stats()
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	FileCacheStats	s;
+	auto	addCache = [&s]( const GameResources & r ) {
+		s.count += r.fileCache.count();
+		s.bytes += qint64( r.fileCache.totalCost() ) << 10;
+	};
+	for ( const auto & r : archives )
+		addCache( r );
+	std::set< const GameResources * >	nifResources;
+	for ( const auto & i : nifResourceMap ) {
+		if ( nifResources.insert( i.second ).second )
+			addCache( *(i.second) );
+	}
+	s.hits = fileCacheHits;
+	s.misses = fileCacheMisses;
+	return s;
+}
+
+void GameManager::update_file_cache_size( int megabytes )
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	fileCacheSize = std::max( megabytes, 0 ) << 10;
+	for ( auto & r : archives )
+		r.fileCache.setMaxCost( fileCacheSize );
+	for ( auto & i : nifResourceMap )
+		i.second->fileCache.setMaxCost( fileCacheSize );
+}
+
+QString GameManager::loose_file_path( const NifModel * nif, const std::string_view & fullPath )
+{
+	if ( fullPath.empty() )
+		return QString();
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	return getNIFResources( nif ).loose_file_path( fullPath );
+}
+
+QString GameManager::loose_file_path( const GameResources & resources, const std::string_view & fullPath )
+{
+	if ( fullPath.empty() )
+		return QString();
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	return resources.loose_file_path( fullPath );
 }
 
 CE2MaterialDB * GameManager::materials( const GameMode game )
@@ -655,6 +1485,7 @@ std::uint64_t GameManager::get_material_db_id( const GameMode game )
 
 void GameManager::close_resources( bool nifResourcesFirst )
 {
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
 	bool	haveNIFResources = false;
 
 	for ( auto i = nifResourceMap.begin(); i != nifResourceMap.end(); i++ ) {
@@ -672,6 +1503,26 @@ void GameManager::close_resources( bool nifResourcesFirst )
 	}
 }
 
+std::vector< GameManager::FileStamp > GameManager::file_stamps( const GameMode game, const QStringList & fullPaths )
+{
+	std::vector< FileStamp >	stamps( size_t( fullPaths.size() ) );
+	if ( !( game >= OTHER && game < NUM_GAMES ) )
+		return stamps;
+	QStringList	paths;
+	{
+		std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+		paths = archives[game].archive_paths();
+	}
+	ArchiveIndex	idx;
+	if ( paths.isEmpty() || !idx.open( game, paths ) )
+		return stamps;
+	for ( int i = 0; i < fullPaths.size(); i++ ) {
+		FileStamp &	s = stamps[size_t(i)];
+		s.stamp = idx.fileStamp( fullPaths.at( i ).toStdString(), paths, s.size );
+	}
+	return stamps;
+}
+
 void GameManager::list_files(
 	std::set< std::string_view > & fileSet, const GameMode game,
 	bool (*fileListFilterFunc)( void * p, const std::string_view & fileName ), void * fileListFilterFuncData )
@@ -719,6 +1570,7 @@ void GameManager::load()
 	clear();
 
 	otherGamesFallback = useOther;
+	update_file_cache_size( settings.value( "Settings/Resources/File Cache Size", 256 ).toInt() );
 	for ( auto i = paths.constBegin(); i != paths.constEnd(); i++ )
 		insert_game( ModeForString( i.key() ), i.value().toString() );
 	for ( auto i = folders.constBegin(); i != folders.constEnd(); i++ )
@@ -729,6 +1581,7 @@ void GameManager::load()
 
 void GameManager::clear()
 {
+	invalidate_lookups();
 	for ( size_t i = size_t(OTHER); i < size_t(NUM_GAMES); i++ ) {
 		gamePaths[i].clear();
 		archives[i].dataPaths.clear();
@@ -747,6 +1600,7 @@ void GameManager::insert_folders( const GameMode game, const QStringList & list
 {
 	if ( !( game >= OTHER && game < NUM_GAMES ) )
 		return;
+	invalidate_lookups();
 	archives[game].dataPaths.clear();
 	for ( const auto & i : list ) {
 		if ( !i.isEmpty() )
@@ -758,6 +1612,7 @@ void GameManager::insert_status( const GameMode game, bool status )
 {
 	if ( game >= OTHER && game < NUM_GAMES )
 		gameStatus[game] = status;
+	invalidate_lookups();
 }
 
 } // end namespace Game
@@ -3,7 +3,15 @@
 
 #include "libfo76utils/src/common.hpp"
 
+#include <future>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 #include <unordered_map>
+#include <vector>
+#include <QByteArray>
+#include <QCache>
+#include <QObject>
 #include <QString>
 #include <QStringList>
 
@@ -88,6 +96,39 @@ public:
 	//! Game enabled status in the GameManager
 	static bool status( const GameMode game );
 
+	//! Flags for get_file()
+	enum FileFlags : std::uint32_t
+	{
+		//! Do not add the file to the cache of decompressed files, for bulk extraction of files used only once
+		FileCacheNoInsert = 1,
+		//! Always extract the file from the archive, even if it is in the cache
+		FileCacheNoLookup = 2,
+		FileCacheBypass = FileCacheNoInsert | FileCacheNoLookup,
+		//! Return false instead of waiting for the archives being loaded in the background, is_loading() is then
+		// still true, and the file can be requested again after ResourceLoadNotifier::loadFinished.
+		// Implied on the GUI thread, see can_wait_for_resources().
+		FileNoWait = 4
+	};
+
+	//! Usage statistics of the decompressed file caches
+	struct FileCacheStats
+	{
+		int	count = 0;
+		qint64	bytes = 0;
+		std::uint64_t	hits = 0;
+		std::uint64_t	misses = 0;
+	};
+
+	//! Persistent index of the files in a set of data paths, see GameResources::find_file()
+	class ArchiveIndex;
+
+	//! Size and modification stamp of a resource file, see file_stamps()
+	struct FileStamp
+	{
+		qint64	size = 0;
+		std::uint64_t	stamp = 0;
+	};
+
 	struct GameResources
 	{
 		GameMode	game = OTHER;
@@ -98,13 +139,44 @@ public:
 		GameResources *	parent = nullptr;
 		// list of data paths, empty for archived NIFs
 		QStringList	dataPaths;
+		// results of find_file() including files not found, valid while findCacheGeneration matches
+		std::unordered_map< std::string, QString >	findCache;
+		std::uint32_t	findCacheGeneration = 0;
+		// file index saved by a previous session, used for lookups until the archives are opened
+		ArchiveIndex *	archiveIndex = nullptr;
+		std::uint32_t	archiveIndexGeneration = 0;
+		// archives and materials opened by a background thread, see GameManager::preload()
+		std::shared_future< void >	preload;
+		QStringList	preloadPaths;
+		BA2File *	preloadedArchives = nullptr;
+		CE2MaterialDB *	preloadedMaterials = nullptr;
+		// recently extracted archived files, the cost is the size in kilobytes
+		QCache< QByteArray, QByteArray >	fileCache;
 		~GameResources();
+		//! Data paths to load, including the fallback to OTHER if enabled
+		QStringList archive_paths() const;
+		//! Map the saved file index if it is up to date, without opening the archives
+		bool open_archive_index();
+		void close_archive_index();
+		//! Return the path of a loose file in the data paths of this object, not including the parent
+		QString find_loose_file( const std::string_view & fullPath ) const;
+		//! Wait until the background loading of this object and its parent is finished, without locking
+		void wait_for_preload() const;
+		//! True if the background loading of this object or its parent has not finished yet
+		bool is_loading() const;
+		//! True if the background loading of this object has not finished yet, not including the parent
+		bool preload_pending() const;
+		//! Use the results of a finished background load if they still match the data paths
+		bool take_preloaded();
 		void init_archives();
 		CE2MaterialDB * init_materials();
 		void close_archives();
 		void close_materials();
 		QString find_file( const std::string_view & fullPath );
-		bool get_file( QByteArray & data, const std::string_view & fullPath );
+		//! Return the path on disk of 'fullPath' if it is a loose file in one of the data folders.
+		QString loose_file_path( const std::string_view & fullPath ) const;
+		bool get_file( QByteArray & data, const std::string_view & fullPath, std::uint32_t flags = 0 );
+		void clear_file_cache();
 		void list_files(
 			std::set< std::string_view > & fileSet,
 			bool (*fileListFilterFunc)( void * p, const std::string_view & fileName ), void * fileListFilterFuncData );
@@ -113,19 +185,42 @@ public:
 	static GameResources * addNIFResourcePath( const NifModel * nif, const QString & dataPath );
 	static void removeNIFResourcePath( const NifModel * nif );
 	static inline GameResources & getNIFResources( const NifModel * nif );
+	//! Return the resources of 'nif' with an additional reference, so that another thread can keep using them
+	// after the model is deleted or its data path changes. The reference is released with releaseResources().
+	static GameResources * acquireNIFResources( const NifModel * nif );
+	static void releaseResources( GameResources * r );
 
 	//! Convert 'name' to lower case, replace backslashes with forward slashes, and make sure that the path
 	// begins with 'archive_folder' and ends with 'extension' (e.g. "textures" and ".dds").
 	static std::string get_full_path( const QString & name, const char * archive_folder, const char * extension );
+	//! Start opening the archives of 'game' and loading its material database on a background thread.
+	// The returned future becomes ready when the resources can be used without blocking. Until then,
+	// find_file() only uses the saved index or loose files, and does not cache files not found.
+	// get_file() extracts files listed in the saved index from their archive, and otherwise waits for the
+	// background thread without holding the resource lock, as list_files() does.
+	static std::shared_future< void > preload( const GameMode game );
+	//! False on the GUI thread, which must not be blocked by the background loading of resources,
+	// true on worker threads and in command line mode
+	static bool can_wait_for_resources();
+	//! Remember 'game' as the game to preload at the next startup
+	static void set_last_game( const GameMode game );
 	//! Search for file 'path' in the resource archives and folders, and return the full path if the file is found,
 	// or an empty string otherwise.
 	static QString find_file(
 		const GameMode game, const QString & path, const char * archiveFolder, const char * extension );
 	//! Find and load resource file to 'data'. The return value is true on success.
-	static bool get_file( QByteArray & data, const GameMode game, const std::string_view & fullPath );
+	// Archived files are cached after decompression, 'data' may share its buffer with the cache.
+	static bool get_file(
+		QByteArray & data, const GameMode game, const std::string_view & fullPath, std::uint32_t flags = 0 );
 	static bool get_file(
 		QByteArray & data, const GameMode game,
-		const QString & path, const char * archiveFolder, const char * extension );
+		const QString & path, const char * archiveFolder, const char * extension, std::uint32_t flags = 0 );
+	//! Return the statistics of the decompressed file caches of all games and loose NIF folders
+	static FileCacheStats file_cache_stats();
+	//! Return the path on disk of a loose resource file used by 'nif', or an empty string if it is archived
+	// or not found.
+	static QString loose_file_path( const NifModel * nif, const std::string_view & fullPath );
+	static QString loose_file_path( const GameResources & resources, const std::string_view & fullPath );
 	//! Return pointer to Starfield material database, loading it first if necessary.
 	// On error, nullptr is returned.
 	static CE2MaterialDB * materials( const GameMode game );
@@ -141,6 +236,10 @@ public:
 		std::set< std::string_view > & fileSet, const GameMode game,
 		bool (*fileListFilterFunc)( void * p, const std::string_view & fileName ) = nullptr,
 		void * fileListFilterFuncData = nullptr );
+	//! Return the stamps of the resource files 'fullPaths' of 'game' from the saved file index, without
+	// extracting the files. A stamp changes when the archive or loose file the file is loaded from is
+	// modified, and it is 0 if the index is not up to date or the source of the file is not known.
+	static std::vector< FileStamp > file_stamps( const GameMode game, const QStringList & fullPaths );
 
 	//! Find applicable data folders at the game installation path
 	static QStringList find_folders( const GameMode game );
@@ -163,6 +262,12 @@ public:
 	static inline void update_status( const GameMode game, bool status );
 	static inline void update_status( const QString & game, bool status );
 	static inline void update_other_games_fallback( bool status );
+	//! Set the memory limit of the decompressed file cache in megabytes, 0 disables the cache
+	static void update_file_cache_size( int megabytes );
+	//! Invalidate cached file lookups, called when archives are opened or closed or the data paths change
+	static inline void invalidate_lookups();
+	//! Changes whenever the archives are opened or closed or the data paths change, for caches of decoded resources
+	static inline std::uint32_t resource_generation();
 
 	static void init_settings( int & manager_version, QProgressDialog * dlg = nullptr );
 	static void update_settings( int & manager_version, QProgressDialog * dlg = nullptr );
@@ -183,13 +288,42 @@ private:
 	// resources associated with loose NIF files
 	static std::unordered_map< const NifModel *, GameResources * >	nifResourceMap;
 	static std::uint64_t	material_db_prv_id;
+	// serializes access to the resources, which may also be used by background texture loading
+	static std::recursive_mutex	resourceMutex;
+	// protects GameResources::preload, never held while waiting for it
+	static std::mutex	preloadMutex;
+	// held shared while files are extracted without resourceMutex, and exclusively when closing archives
+	static std::shared_mutex	archiveMutex;
+	static std::uint32_t	resourceGeneration;
+	static int	fileCacheSize;
+	static std::uint64_t	fileCacheHits;
+	static std::uint64_t	fileCacheMisses;
 	static QString	gamePaths[NUM_GAMES];
 	static bool	gameStatus[NUM_GAMES];
 	static bool	otherGamesFallback;
 };
 
+//! Reports the progress of background resource loading, the signals are emitted from worker threads
+class ResourceLoadNotifier final : public QObject
+{
+	Q_OBJECT
+
+public:
+	static ResourceLoadNotifier * get();
+
+signals:
+	//! An empty message is sent when loading is finished
+	void loadProgress( const QString & message, int value, int maximum );
+	void loadFinished( int game );
+
+private:
+	ResourceLoadNotifier() = default;
+};
+
 inline GameManager::GameResources & GameManager::getNIFResources( const NifModel * nif )
 {
+	// models may be created and loaded by several threads in command line batch mode
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
 	auto	i = nifResourceMap.find( nif );
 	if ( i != nifResourceMap.end() ) [[likely]]
 		return *(i->second);
@@ -254,6 +388,19 @@ void GameManager::update_status( const QString & game, bool status )
 void GameManager::update_other_games_fallback( bool status )
 {
 	otherGamesFallback = status;
+	invalidate_lookups();
+}
+
+void GameManager::invalidate_lookups()
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	resourceGeneration++;
+}
+
+std::uint32_t GameManager::resource_generation()
+{
+	std::lock_guard< std::recursive_mutex >	lock( resourceMutex );
+	return resourceGeneration;
 }
 
 } // end namespace Game
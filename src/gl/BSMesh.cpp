@@ -27,7 +27,7 @@ void BSMesh::transformShapes()
 
 void BSMesh::drawShapes( NodeList * secondPass )
 {
-	if ( isHidden() || ( !scene->hasOption(Scene::ShowMarkers) && name.contains("EditorMarker") ) )
+	if ( isHidden() || isCulled || ( !scene->hasOption(Scene::ShowMarkers) && name.contains("EditorMarker") ) )
 		return;
 
 	// Draw translucent meshes in second pass
@@ -502,12 +502,14 @@ void BSMesh::updateImpl(const NifModel* nif, const QModelIndex& index)
 
 	iData = index;
 	iMeshes = nif->getIndex(index, "Meshes");
-	meshes.clear();
+	// keep the previous meshes alive until the new ones are looked up in the shared cache
+	QVector<std::shared_ptr<MeshFile>>	prevMeshes;
+	prevMeshes.swap( meshes );
 	for ( int i = 0; i < 4; i++ ) {
 		auto meshArray = QModelIndex_child( iMeshes, i );
 		bool hasMesh = nif->get<bool>( QModelIndex_child( meshArray ) );
 		if ( hasMesh ) {
-			auto mesh = std::make_shared<MeshFile>( nif, QModelIndex_child( meshArray, 1 ) );
+			auto mesh = MeshFile::get( nif, QModelIndex_child( meshArray, 1 ) );
 			if ( mesh->isValid() ) {
 				meshes.append(mesh);
 				if ( i > 0 || mesh->lods.size() > 0 )
@@ -526,6 +528,7 @@ void BSMesh::updateData(const NifModel* nif)
 	gpuLODs.clear();
 	boneNames.clear();
 	boneTransforms.clear();
+	triangleTreeValid = false;
 
 	if ( meshes.size() == 0 )
 		return;
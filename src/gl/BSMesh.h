@@ -63,6 +63,7 @@ public:
 protected:
 	void updateImpl(const NifModel* nif, const QModelIndex& index) override;
 	void updateData(const NifModel* nif) override;
+	QVector<Triangle> pickTriangles() const override { return sortedTriangles; }
 
 	QModelIndex iMeshes;
 
@@ -192,10 +192,15 @@ void BSShape::transformShapes()
 
 	Node::transformShapes();
 
+	// Skinned shapes are still transformed while culled to keep their bounds current
+	if ( isCulled && !isSkinned )
+		return;
+
 	transformRigid = true;
 
 	if ( isSkinned && weights.count() && scene->hasOption(Scene::DoSkinning) ) {
 		transformRigid = false;
+		rigidDataValid = false;
 
 		transVerts.resize( numVerts );
 		transVerts.fill( Vector3() );
@@ -233,6 +238,12 @@ void BSShape::transformShapes()
 		boundSphere.applyInv( viewTrans() );
 		needUpdateBounds = false;
 	} else {
+		// Static rigid shapes keep their arrays until the data or shader changes
+		if ( rigidDataValid && controllers.isEmpty() )
+			return;
+
+		rigidDataValid = true;
+
 		transVerts = verts;
 		transNorms = norms;
 		transTangents = tangents;
@@ -249,7 +260,7 @@ void BSShape::transformShapes()
 
 void BSShape::drawShapes( NodeList * secondPass )
 {
-	if ( isHidden() )
+	if ( isHidden() || isCulled )
 		return;
 
 	glPointSize( GLView::Settings::vertexSelectPointSize );
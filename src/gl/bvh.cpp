@@ -0,0 +1,346 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+//! @file bvh.cpp Bounding volume hierarchy for culling and picking
+
+/*
+ *  BoundingBox
+ */
+
+BoundingBox::BoundingBox( const BoundSphere & s ) : BoundingBox()
+{
+	if ( s.radius >= 0.0f ) {
+		Vector3 r( s.radius, s.radius, s.radius );
+		lower = s.center - r;
+		upper = s.center + r;
+	}
+}
+
+int BoundingBox::longestAxis() const
+{
+	Vector3 d = upper - lower;
+	if ( d[0] >= d[1] && d[0] >= d[2] )
+		return 0;
+	return ( d[1] >= d[2] ? 1 : 2 );
+}
+
+BoundSphere BoundingBox::toSphere() const
+{
+	if ( isEmpty() )
+		return BoundSphere();
+
+	return BoundSphere( center(), ( upper - lower ).length() * 0.5f );
+}
+
+bool BoundingBox::intersect( const Ray & ray, float & tNear, float tFar ) const
+{
+	if ( isEmpty() )
+		return false;
+
+	for ( int i = 0; i < 3; i++ ) {
+		float t1 = ( lower[i] - ray.origin[i] ) * ray.invDirection[i];
+		float t2 = ( upper[i] - ray.origin[i] ) * ray.invDirection[i];
+		if ( t1 > t2 )
+			std::swap( t1, t2 );
+
+		tNear = std::max( tNear, t1 );
+		tFar = std::min( tFar, t2 );
+		if ( tNear > tFar )
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ *  Ray
+ */
+
+Ray::Ray( const Vector3 & o, const Vector3 & d ) : origin( o ), direction( d )
+{
+	for ( int i = 0; i < 3; i++ )
+		invDirection[i] = ( d[i] != 0.0f ? 1.0f / d[i] : std::copysign( FLT_MAX, d[i] ) );
+}
+
+Ray Ray::toLocal( const Transform & t ) const
+{
+	Matrix ri = t.rotation.inverted();
+	return Ray( ri * ( origin - t.translation ) / t.scale, ri * direction / t.scale );
+}
+
+bool Ray::intersect( const Vector3 & a, const Vector3 & b, const Vector3 & c, float & t ) const
+{
+	// Moller-Trumbore
+	Vector3 e1 = b - a;
+	Vector3 e2 = c - a;
+	Vector3 p = Vector3::crossproduct( direction, e2 );
+	float det = Vector3::dotproduct( e1, p );
+	if ( std::fabs( det ) < 1.0e-12f )
+		return false;
+
+	float invDet = 1.0f / det;
+	Vector3 s = origin - a;
+	float u = Vector3::dotproduct( s, p ) * invDet;
+	if ( u < 0.0f || u > 1.0f )
+		return false;
+
+	Vector3 q = Vector3::crossproduct( s, e1 );
+	float v = Vector3::dotproduct( direction, q ) * invDet;
+	if ( v < 0.0f || ( u + v ) > 1.0f )
+		return false;
+
+	t = Vector3::dotproduct( e2, q ) * invDet;
+	return ( t >= 0.0f );
+}
+
+
+/*
+ *  Frustum
+ */
+
+void Frustum::addPlane( const Vector3 & n, float d )
+{
+	if ( numPlanes >= 4 )
+		return;
+
+	float l = n.length();
+	if ( !( l > 0.0f ) )
+		return;
+
+	normals[numPlanes] = n / l;
+	dists[numPlanes] = d / l;
+	numPlanes++;
+}
+
+Frustum Frustum::perspective( float tanHalfWidth, float tanHalfHeight )
+{
+	// The side planes pass through the eye, which also rejects everything behind it
+	Frustum f;
+	f.addPlane( Vector3( 1.0f, 0.0f, -tanHalfWidth ), 0.0f );
+	f.addPlane( Vector3( -1.0f, 0.0f, -tanHalfWidth ), 0.0f );
+	f.addPlane( Vector3( 0.0f, 1.0f, -tanHalfHeight ), 0.0f );
+	f.addPlane( Vector3( 0.0f, -1.0f, -tanHalfHeight ), 0.0f );
+	return f;
+}
+
+Frustum Frustum::orthographic( float halfWidth, float halfHeight )
+{
+	Frustum f;
+	f.addPlane( Vector3( 1.0f, 0.0f, 0.0f ), halfWidth );
+	f.addPlane( Vector3( -1.0f, 0.0f, 0.0f ), halfWidth );
+	f.addPlane( Vector3( 0.0f, 1.0f, 0.0f ), halfHeight );
+	f.addPlane( Vector3( 0.0f, -1.0f, 0.0f ), halfHeight );
+	return f;
+}
+
+Frustum Frustum::toWorld( const Transform & view ) const
+{
+	// dot( n, s * R * p + t ) + d = s * dot( transpose( R ) * n, p ) + dot( n, t ) + d
+	if ( !( view.scale > 0.0f ) )
+		return Frustum();
+
+	Frustum f;
+	for ( int i = 0; i < numPlanes; i++ ) {
+		const Vector3 & n = normals[i];
+		Vector3 nw;
+		for ( int j = 0; j < 3; j++ )
+			nw[j] = view.rotation( 0, j ) * n[0] + view.rotation( 1, j ) * n[1] + view.rotation( 2, j ) * n[2];
+
+		f.addPlane( nw, ( Vector3::dotproduct( n, view.translation ) + dists[i] ) / view.scale );
+	}
+	return f;
+}
+
+bool Frustum::intersects( const BoundingBox & box ) const
+{
+	if ( box.isEmpty() )
+		return false;
+
+	for ( int i = 0; i < numPlanes; i++ ) {
+		const Vector3 & n = normals[i];
+		// The corner of the box furthest along the plane normal
+		Vector3 p( n[0] >= 0.0f ? box.upper[0] : box.lower[0],
+		           n[1] >= 0.0f ? box.upper[1] : box.lower[1],
+		           n[2] >= 0.0f ? box.upper[2] : box.lower[2] );
+		if ( Vector3::dotproduct( n, p ) + dists[i] < 0.0f )
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ *  BVH
+ */
+
+void BVH::clear()
+{
+	nodes.clear();
+	indices.clear();
+}
+
+void BVH::build( const QVector<BoundingBox> & primBounds, int maxLeafSize )
+{
+	clear();
+
+	int n = primBounds.count();
+	if ( n < 1 )
+		return;
+
+	QVector<Vector3> centroids( n );
+	indices.resize( n );
+	for ( int i = 0; i < n; i++ ) {
+		indices[i] = i;
+		if ( !primBounds.at( i ).isEmpty() )
+			centroids[i] = primBounds.at( i ).center();
+	}
+
+	nodes.reserve( 2 * ( n / std::max( maxLeafSize, 1 ) ) + 1 );
+	buildNode( primBounds, centroids, 0, n, std::max( maxLeafSize, 1 ) );
+}
+
+int BVH::buildNode( const QVector<BoundingBox> & primBounds, const QVector<Vector3> & centroids, int first, int count, int maxLeafSize )
+{
+	int ni = nodes.count();
+	nodes.append( Node() );
+
+	BoundingBox b, cb;
+	for ( int i = first; i < first + count; i++ ) {
+		b |= primBounds.at( indices.at( i ) );
+		cb.add( centroids.at( indices.at( i ) ) );
+	}
+	nodes[ni].bounds = b;
+
+	if ( count <= maxLeafSize ) {
+		nodes[ni].first = first;
+		nodes[ni].count = count;
+		return ni;
+	}
+
+	int axis = cb.longestAxis();
+	int mid = first + count / 2;
+	auto it = indices.begin();
+	std::nth_element( it + first, it + mid, it + first + count,
+		[&centroids, axis]( qint32 a, qint32 b ) {
+			return centroids.at( a )[axis] < centroids.at( b )[axis];
+		}
+	);
+
+	buildNode( primBounds, centroids, first, mid - first, maxLeafSize );
+	int right = buildNode( primBounds, centroids, mid, first + count - mid, maxLeafSize );
+
+	nodes[ni].first = right;
+	nodes[ni].count = 0;
+	return ni;
+}
+
+void BVH::refit( const QVector<BoundingBox> & primBounds )
+{
+	for ( int ni = nodes.count() - 1; ni >= 0; ni-- ) {
+		BoundingBox b;
+		const Node & n = nodes.at( ni );
+		if ( n.count > 0 ) {
+			for ( int i = n.first; i < n.first + n.count; i++ )
+				b |= primBounds.at( indices.at( i ) );
+		} else {
+			b = nodes.at( ni + 1 ).bounds;
+			b |= nodes.at( n.first ).bounds;
+		}
+		nodes[ni].bounds = b;
+	}
+}
+
+QVector<BoundingBox> triangleBounds( const QVector<Triangle> & triangles, const QVector<Vector3> & verts )
+{
+	int nVerts = verts.count();
+	QVector<BoundingBox> triBounds( triangles.count() );
+	for ( int i = 0; i < triangles.count(); i++ ) {
+		const Triangle & tri = triangles.at( i );
+		if ( tri.v1() < nVerts && tri.v2() < nVerts && tri.v3() < nVerts ) {
+			BoundingBox & b = triBounds[i];
+			b.add( verts.at( tri.v1() ) );
+			b.add( verts.at( tri.v2() ) );
+			b.add( verts.at( tri.v3() ) );
+		}
+	}
+	return triBounds;
+}
+
+bool rayCastTriangles( const BVH & tree, const QVector<Triangle> & triangles, const QVector<Vector3> & verts,
+					   const Ray & ray, float & tMax, int & triangle, int & vertex )
+{
+	const Vector3 * v = verts.constData();
+	int nVerts = verts.count();
+	int hitTriangle = -1;
+	float hitDist = tMax;
+
+	tree.raycast( ray, tMax, [&]( int i, float & tFar ) {
+		const Triangle & tri = triangles.at( i );
+		if ( tri.v1() >= nVerts || tri.v2() >= nVerts || tri.v3() >= nVerts )
+			return;
+
+		float t;
+		if ( ray.intersect( v[tri.v1()], v[tri.v2()], v[tri.v3()], t ) && t < tFar ) {
+			tFar = hitDist = t;
+			hitTriangle = i;
+		}
+	} );
+
+	if ( hitTriangle < 0 )
+		return false;
+
+	const Triangle & tri = triangles.at( hitTriangle );
+	tMax = hitDist;
+	triangle = hitTriangle;
+
+	Vector3 p = ray.at( hitDist );
+	vertex = tri.v1();
+	float dist = ( v[tri.v1()] - p ).squaredLength();
+	for ( quint16 j : { tri.v2(), tri.v3() } ) {
+		float d = ( v[j] - p ).squaredLength();
+		if ( d < dist ) {
+			dist = d;
+			vertex = j;
+		}
+	}
+
+	return true;
+}
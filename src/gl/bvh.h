@@ -0,0 +1,290 @@
+/***** BEGIN LICENSE BLOCK *****
+
+BSD License
+
+Copyright (c) 2005-2015, NIF File Format Library and Tools
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the NIF File Format Library and Tools project may not be
+   used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+***** END LICENCE BLOCK *****/
+
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "gl/gltools.h"
+
+#include <QVector>
+
+#include <cfloat>
+#include <utility>
+
+
+//! @file bvh.h BoundingBox, Ray, Frustum, BVH
+
+class Ray;
+
+//! An axis aligned bounding box
+class BoundingBox final
+{
+public:
+	//! Constructs an empty box
+	BoundingBox() : lower( FLT_MAX, FLT_MAX, FLT_MAX ), upper( -FLT_MAX, -FLT_MAX, -FLT_MAX ) {}
+	BoundingBox( const Vector3 & a, const Vector3 & b ) : lower( a ), upper( a ) { add( b ); }
+	explicit BoundingBox( const BoundSphere & s );
+
+	Vector3 lower;
+	Vector3 upper;
+
+	inline bool isEmpty() const { return !( lower[0] <= upper[0] ); }
+
+	inline void add( const Vector3 & v )
+	{
+		lower.boundMin( v );
+		upper.boundMax( v );
+	}
+
+	inline BoundingBox & operator|=( const BoundingBox & o )
+	{
+		lower.boundMin( o.lower );
+		upper.boundMax( o.upper );
+		return *this;
+	}
+
+	inline Vector3 center() const { return ( lower + upper ) * 0.5f; }
+
+	//! Returns the axis (0 to 2) along which the box is the largest
+	int longestAxis() const;
+
+	//! Returns the bounding sphere of the box, or an invalid sphere if the box is empty
+	BoundSphere toSphere() const;
+
+	/*! Ray-box slab test
+	 *
+	 * @param[in]     ray	The ray
+	 * @param[in,out] tNear	Distance along the ray where it enters the box, must be initialized to the minimum distance
+	 * @param[in]     tFar	The maximum distance along the ray
+	 * @return				True if the ray intersects the box within [tNear, tFar]
+	 */
+	bool intersect( const Ray & ray, float & tNear, float tFar ) const;
+};
+
+//! A ray with a precomputed reciprocal direction
+class Ray final
+{
+public:
+	Ray() {}
+	Ray( const Vector3 & o, const Vector3 & d );
+
+	Vector3 origin;
+	Vector3 direction;
+	Vector3 invDirection;
+
+	inline Vector3 at( float t ) const { return origin + direction * t; }
+
+	//! Returns the ray mapped by the inverse of t; distances along the ray are preserved
+	Ray toLocal( const Transform & t ) const;
+
+	/*! Ray-triangle test, both sides of the triangle are hit
+	 *
+	 * @param[in]  a, b, c	The triangle vertices
+	 * @param[out] t		Distance along the ray to the hit point
+	 * @return				True if the ray hits the triangle at t >= 0
+	 */
+	bool intersect( const Vector3 & a, const Vector3 & b, const Vector3 & c, float & t ) const;
+};
+
+//! The side planes of a view frustum; the near and far planes are not tested
+class Frustum final
+{
+public:
+	//! Constructs a frustum that contains everything
+	Frustum() {}
+
+	/*! Perspective frustum in view space, looking down the negative Z axis
+	 *
+	 * @param tanHalfWidth	Tangent of half the horizontal field of view
+	 * @param tanHalfHeight	Tangent of half the vertical field of view
+	 */
+	static Frustum perspective( float tanHalfWidth, float tanHalfHeight );
+
+	//! Orthographic frustum in view space
+	static Frustum orthographic( float halfWidth, float halfHeight );
+
+	//! Returns the frustum transformed from view space to the space the view transform maps from
+	Frustum toWorld( const Transform & view ) const;
+
+	//! Returns false only if the box is entirely outside one of the planes
+	bool intersects( const BoundingBox & box ) const;
+
+	bool isValid() const { return numPlanes > 0; }
+
+protected:
+	void addPlane( const Vector3 & n, float d );
+
+	//! A point is inside if dot( normal, p ) + dist >= 0 for all planes
+	Vector3 normals[4];
+	float dists[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	int numPlanes = 0;
+};
+
+/*! A bounding volume hierarchy over an array of primitive bounds
+ *
+ * The tree is stored in depth first order, the left child of an internal
+ * node immediately follows it, so that refitting can walk the array backwards.
+ */
+class BVH final
+{
+public:
+	struct Node
+	{
+		BoundingBox bounds;
+		//! First primitive in indices (leaf), or the right child (internal node)
+		qint32 first = 0;
+		//! Number of primitives, 0 for internal nodes
+		qint32 count = 0;
+	};
+
+	void clear();
+
+	//! Builds the tree with a median split along the longest axis of the centroid bounds
+	void build( const QVector<BoundingBox> & primBounds, int maxLeafSize = 4 );
+
+	//! Updates the node bounds without changing the topology, primBounds must have the same size as in build()
+	void refit( const QVector<BoundingBox> & primBounds );
+
+	bool isEmpty() const { return nodes.isEmpty(); }
+	int primitiveCount() const { return indices.count(); }
+
+	//! Bounds of the whole tree
+	BoundingBox bounds() const { return ( nodes.isEmpty() ? BoundingBox() : nodes.at( 0 ).bounds ); }
+
+	//! Calls func( int primitive ) for every leaf primitive whose node intersects the frustum
+	template <typename F> void query( const Frustum & frustum, F func ) const;
+
+	/*! Visits the leaves hit by a ray in approximate front to back order
+	 *
+	 * Calls func( int primitive, float & tMax ), which can shorten tMax to prune
+	 * nodes further along the ray.
+	 */
+	template <typename F> void raycast( const Ray & ray, float tMax, F func ) const;
+
+	const QVector<Node> & nodeList() const { return nodes; }
+	const QVector<qint32> & primitiveIndices() const { return indices; }
+
+protected:
+	int buildNode( const QVector<BoundingBox> & primBounds, const QVector<Vector3> & centroids, int first, int count, int maxLeafSize );
+
+	QVector<Node> nodes;
+	QVector<qint32> indices;
+
+	static constexpr int stackSize = 64;
+};
+
+//! Returns the bounds of each triangle, triangles with out of range vertices get an empty box
+QVector<BoundingBox> triangleBounds( const QVector<Triangle> & triangles, const QVector<Vector3> & verts );
+
+/*! Casts a ray against a triangle mesh, both sides of the triangles are hit
+ *
+ * @param[in]     tree		BVH built from triangleBounds( triangles, verts )
+ * @param[in]     triangles	The triangles
+ * @param[in]     verts		The vertices, in the same space as the ray
+ * @param[in]     ray		The ray
+ * @param[in,out] tMax		Maximum distance along the ray, shortened to the distance of the hit
+ * @param[out]    triangle	Index of the hit triangle
+ * @param[out]    vertex	Vertex of the hit triangle closest to the hit point
+ * @return					True if a triangle was hit closer than tMax
+ */
+bool rayCastTriangles( const BVH & tree, const QVector<Triangle> & triangles, const QVector<Vector3> & verts,
+					   const Ray & ray, float & tMax, int & triangle, int & vertex );
+
+template <typename F> inline void BVH::query( const Frustum & frustum, F func ) const
+{
+	if ( nodes.isEmpty() )
+		return;
+
+	int stack[stackSize];
+	int sp = 0;
+	stack[sp++] = 0;
+
+	while ( sp > 0 ) {
+		int ni = stack[--sp];
+		const Node & n = nodes.at( ni );
+		if ( !frustum.intersects( n.bounds ) )
+			continue;
+
+		if ( n.count > 0 ) {
+			for ( int i = n.first; i < n.first + n.count; i++ )
+				func( int( indices.at( i ) ) );
+		} else if ( sp + 2 <= stackSize ) {
+			stack[sp++] = n.first;
+			stack[sp++] = ni + 1;
+		}
+	}
+}
+
+template <typename F> inline void BVH::raycast( const Ray & ray, float tMax, F func ) const
+{
+	if ( nodes.isEmpty() )
+		return;
+
+	int stack[stackSize];
+	int sp = 0;
+	float t = 0.0f;
+	if ( !nodes.at( 0 ).bounds.intersect( ray, t, tMax ) )
+		return;
+	stack[sp++] = 0;
+
+	while ( sp > 0 ) {
+		int ni = stack[--sp];
+		const Node & n = nodes.at( ni );
+		t = 0.0f;
+		if ( !n.bounds.intersect( ray, t, tMax ) )
+			continue;
+
+		if ( n.count > 0 ) {
+			for ( int i = n.first; i < n.first + n.count; i++ )
+				func( int( indices.at( i ) ), tMax );
+			continue;
+		}
+
+		int c1 = ni + 1;
+		int c2 = n.first;
+		float t1 = 0.0f, t2 = 0.0f;
+		bool hit1 = nodes.at( c1 ).bounds.intersect( ray, t1, tMax );
+		bool hit2 = nodes.at( c2 ).bounds.intersect( ray, t2, tMax );
+		if ( hit1 && hit2 && t2 < t1 ) {
+			std::swap( c1, c2 );
+			std::swap( hit1, hit2 );
+		}
+		// Push the far child first so that the near one is visited first
+		if ( hit2 && sp < stackSize )
+			stack[sp++] = c2;
+		if ( hit1 && sp < stackSize )
+			stack[sp++] = c1;
+	}
+}
+
+#endif
@@ -148,11 +148,15 @@ void IControllable::updateImpl(const NifModel * nif, const QModelIndex & index)
 
 void IControllable::transform()
 {
-	if ( scene->animate ) {
+	// Controllers only need to run again if the time or the model changed
+	if ( scene->animate && ( scene->time != controllerTime || scene->version != controllerVersion ) ) {
 		for ( Controller * controller : controllers ) {
 			controller->updateTime( scene->time );
 		}
 	}
+
+	controllerTime = scene->time;
+	controllerVersion = scene->version;
 }
 
 void IControllable::timeBounds( float & tmin, float & tmax )
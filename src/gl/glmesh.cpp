@@ -614,10 +614,15 @@ void Mesh::transformShapes()
 
 	Node::transformShapes();
 
+	// Skinned shapes are still transformed while culled to keep their bounds current
+	if ( isCulled && !isSkinned )
+		return;
+
 	transformRigid = true;
 
 	if ( isSkinned && ( weights.count() || partitions.count() ) && scene->hasOption(Scene::DoSkinning) ) {
 		transformRigid = false;
+		rigidDataValid = false;
 
 		int vcnt = verts.count();
 		int ncnt = norms.count();
@@ -717,6 +722,16 @@ void Mesh::transformShapes()
 		boundSphere.applyInv( viewTrans() );
 		needUpdateBounds = false;
 	} else {
+		MaterialProperty * matprop = findProperty<MaterialProperty>();
+		float alpha = ( matprop ? matprop->alphaValue() : 1.0f );
+
+		// Static rigid shapes keep their arrays until the data, shader or material alpha changes
+		if ( rigidDataValid && controllers.isEmpty() && alpha == rigidAlpha )
+			return;
+
+		rigidDataValid = true;
+		rigidAlpha = alpha;
+
 		transVerts = verts;
 		transNorms = norms;
 		transTangents = tangents;
@@ -755,7 +770,7 @@ BoundSphere Mesh::bounds() const
 
 void Mesh::drawShapes( NodeList * secondPass )
 {
-	if ( isHidden() )
+	if ( isHidden() || isCulled )
 		return;
 
 	// TODO: Only run this if BSXFlags has "EditorMarkers present" flag
@@ -68,6 +68,9 @@ protected:
 
 	void updateData_NiMesh( const NifModel * nif );
 	void updateData_NiTriShape( const NifModel * nif );
+
+	//! Material alpha the transformed colors of a rigid shape were blended with
+	float rigidAlpha = 1.0f;
 };
 
 #endif
@@ -236,6 +236,7 @@ void Node::clear()
 	nodeId = 0;
 	flags.bits = 0;
 	local = Transform();
+	transformDirty = true;
 
 	children.clear();
 	properties.clear();
@@ -321,6 +322,7 @@ void Node::makeParent( Node * newParent )
 		parent->children.del( this );
 
 	parent = newParent;
+	transformDirty = true;
 
 	if ( parent )
 		parent->children.add( this );
@@ -356,10 +358,11 @@ void Node::activeProperties( PropertyList & list ) const
 		parent->activeProperties( list );
 }
 
-const Transform & Node::viewTrans() const
+Transform Node::viewTrans() const
 {
-	if ( scene->viewTrans.contains( nodeId ) )
-		return scene->viewTrans[ nodeId ];
+	bool cached = ( nodeId >= 0 && nodeId < scene->transValid.count() );
+	if ( cached && ( scene->transValid.at( nodeId ) & Scene::ViewTransValid ) )
+		return scene->viewTrans.at( nodeId );
 
 	Transform t;
 
@@ -368,22 +371,32 @@ const Transform & Node::viewTrans() const
 	else
 		t = scene->view * worldTrans();
 
-	scene->viewTrans.insert( nodeId, t );
-	return scene->viewTrans[ nodeId ];
+	return storeTrans( scene->viewTrans, Scene::ViewTransValid, t );
 }
 
-const Transform & Node::worldTrans() const
+Transform Node::worldTrans() const
 {
-	if ( scene->worldTrans.contains( nodeId ) )
-		return scene->worldTrans[ nodeId ];
+	bool cached = ( nodeId >= 0 && nodeId < scene->transValid.count() );
+	if ( cached && ( scene->transValid.at( nodeId ) & Scene::WorldTransValid ) )
+		return scene->worldTrans.at( nodeId );
 
 	Transform t = local;
 
 	if ( parent )
 		t = parent->worldTrans() * t;
 
-	scene->worldTrans.insert( nodeId, t );
-	return scene->worldTrans[ nodeId ];
+	return storeTrans( scene->worldTrans, Scene::WorldTransValid, t );
+}
+
+const Transform & Node::storeTrans( QVector<Transform> & cache, quint8 flag, const Transform & t ) const
+{
+	// Not seen by Scene::transform() yet, the caller returns t by value
+	if ( nodeId < 0 || nodeId >= scene->transValid.count() )
+		return t;
+
+	cache[nodeId] = t;
+	scene->transValid[nodeId] |= flag;
+	return cache.at( nodeId );
 }
 
 Transform Node::localTrans( int root ) const
@@ -463,6 +476,18 @@ void Node::transform()
 {
 	IControllable::transform();
 
+	// Only invalidate the cached transforms if this node or one of its parents moved
+	worldChanged = transformDirty || !( local == lastLocal ) || ( parent && parent->worldChanged );
+	transformDirty = false;
+	lastLocal = local;
+
+	if ( nodeId >= 0 && nodeId < scene->transValid.count() ) {
+		if ( worldChanged )
+			scene->transValid[nodeId] = 0;
+		else if ( scene->viewChanged )
+			scene->transValid[nodeId] &= ~Scene::ViewTransValid;
+	}
+
 	// if there's a rigid body attached, then calculate and cache the body's transform
 	// (need this later in the drawing stage for the constraints)
 	auto nif = NifModel::fromValidIndex( iBlock );
@@ -1947,10 +1972,11 @@ BillboardNode::BillboardNode( Scene * scene, const QModelIndex & iBlock )
 {
 }
 
-const Transform & BillboardNode::viewTrans() const
+Transform BillboardNode::viewTrans() const
 {
-	if ( scene->viewTrans.contains( nodeId ) )
-		return scene->viewTrans[ nodeId ];
+	bool cached = ( nodeId >= 0 && nodeId < scene->transValid.count() );
+	if ( cached && ( scene->transValid.at( nodeId ) & Scene::ViewTransValid ) )
+		return scene->viewTrans.at( nodeId );
 
 	Transform t;
 
@@ -1961,6 +1987,5 @@ const Transform & BillboardNode::viewTrans() const
 
 	t.rotation = Matrix();
 
-	scene->viewTrans.insert( nodeId, t );
-	return scene->viewTrans[ nodeId ];
+	return storeTrans( scene->viewTrans, Scene::ViewTransValid, t );
 }
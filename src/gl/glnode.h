@@ -118,8 +118,8 @@ public:
 	virtual float viewDepth() const;
 	virtual class BoundSphere bounds() const;
 	virtual const Vector3 center() const;
-	virtual const Transform & viewTrans() const;
-	virtual const Transform & worldTrans() const;
+	virtual Transform viewTrans() const;
+	virtual Transform worldTrans() const;
 	virtual const Transform & localTrans() const { return local; }
 	virtual Transform localTrans( int parentNode ) const;
 
@@ -155,12 +155,21 @@ protected:
 	void glHighlightColor() const;
 	void glNormalColor() const;
 
+	//! Stores t in the cache of the scene (worldTrans or viewTrans) if the node has an entry, and returns it
+	const Transform & storeTrans( QVector<Transform> & cache, quint8 flag, const Transform & t ) const;
+
 	QPointer<Node> parent;
 	NodeList children;
 
 	PropertyList properties;
 
 	Transform local;
+	//! local as of the last transform(), to detect changes made by controllers or edits
+	Transform lastLocal;
+	//! Forces the cached transforms to be recomputed, e.g. after the parent changed
+	bool transformDirty = true;
+	//! Did the world transform change in the last transform()?
+	bool worldChanged = true;
 
 	NodeFlags flags;
 
@@ -218,7 +227,7 @@ class BillboardNode : public Node
 public:
 	BillboardNode( Scene * scene, const QModelIndex & block );
 
-	const Transform & viewTrans() const override;
+	Transform viewTrans() const override;
 };
 
 
@@ -988,7 +988,10 @@ void BSShaderLightingProperty::loadSFMaterial()
 	sf_material_valid = false;
 	const NifModel *	nif = scene->nifModel;
 	try {
-		CE2MaterialDB *	materials = nif->getCE2Materials();
+		// do not block rendering while the database is loaded, this is retried on the next frame
+		CE2MaterialDB *	materials = nif->getCE2Materials( false );
+		if ( !materials && Game::GameManager::getNIFResources( nif ).is_loading() )
+			return;
 		if ( materials ) {
 			if ( !sfMaterialPath.empty() ) {
 				sf_material = materials->loadMaterial( sfMaterialPath );
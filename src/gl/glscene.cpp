@@ -45,6 +45,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QAction>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
+#include <QSet>
 #include <QSettings>
 
 
@@ -108,18 +109,31 @@ void Scene::updateShaders()
 	renderer->updateShaders();
 }
 
-void Scene::clear( [[maybe_unused]] bool flushTextures )
+void Scene::clear( bool flushTextures )
 {
 	nodes.clear();
 	properties.clear();
 	roots.clear();
 	shapes.clear();
 
+	shapeBounds.clear();
+	shapeTree.clear();
+	shapeTreeValid = false;
+	shapesDrawn = shapesCulled = 0;
+
+	worldTrans.clear();
+	viewTrans.clear();
+	transValid.clear();
+	version++;
+
+	dependents.clear();
+	dependentsValid = false;
+
 	animGroups.clear();
 	animTags.clear();
 
-	//if ( flushTextures )
-	textures->flush();
+	if ( flushTextures )
+		textures->flush();
 
 	sceneBoundsValid = timeBoundsValid = false;
 
@@ -133,26 +147,45 @@ void Scene::update( const NifModel * nif, const QModelIndex & index )
 
 	nifModel = nif;
 
+	// Edits can change any transform or controller
+	version++;
+	transValid.fill( 0 );
+
 	if ( index.isValid() ) {
 		QModelIndex block = nif->getBlockIndex( index );
 		if ( !block.isValid() )
 			return;
 
-		for ( Property * prop : properties )
-			prop->update( nif, block );
+		if ( !dependentsValid )
+			updateDependents( nif );
 
-		for ( Node * node : nodes.list() )
-			node->update( nif, block );
+		// Only the objects linking to the block can depend on it
+		const QVector<IControllable *> objects = dependents.value( nif->getBlockNumber( block ) );
+		for ( IControllable * obj : objects )
+			obj->update( nif, block );
 	} else {
 		properties.validate();
 		nodes.validate();
 
+		// Drop the shapes deleted by validate() and renumber the rest
+		QVector<Shape *> validShapes;
+		for ( Shape * shape : shapes ) {
+			if ( nodes.list().contains( shape ) ) {
+				shape->shapeNumber = validShapes.count();
+				validShapes.append( shape );
+			}
+		}
+		shapes = validShapes;
+		shapeTreeValid = false;
+
 		for ( Property * p : properties )
 			p->update( nif, p->index() );
 
 		for ( Node * n : nodes.list() )
 			n->update( nif, n->index() );
 
+		dependentsValid = false;
+
 		roots.clear();
 		for ( const auto link : nif->getRootLinks() ) {
 			QModelIndex iBlock = nif->getBlockIndex( link );
@@ -169,6 +202,51 @@ void Scene::update( const NifModel * nif, const QModelIndex & index )
 	timeBoundsValid = false;
 }
 
+void Scene::updateDependents( const NifModel * nif )
+{
+	int numBlocks = nif->getBlockCount();
+
+	dependents.clear();
+	dependents.resize( numBlocks );
+
+	// Links to other nodes are not followed, the nodes have their own entries
+	QVector<bool> isNode( numBlocks, false );
+	for ( Node * node : nodes.list() ) {
+		int b = nif->getBlockNumber( node->index() );
+		if ( b >= 0 && b < numBlocks )
+			isNode[b] = true;
+	}
+
+	auto addObject = [this, nif, numBlocks, &isNode]( IControllable * obj ) {
+		int root = nif->getBlockNumber( obj->index() );
+		if ( root < 0 || root >= numBlocks )
+			return;
+
+		QVector<int> stack = { root };
+		QSet<int> visited = { root };
+
+		while ( !stack.isEmpty() ) {
+			int b = stack.takeLast();
+			dependents[b].append( obj );
+
+			for ( int l : nif->getChildLinks( b ) ) {
+				if ( l >= 0 && l < numBlocks && !isNode.at( l ) && !visited.contains( l ) ) {
+					visited.insert( l );
+					stack.append( l );
+				}
+			}
+		}
+	};
+
+	// Same order as a full update, properties before nodes
+	for ( Property * prop : properties )
+		addObject( prop );
+	for ( Node * node : nodes.list() )
+		addObject( node );
+
+	dependentsValid = true;
+}
+
 void Scene::updateSceneOptions( bool checked )
 {
 	Q_UNUSED( checked );
@@ -265,7 +343,10 @@ Node * Scene::getNode( const NifModel * nif, const QModelIndex & iNode )
 
 	if ( node ) {
 		nodes.add( node );
+		dependentsValid = false;
 		node->update( nif, iNode );
+		if ( shapes.count() != shapeBounds.count() )
+			shapeTreeValid = false;
 	}
 
 	return node;
@@ -278,8 +359,10 @@ Property * Scene::getProperty( const NifModel * nif, const QModelIndex & iProper
 		return prop;
 
 	prop = Property::create( this, nif, iProperty );
-	if ( prop )
+	if ( prop ) {
 		properties.add( prop );
+		dependentsValid = false;
+	}
 	return prop;
 }
 
@@ -294,6 +377,7 @@ Property * Scene::getProperty( const NifModel * nif, const QModelIndex & iParent
 void Scene::setSequence( const QString & seqname )
 {
 	animGroup = seqname;
+	version++;
 
 	for ( Node * node : nodes.list() ) {
 		node->setSequence( seqname );
@@ -307,11 +391,26 @@ void Scene::setSequence( const QString & seqname )
 
 void Scene::transform( const Transform & trans, float time )
 {
+	viewChanged = !( view == trans );
 	view = trans;
 	this->time = time;
 
-	worldTrans.clear();
-	viewTrans.clear();
+	if ( animate != lastAnimate ) {
+		lastAnimate = animate;
+		version++;
+	}
+
+	// Node ids are block numbers, which can grow when blocks are inserted
+	int numIds = 0;
+	for ( Node * node : nodes.list() )
+		numIds = std::max( numIds, node->id() + 1 );
+
+	if ( numIds > transValid.count() ) {
+		worldTrans.resize( numIds );
+		viewTrans.resize( numIds );
+		transValid.resize( numIds );
+	}
+
 	bhkBodyTrans.clear();
 
 	for ( Property * prop : properties ) {
@@ -320,6 +419,9 @@ void Scene::transform( const Transform & trans, float time )
 	for ( Node * node : roots.list() ) {
 		node->transform();
 	}
+
+	updateShapeTree();
+
 	for ( Node * node : roots.list() ) {
 		node->transformShapes();
 	}
@@ -416,6 +518,83 @@ BoundSphere Scene::bounds() const
 	return bndSphere;
 }
 
+BoundSphere Scene::bounds( const Node * node ) const
+{
+	BoundSphere bs = node->bounds();
+
+	BoundingBox box;
+	for ( int i = 0; i < shapes.count() && i < shapeBounds.count(); i++ ) {
+		const Shape * shape = shapes.at( i );
+		if ( shape == node )
+			return bs;
+		if ( shape->findParent( node->id() ) )
+			box |= shapeBounds.at( i );
+	}
+
+	bs |= box.toSphere();
+	return bs;
+}
+
+Scene::RayHit Scene::rayCast( const Ray & ray )
+{
+	RayHit hit;
+	if ( !shapeTreeValid || !( view.scale > 0.0f ) )
+		return hit;
+
+	// The shape tree is in world space
+	shapeTree.raycast( ray.toLocal( view ), hit.distance, [this, &ray, &hit]( int i, float & tFar ) {
+		Shape * shape = shapes.value( i );
+		int triangle, vertex;
+		if ( shape && shape->rayCast( ray, tFar, triangle, vertex ) ) {
+			hit.shape = shape;
+			hit.block = shape->id();
+			hit.triangle = triangle;
+			hit.vertex = vertex;
+			hit.distance = tFar;
+		}
+	} );
+
+	return hit;
+}
+
+void Scene::updateShapeTree()
+{
+	int n = shapes.count();
+
+	shapeBounds.resize( n );
+	for ( int i = 0; i < n; i++ ) {
+		Shape * shape = shapes.at( i );
+		shapeBounds[i] = shape->isHidden() ? BoundingBox() : BoundingBox( shape->bounds() );
+	}
+
+	if ( !shapeTreeValid || shapeTree.primitiveCount() != n ) {
+		shapeTree.build( shapeBounds );
+		shapeTreeValid = true;
+	} else {
+		shapeTree.refit( shapeBounds );
+	}
+
+	// the bounds of skinned shapes are calculated from the bind pose, which the animated pose may leave
+	for ( Shape * shape : shapes )
+		shape->isCulled = !shape->isSkinned;
+
+	Frustum f = frustum.toWorld( view );
+	shapeTree.query( f, [this, &f]( int i ) {
+		if ( f.intersects( shapeBounds.at( i ) ) )
+			shapes.at( i )->isCulled = false;
+	} );
+
+	shapesDrawn = shapesCulled = 0;
+	for ( int i = 0; i < n; i++ ) {
+		if ( shapeBounds.at( i ).isEmpty() )
+			continue;
+		if ( shapes.at( i )->isCulled )
+			shapesCulled++;
+		else
+			shapesDrawn++;
+	}
+}
+
 void Scene::updateTimeBounds() const
 {
 	if ( !nodes.list().isEmpty() ) {
@@ -461,11 +640,13 @@ float Scene::timeMax() const
 
 QString Scene::textStats()
 {
+	QString stats = QString( "shapes drawn: %1, culled: %2\n\n" ).arg( shapesDrawn ).arg( shapesCulled );
+
 	for ( Node * node : nodes.list() ) {
 		if ( node->index() == currentBlock ) {
-			return node->textStats();
+			return stats + node->textStats();
 		}
 	}
-	return QString();
+	return stats;
 }
 
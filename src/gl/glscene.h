@@ -33,6 +33,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef GLSCENE_H
 #define GLSCENE_H
 
+#include "bvh.h"
 #include "glnode.h"
 #include "glproperty.h"
 #include "gltools.h"
@@ -180,14 +181,29 @@ public:
 
 	NodeList roots;
 
-	mutable QHash<int, Transform> worldTrans;
-	mutable QHash<int, Transform> viewTrans;
+	//! Cached world and view transforms, indexed by node id
+	mutable QVector<Transform> worldTrans;
+	mutable QVector<Transform> viewTrans;
+
+	enum TransFlag : quint8
+	{
+		WorldTransValid = 1,
+		ViewTransValid = 2
+	};
+	//! Which cached transforms are valid, indexed by node id, see Node::transform()
+	mutable QVector<quint8> transValid;
+
 	mutable QHash<int, Transform> bhkBodyTrans;
 
 	Transform view;
+	//! Did view change in the last transform()?
+	bool viewChanged = true;
 
 	bool animate;
 
+	//! Incremented when the model is edited, the scene is rebuilt or the animation changes, see IControllable::transform()
+	quint32 version = 0;
+
 	float time;
 
 	QString animGroup;
@@ -201,7 +217,33 @@ public:
 
 	QVector<Shape *> shapes;
 
+	//! Side planes of the view frustum in view space, set by the viewport before transform()
+	Frustum frustum;
+
+	//! Number of visible shapes drawn and culled by the view frustum in the last transform()
+	int shapesDrawn = 0;
+	int shapesCulled = 0;
+
 	BoundSphere bounds() const;
+	//! Bounds of a node including all shapes below it, for centering the view on a selection
+	BoundSphere bounds( const Node * node ) const;
+
+	//! Result of rayCast()
+	struct RayHit
+	{
+		Shape * shape = nullptr;
+		//! Block number of the shape
+		int block = -1;
+		//! Triangle index, see Shape::rayCast()
+		int triangle = -1;
+		//! Vertex index, see Shape::rayCast()
+		int vertex = -1;
+		//! Distance along the ray
+		float distance = FLT_MAX;
+	};
+
+	//! Casts a ray in view space against the visible shapes, as of the last transform()
+	RayHit rayCast( const Ray & ray );
 
 	float timeMin() const;
 	float timeMax() const;
@@ -221,6 +263,29 @@ protected:
 	mutable float tMin = 0, tMax = 0;
 
 	void updateTimeBounds() const;
+
+	//! Value of animate in the last transform()
+	bool lastAnimate = false;
+
+	//! World space bounds of the shapes, indexed the same as shapes
+	QVector<BoundingBox> shapeBounds;
+	//! Hierarchy over shapeBounds
+	BVH shapeTree;
+	bool shapeTreeValid = false;
+
+	//! Refits (or builds) the shape hierarchy and frustum culls the shapes
+	void updateShapeTree();
+
+	//! The objects depending on each block, indexed by block number
+	QVector<QVector<IControllable *>> dependents;
+	bool dependentsValid = false;
+
+	/*! Rebuilds dependents
+	 *
+	 * An object depends on its own block and on every block reachable from it
+	 * through child links, without passing through the blocks of other nodes.
+	 */
+	void updateDependents( const NifModel * nif );
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS( Scene::SceneOptions )
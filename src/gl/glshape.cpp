@@ -60,6 +60,11 @@ void Shape::clear()
 	transBitangents.clear();
 	sortedTriangles.clear();
 
+	triangleTree.clear();
+	treeTriangles.clear();
+	triangleTreeValid = false;
+	rigidDataValid = false;
+
 	bssp = nullptr;
 	bslsp = nullptr;
 	bsesp = nullptr;
@@ -77,6 +82,8 @@ void Shape::transform()
 		auto nif = NifModel::fromValidIndex( iBlock );
 		if ( nif ) {
 			needUpdateBounds = true; // Force update bounds
+			triangleTreeValid = false;
+			rigidDataValid = false;
 			updateData(nif);
 
 			if ( isVertexAlphaAnimation ) {
@@ -139,6 +146,63 @@ void Shape::updateImpl( const NifModel * nif, const QModelIndex & index )
 	}
 }
 
+bool Shape::rayCast( const Ray & ray, float & tMax, int & triangle, int & vertex )
+{
+	if ( isHidden() || isCulled || transVerts.isEmpty() )
+		return false;
+
+	if ( !scene->hasOption(Scene::ShowMarkers) && name.contains( "EditorMarker" ) )
+		return false;
+
+	// Rigid shapes keep their vertices in model space, skinned shapes in view space
+	Ray r = ray;
+	if ( transformRigid ) {
+		if ( !( viewTrans().scale > 0.0f ) )
+			return false;
+		r = ray.toLocal( viewTrans() );
+	}
+
+	updateTriangleTree();
+
+	return rayCastTriangles( triangleTree, treeTriangles, transVerts, r, tMax, triangle, vertex );
+}
+
+QVector<Triangle> Shape::pickTriangles() const
+{
+	if ( tristrips.isEmpty() )
+		return triangles;
+
+	QVector<Triangle> tris = triangles;
+	for ( const TriStrip & strip : tristrips ) {
+		for ( int i = 2; i < strip.count(); i++ ) {
+			quint16 a = strip.at( i - 2 ), b = strip.at( i - 1 ), c = strip.at( i );
+			if ( a != b && b != c && a != c )
+				tris.append( Triangle( a, b, c ) );
+		}
+	}
+	return tris;
+}
+
+void Shape::updateTriangleTree()
+{
+	// Skinned and morphed vertices move, the others only change with the data
+	bool refit = ( triangleTreeValid && ( !transformRigid || !controllers.isEmpty() ) );
+	if ( triangleTreeValid && !refit )
+		return;
+
+	if ( !triangleTreeValid )
+		treeTriangles = pickTriangles();
+
+	QVector<BoundingBox> triBounds( triangleBounds( treeTriangles, transVerts ) );
+
+	if ( refit ) {
+		triangleTree.refit( triBounds );
+	} else {
+		triangleTree.build( triBounds );
+		triangleTreeValid = true;
+	}
+}
+
 void Shape::boneSphere( const NifModel * nif, const QModelIndex & index ) const
 {
 	Node * root = findParent( 0 );
@@ -192,6 +256,8 @@ void Shape::resetSkeletonData()
 
 void Shape::updateShader()
 {
+	rigidDataValid = false;
+
 	if ( bslsp )
 		translucent = (bslsp->alpha < 1.0) || bslsp->hasRefraction;
 	else if ( bsesp )
@@ -34,6 +34,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define GLSHAPE_H
 
 #include "gl/glnode.h" // Inherited
+#include "gl/bvh.h"
 #include "gl/gltools.h"
 
 #include <QPersistentModelIndex>
@@ -49,6 +50,7 @@ class Shape : public Node
 	friend class MorphController;
 	friend class UVController;
 	friend class Renderer;
+	friend class Scene;
 
 public:
 	Shape( Scene * s, const QModelIndex & b );
@@ -63,6 +65,16 @@ public:
 	virtual void drawVerts() const {};
 	virtual QModelIndex vertexAt( int ) const { return QModelIndex(); };
 
+	/*! Casts a ray against the triangles of the shape
+	 *
+	 * @param[in]     ray		Ray in view space
+	 * @param[in,out] tMax		Maximum distance along the ray, shortened to the distance of the hit
+	 * @param[out]    triangle	Index of the hit triangle in pickTriangles()
+	 * @param[out]    vertex	Vertex of the hit triangle closest to the hit point
+	 * @return					True if the shape was hit closer than tMax
+	 */
+	bool rayCast( const Ray & ray, float & tMax, int & triangle, int & vertex );
+
 protected:
 	int shapeNumber;
 
@@ -113,6 +125,8 @@ protected:
 
 	//! Is the transform rigid or weighted?
 	bool transformRigid = true;
+	//! Are the transformed arrays of a rigid shape up to date with the data and shader?
+	bool rigidDataValid = false;
 	//! Transformed vertices
 	QVector<Vector3> transVerts;
 	//! Transformed normals
@@ -126,6 +140,8 @@ protected:
 
 	//! Toggle for skinning
 	bool isSkinned = false;
+	//! Outside the view frustum, set by Scene::transform()
+	bool isCulled = false;
 
 	int skeletonRoot = 0;
 	Transform skeletonTrans;
@@ -164,6 +180,16 @@ protected:
 	mutable BoundSphere boundSphere;
 	mutable bool needUpdateBounds = false;
 
+	//! Triangles tested by rayCast(), the triangles followed by the triangulated strips
+	virtual QVector<Triangle> pickTriangles() const;
+
+	//! Triangle hierarchy for rayCast(), in the same space as transVerts
+	BVH triangleTree;
+	QVector<Triangle> treeTriangles;
+	bool triangleTreeValid = false;
+
+	void updateTriangleTree();
+
 	bool isLOD = false;
 };
 
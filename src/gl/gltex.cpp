@@ -38,11 +38,15 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "model/nifmodel.h"
 
 #include <QDebug>
+#include <QDateTime>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QListView>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QSettings>
+#include <QThread>
 
 #include <algorithm>
 
@@ -59,6 +63,83 @@ int TexCache::num_txtunits_client = 0;
 int TexCache::pbrCubeMapResolution = 512;
 int TexCache::pbrImportanceSamples = 256;
 int TexCache::hdrToneMapLevel = 8;
+int TexCache::uploadTimeBudget = 4;
+qint64 TexCache::memoryBudget = 0;
+quint32 TexCache::cubeMapSettingsVersion = 0;
+std::atomic< bool > TexCache::alternateExtensions = false;
+
+struct TexCache::LoadJob
+{
+	QString filename;
+	QString filepath;
+	//! Path on disk if the file is loose, otherwise it is extracted from the archives of 'resources'
+	QString looseFile;
+	//! Resources of the model, referenced until the job is deleted, as the model may be closed in the meantime
+	Game::GameManager::GameResources * resources = nullptr;
+	QByteArray data;
+	QString status;
+	qint64 fileSize = -1;
+	qint64 fileTime = -1;
+	qint64 readTime = 0;
+	//! Filtered diffuse cube map for image based lighting
+	QByteArray diffuseData;
+	int bsVersion = 0;
+	PBRFilterSettings filterSettings;
+	quint32 settingsVersion = 0;
+	std::atomic< bool > finished = false;
+	//! Set if the texture was deleted while loading
+	std::atomic< bool > cancelled = false;
+
+	~LoadJob()
+	{
+		Game::GameManager::releaseResources( resources );
+	}
+};
+
+static inline bool isColorTexture( const QString & file )
+{
+	return ( file.startsWith("#") && (file.length() == 9 || file.length() == 10) );
+}
+
+//! Calculate the GPU memory used by all faces and mipmaps of a texture, leaves the texture bound
+static qint64 textureMemory( GLenum target, GLuint id )
+{
+	if ( !id || id == 0xFFFFFFFF )
+		return 0;
+
+	glBindTexture( target, id );
+	GLenum	t = target;
+	qint64	faces = 1;
+	if ( target == GL_TEXTURE_CUBE_MAP ) {
+		t = GL_TEXTURE_CUBE_MAP_POSITIVE_X;
+		faces = 6;
+	}
+
+	qint64	bytes = 0;
+	for ( GLint level = 0; level < 16; level++ ) {
+		GLint	w = 0, h = 0, compressed = 0;
+		glGetTexLevelParameteriv( t, level, GL_TEXTURE_WIDTH, &w );
+		glGetTexLevelParameteriv( t, level, GL_TEXTURE_HEIGHT, &h );
+		if ( w <= 0 || h <= 0 )
+			break;
+		glGetTexLevelParameteriv( t, level, GL_TEXTURE_COMPRESSED, &compressed );
+		if ( compressed ) {
+			GLint	n = 0;
+			glGetTexLevelParameteriv( t, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &n );
+			bytes += n;
+			continue;
+		}
+		GLint	bits = 0;
+		for ( GLenum p : { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_SHARED_SIZE } ) {
+			GLint	n = 0;
+			glGetTexLevelParameteriv( t, level, p, &n );
+			bits += n;
+		}
+		bytes += qint64( w ) * h * ( bits > 0 ? bits : 32 ) / 8;
+	}
+
+	return bytes * faces;
+}
 
 //! Maximum anisotropy
 float max_anisotropy = 1.0f;
@@ -199,18 +280,23 @@ QString TexCache::TexFmt::toString() const
 
 TexCache::TexCache( QObject * parent ) : QObject( parent )
 {
+	// leave at least one core for the GUI thread, resource access is serialized anyway
+	loaderPool.setMaxThreadCount( std::clamp( QThread::idealThreadCount() - 1, 1, 4 ) );
 }
 
 TexCache::~TexCache()
 {
+	loaderPool.clear();
+	loaderPool.waitForDone();
 	//flush();
 }
 
-QString TexCache::find( const QString & file, const NifModel * nif )
+//! Find a texture in 'resources', trying other extensions if enabled
+static QString findTexture( const QString & file, Game::GameManager::GameResources & resources )
 {
 	if ( file.isEmpty() )
 		return QString();
-	if ( file.startsWith("#") && (file.length() == 9 || file.length() == 10) )
+	if ( isColorTexture( file ) )
 		return file;
 
 	QString filename( file );
@@ -221,23 +307,39 @@ QString TexCache::find( const QString & file, const NifModel * nif )
 
 	// attempt to find the texture with one of the extensions
 	for ( size_t i = 0; i < 6; i++ ) {
-		QString	fullPath;
-		if ( !nif )
-			fullPath = Game::GameManager::find_file( Game::OTHER, filename, "textures", extensions[i] );
-		else
-			fullPath = nif->findResourceFile( filename, "textures", extensions[i] );
+		QString	fullPath( resources.find_file( Game::GameManager::get_full_path( filename, "textures", extensions[i] ) ) );
 		if ( !fullPath.isEmpty() )
 			return fullPath;
-		if ( i == 0 ) {
-			QSettings settings;
-			if ( !settings.value( "Settings/Resources/Alternate Extensions", false ).toBool() )
-				break;
-		}
+		if ( !TexCache::alternateExtensions.load( std::memory_order_relaxed ) )
+			break;
 	}
 
 	return filename;
 }
 
+//! Get the content identity of a texture source that is a loose file in 'resources', and return its path on disk
+static QString looseFileIdentity(
+	const Game::GameManager::GameResources & resources, const QString & filepath, qint64 & fileSize, qint64 & fileTime )
+{
+	fileSize = fileTime = -1;
+	if ( filepath.isEmpty() || isColorTexture( filepath ) )
+		return QString();
+
+	std::string	fullPath( Game::GameManager::get_full_path( filepath, "textures", "" ) );
+	QString	looseFile( Game::GameManager::loose_file_path( resources, fullPath ) );
+	if ( looseFile.isEmpty() )
+		return looseFile;
+	QFileInfo	f( looseFile );
+	fileSize = f.size();
+	fileTime = f.lastModified().toMSecsSinceEpoch();
+	return looseFile;
+}
+
+QString TexCache::find( const QString & file, const NifModel * nif )
+{
+	return findTexture( file, Game::GameManager::getNIFResources( nif ) );
+}
+
 /*!
  * Note: all original morrowind nifs use name.ext only for addressing the
  * textures, but most mods use something like textures/[subdir/]name.ext.
@@ -301,14 +403,38 @@ int TexCache::bind( const QString & fname, const NifModel * nif, bool useSecondT
 		tx->mipmaps = 0;
 
 		textures.insert( tx->filename, tx );
+		tx->lastUsed = generation;
+		tx->lastFrame = frameNumber;
+		tx->bindCount = 1;
+		counters.misses++;
 
 		if ( !isSupported( fname ) ) {
 			tx->id[0] = 0xFFFFFFFF;
-		} else {
+		} else if ( !streaming || isColorTexture( fname ) ) {
+			// generated textures are cheap, load them immediately
 			tx->filepath = find( tx->filename, nif );
+			getFileIdentity( nif, tx->filepath, tx->fileSize, tx->fileTime );
 			tx->load( nif );
+			counters.bytes += tx->memorySize;
+			counters.uploadTime += tx->uploadTime;
 			return tx->mipmaps;
+		} else {
+			startLoad( tx, nif );
+			return 0;
 		}
+		return 0;
+	}
+
+	tx->lastUsed = generation;
+	tx->lastFrame = frameNumber;
+	tx->bindCount++;
+
+	// until the texture is uploaded, 0 is returned and the caller uses its default texture
+	if ( tx->job ) [[unlikely]] {
+		if ( !finishLoad( tx, nif ) )
+			return 0;
+	} else {
+		counters.hits++;
 	}
 
 	if ( tx->id[0] == 0xFFFFFFFF ) [[unlikely]]
@@ -337,17 +463,21 @@ int TexCache::bind( const QModelIndex & iSource )
 					tx = new Tex();
 					tx->id[0] = 0;
 					tx->id[1] = 0;
+					counters.misses++;
 					try
 					{
 						glGenTextures( 1, tx->id );
 						glBindTexture( GL_TEXTURE_2D, tx->id[0] );
 						embedTextures.insert( iData, tx );
 						texLoad( iData, tx->format, tx->target, tx->width, tx->height, tx->mipmaps, tx->id );
+						tx->memorySize = textureMemory( GL_TEXTURE_2D, tx->id[0] );
+						counters.bytes += tx->memorySize;
 					}
 					catch ( QString & e ) {
 						tx->status = e;
 					}
 				} else {
+					counters.hits++;
 					glBindTexture( GL_TEXTURE_2D, tx->id[0] );
 				}
 
@@ -361,26 +491,202 @@ int TexCache::bind( const QModelIndex & iSource )
 	return 0;
 }
 
-void TexCache::flush()
+void TexCache::beginFrame()
 {
+	frameTimer.start();
+	uploadsThisFrame = 0;
+	frameNumber++;
+
+	if ( memoryBudget > 0 && counters.bytes > memoryBudget ) [[unlikely]]
+		evict();
+}
+
+void TexCache::evict()
+{
+	// textures bound in the last few frames are in use and are never evicted
+	constexpr quint32	minFrames = 8;
+
+	QVector< Tex * >	candidates;
 	for ( Tex * tx : textures ) {
-		if ( tx->id[0] )
-			glDeleteTextures( ( !tx->id[1] ? 1 : 2 ), tx->id );
+		if ( !tx->job && tx->memorySize > 0 && ( frameNumber - tx->lastFrame ) > minFrames )
+			candidates.append( tx );
 	}
-	qDeleteAll( textures );
-	textures.clear();
+	std::sort( candidates.begin(), candidates.end(), []( const Tex * a, const Tex * b ) {
+		return ( a->lastFrame < b->lastFrame );
+	} );
 
-	for ( Tex * tx : embedTextures ) {
-		if ( tx->id[0] )
-			glDeleteTextures( ( !tx->id[1] ? 1 : 2 ), tx->id );
+	for ( Tex * tx : candidates ) {
+		if ( counters.bytes <= memoryBudget )
+			break;
+		textures.remove( tx->filename );
+		deleteTex( tx );
+		counters.evictions++;
 	}
-	qDeleteAll( embedTextures );
+}
+
+void TexCache::startLoad( Tex * tx, const NifModel * nif )
+{
+	auto	job = std::make_shared< LoadJob >();
+	job->filename = tx->filename;
+	job->bsVersion = ( nif ? int( nif->getBSVersion() ) : 0 );
+	job->filterSettings = PBRFilterSettings::current();
+	job->settingsVersion = cubeMapSettingsVersion;
+	tx->job = job;
+
+	// the path is resolved on the worker, which may wait for the archives to be opened, against the resources
+	// of the model at the time of the request, these stay valid while the job exists
+	job->resources = Game::GameManager::acquireNIFResources( nif );
+
+	loaderPool.start( [this, job]() {
+		if ( job->cancelled.load( std::memory_order_relaxed ) )
+			return;
+
+		QElapsedTimer	t;
+		t.start();
+
+		// only loose files can be found while the archives are being loaded in the background
+		job->resources->wait_for_preload();
+		job->filepath = findTexture( job->filename, *( job->resources ) );
+		job->looseFile = looseFileIdentity( *( job->resources ), job->filepath, job->fileSize, job->fileTime );
+
+		bool	fileFound;
+		if ( !job->looseFile.isEmpty() ) {
+			QFile	f( job->looseFile );
+			fileFound = f.open( QIODevice::ReadOnly );
+			if ( fileFound )
+				job->data = f.readAll();
+		} else {
+			fileFound = job->resources->get_file( job->data, Game::GameManager::get_full_path( job->filepath, "textures", "" ) );
+		}
+		if ( !fileFound )
+			job->status = QString( "could not open file" );
+		else if ( job->data.isEmpty() )
+			job->status = QString( "empty file" );
+
+		// prefilter FO76 and Starfield environment maps here instead of on the GUI thread
+		bool	isCubeMapSource = ( job->filepath.endsWith( ".dds", Qt::CaseInsensitive ) || job->filepath.endsWith( ".hdr", Qt::CaseInsensitive ) );
+		if ( job->status.isEmpty() && job->bsVersion >= 151 && isCubeMapSource ) {
+			qint64	t0 = t.nsecsElapsed();
+			if ( texPrefilterPBRCubeMap( job->bsVersion, job->data, job->diffuseData, job->filterSettings, &job->cancelled ) ) {
+				qCDebug( nsGl ) << "Prefiltered cube map" << job->filepath << "at" << job->filterSettings.resolution
+								<< "with" << job->filterSettings.importanceSamples << "samples in"
+								<< ( t.nsecsElapsed() - t0 ) / 1000000 << "ms";
+			}
+		}
+
+		job->readTime = t.nsecsElapsed() / 1000;
+		job->finished.store( true, std::memory_order_release );
+		requestRefresh();
+	} );
+}
+
+bool TexCache::finishLoad( Tex * tx, const NifModel * nif )
+{
+	if ( !tx->job->finished.load( std::memory_order_acquire ) )
+		return false;
+
+	// cube maps filtered with old settings are loaded again
+	if ( !tx->job->diffuseData.isEmpty() && tx->job->settingsVersion != cubeMapSettingsVersion ) {
+		startLoad( tx, nif );
+		return false;
+	}
+
+	// decoding and uploading runs on the GUI thread, spread it over multiple frames if needed
+	if ( frameTimer.isValid() && uploadsThisFrame > 0 && frameTimer.elapsed() >= uploadTimeBudget ) {
+		requestRefresh();
+		return false;
+	}
+
+	std::shared_ptr< LoadJob >	job = std::move( tx->job );
+	tx->filepath = job->filepath;
+	tx->fileSize = job->fileSize;
+	tx->fileTime = job->fileTime;
+	tx->readTime = job->readTime;
+	counters.readTime += job->readTime;
+	if ( !job->status.isEmpty() ) {
+		tx->status = job->status;
+		return true;
+	}
+
+	tx->load( nif, job->data, job->diffuseData );
+	counters.bytes += tx->memorySize;
+	counters.uploadTime += tx->uploadTime;
+	uploadsThisFrame++;
+	return true;
+}
+
+void TexCache::requestRefresh()
+{
+	if ( refreshPending.exchange( true ) )
+		return;
+
+	QMetaObject::invokeMethod( this, [this]() {
+		refreshPending = false;
+		emit sigRefresh();
+	}, Qt::QueuedConnection );
+}
+
+QString TexCache::getFileIdentity( const NifModel * nif, const QString & filepath, qint64 & fileSize, qint64 & fileTime )
+{
+	return looseFileIdentity( Game::GameManager::getNIFResources( nif ), filepath, fileSize, fileTime );
+}
+
+void TexCache::deleteTex( Tex * tx )
+{
+	if ( tx->job )
+		tx->job->cancelled = true;
+	counters.bytes -= tx->memorySize;
+	if ( tx->id[0] && tx->id[0] != 0xFFFFFFFF )
+		glDeleteTextures( ( !tx->id[1] ? 1 : 2 ), tx->id );
+	delete tx;
+}
+
+void TexCache::purge( const NifModel * nif )
+{
+	for ( auto i = textures.begin(); i != textures.end(); ) {
+		Tex *	tx = i.value();
+		bool	keep = ( tx->lastUsed == generation );
+		if ( keep && !tx->job && tx->id[0] != 0xFFFFFFFF ) {
+			QString	filepath( find( tx->filename, nif ) );
+			qint64	fileSize, fileTime;
+			getFileIdentity( nif, filepath, fileSize, fileTime );
+			keep = ( filepath == tx->filepath && fileSize == tx->fileSize && fileTime == tx->fileTime );
+		}
+		if ( keep ) {
+			i++;
+			continue;
+		}
+		deleteTex( tx );
+		i = textures.erase( i );
+	}
+
+	for ( Tex * tx : embedTextures )
+		deleteTex( tx );
+	embedTextures.clear();
+
+	generation++;
+}
+
+void TexCache::flush()
+{
+	// jobs already running finish on their own, their textures are released with the last reference
+	loaderPool.clear();
+
+	for ( Tex * tx : textures )
+		deleteTex( tx );
+	textures.clear();
+
+	for ( Tex * tx : embedTextures )
+		deleteTex( tx );
 	embedTextures.clear();
 }
 
 void TexCache::setNifFolder( const QString & folder )
 {
-	(void) folder;
+	// relative paths resolve differently in another folder, otherwise the textures are revalidated by purge()
+	if ( folder == nifFolder && !textures.isEmpty() )
+		return;
+	nifFolder = folder;
 	flush();
 	emit sigRefresh();
 }
@@ -394,32 +700,74 @@ QString TexCache::info( const QModelIndex & iSource )
 		if ( nif->get<quint8>( iSource, "Use External" ) == 0 ) {
 			QModelIndex iData = nif->getBlockIndex( nif->getLink( iSource, "Pixel Data" ) );
 
-			if ( iData.isValid() ) {
-				Tex * tx = embedTextures.value( iData );
-				temp = QString( "Embedded texture: %1\nWidth: %2\nHeight: %3\nMipmaps: %4" )
+			Tex * tx = embedTextures.value( iData );
+			if ( iData.isValid() && tx ) {
+				temp = QString( "Embedded texture: %1\nWidth: %2\nHeight: %3\nMipmaps: %4\nMemory: %5 KB" )
 						.arg( tx->format.toString() )
 						.arg( tx->width )
 						.arg( tx->height )
-						.arg( tx->mipmaps );
+						.arg( tx->mipmaps )
+						.arg( double( tx->memorySize ) / 1024.0, 0, 'f', 1 );
 			} else {
 				temp = QString( "Embedded texture invalid" );
 			}
 		} else {
-			QString filename = nif->get<QString>( iSource, "File Name" );
-			Tex * tx = textures.value( filename );
-			temp = QString( "External texture file: %1\nTexture path: %2\nFormat: %3\nWidth: %4\nHeight: %5\nMipmaps: %6" )
-					.arg( tx->filename )
-					.arg( tx->filepath )
-					.arg( tx->format.toString() )
-					.arg( tx->width )
-					.arg( tx->height )
-					.arg( tx->mipmaps );
+			temp = info( nif->get<QString>( iSource, "File Name" ) );
 		}
 	}
 
 	return temp;
 }
 
+QString TexCache::info( const QString & file ) const
+{
+	const Tex *	tx = getTextureInfo( file );
+	if ( !tx )
+		return QString( "External texture file: %1 (not loaded)" ).arg( file );
+
+	QString	temp = QString( "External texture file: %1\nTexture path: %2\nFormat: %3\nWidth: %4\nHeight: %5\nMipmaps: %6" )
+			.arg( tx->filename )
+			.arg( tx->filepath )
+			.arg( tx->format.toString() )
+			.arg( tx->width )
+			.arg( tx->height )
+			.arg( tx->mipmaps );
+	if ( tx->job )
+		return temp + QString( "\nLoading..." );
+	temp += QString( "\nMemory: %1 KB\nRead time: %2 ms\nUpload time: %3 ms\nBinds: %4 (last frame %5)" )
+			.arg( double( tx->memorySize ) / 1024.0, 0, 'f', 1 )
+			.arg( double( tx->readTime ) / 1000.0, 0, 'f', 2 )
+			.arg( double( tx->uploadTime ) / 1000.0, 0, 'f', 2 )
+			.arg( tx->bindCount )
+			.arg( tx->lastFrame );
+	if ( !tx->status.isEmpty() )
+		temp += QString( "\nStatus: %1" ).arg( tx->status );
+	return temp;
+}
+
+TexCache::Stats TexCache::stats() const
+{
+	Stats	s = counters;
+	s.count = int( textures.size() + embedTextures.size() );
+	return s;
+}
+
+QString TexCache::statsText() const
+{
+	Stats	s = stats();
+	quint64	binds = s.hits + s.misses;
+	QString	temp = QString( "Textures: %1, %2 MB" ).arg( s.count ).arg( double( s.bytes ) / 1048576.0, 0, 'f', 1 );
+	if ( memoryBudget > 0 )
+		temp += QString( " of %1 MB" ).arg( memoryBudget >> 20 );
+	temp += QString( "\nHit rate: %1% (%2 binds), evicted: %3\nRead time: %4 ms, upload time: %5 ms" )
+			.arg( binds ? double( s.hits ) * 100.0 / double( binds ) : 0.0, 0, 'f', 1 )
+			.arg( binds )
+			.arg( s.evictions )
+			.arg( double( s.readTime ) / 1000.0, 0, 'f', 1 )
+			.arg( double( s.uploadTime ) / 1000.0, 0, 'f', 1 );
+	return temp;
+}
+
 bool TexCache::exportFile( const QModelIndex & iSource, QString & filepath )
 {
 	Tex * tx = embedTextures.value( iSource );
@@ -454,6 +802,13 @@ bool TexCache::importFile( NifModel * nif, const QModelIndex & iSource, QModelIn
 */
 
 void TexCache::Tex::load( const NifModel * nif )
+{
+	QByteArray	data;
+	QByteArray	diffuseData;
+	load( nif, data, diffuseData );
+}
+
+void TexCache::Tex::load( const NifModel * nif, QByteArray & data, QByteArray & diffuseData )
 {
 	if ( !id[0] )
 		glGenTextures( 1, id );
@@ -464,15 +819,24 @@ void TexCache::Tex::load( const NifModel * nif )
 	if ( target )
 		glBindTexture( target, id[0] );
 
+	QElapsedTimer	t;
+	t.start();
 	try
 	{
-		QByteArray	data;
-		texLoad( nif, filepath, format, target, width, height, mipmaps, data, id );
+		texLoad( nif, filepath, format, target, width, height, mipmaps, data, diffuseData, id );
 	}
 	catch ( QString & e )
 	{
 		status = e;
 	}
+
+	// the second texture is measured first so that the primary one stays bound
+	memorySize = 0;
+	if ( mipmaps ) {
+		GLenum	tgt = ( target ? target : GL_TEXTURE_2D );
+		memorySize = textureMemory( tgt, id[1] ) + textureMemory( tgt, id[0] );
+	}
+	uploadTime = t.nsecsElapsed() / 1000;
 }
 
 bool TexCache::Tex::saveAsFile( const QModelIndex & index, QString & savepath )
@@ -510,6 +874,14 @@ bool TexCache::loadSettings( QSettings & settings )
 	tmp = std::min< int >( std::max< int >( tmp, 0 ), 16 );
 	r = r | ( tmp != hdrToneMapLevel );
 	hdrToneMapLevel = tmp;
+	if ( r )
+		cubeMapSettingsVersion++;
+
+	alternateExtensions.store( settings.value( "Settings/Resources/Alternate Extensions", false ).toBool(), std::memory_order_relaxed );
+
+	// does not require flushing, the budget is applied on the next frame
+	tmp = settings.value( "Settings/Render/General/Texture Memory Budget", 0 ).toInt();
+	memoryBudget = qint64( std::max< int >( tmp, 0 ) ) << 20;
 
 	return r;
 }
@@ -35,9 +35,14 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QObject> // Inherited
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QPersistentModelIndex>
 #include <QString>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
 
 
 //! @file gltex.h TexCache etc. header
@@ -85,6 +90,9 @@ public:
 		QString toString() const;
 	};
 
+	//! Texture file lookup and extraction running on the loader thread pool
+	struct LoadJob;
+
 	//! A structure for storing information on a single texture.
 	struct Tex
 	{
@@ -106,9 +114,27 @@ public:
 		TexFmt format;
 		//! Status messages
 		QString status;
+		//! Background load in progress, the texture is not uploaded yet
+		std::shared_ptr< LoadJob > job;
+		//! Size and modification time of the source if it is a loose file, -1 if archived or generated
+		qint64 fileSize = -1;
+		qint64 fileTime = -1;
+		//! Cache generation in which the texture was last bound
+		quint32 lastUsed = 0;
+		//! Frame in which the texture was last bound, for LRU eviction
+		quint32 lastFrame = 0;
+		//! Number of times the texture was bound
+		quint32 bindCount = 0;
+		//! GPU memory used by all faces and mipmaps of the texture, in bytes
+		qint64 memorySize = 0;
+		//! Time spent reading the file and decoding/uploading it, in microseconds
+		qint64 readTime = 0;
+		qint64 uploadTime = 0;
 
 		//! Load the texture
 		void load( const NifModel * nif );
+		//! Load the texture from file data that has already been read, and prefiltered if it is a PBR cube map
+		void load( const NifModel * nif, QByteArray & data, QByteArray & diffuseData );
 
 		//! Save the texture as a file
 		bool saveAsFile( const QModelIndex & index, QString & savepath );
@@ -124,8 +150,42 @@ public:
 	//! Bind a texture from pixel data
 	int bind( const QModelIndex & iSource );
 
+	/*! Evict textures that are no longer referenced or whose source has changed
+	 *
+	 * Textures not bound since the previous call, and textures that now resolve to a different
+	 * path or whose loose file has been modified are deleted, the rest is kept for reuse when the
+	 * scene is rebuilt. Embedded textures are keyed by model index and are always deleted.
+	 */
+	void purge( const NifModel * nif );
+
+	//! Enable loading external texture files in the background, bind() returns 0 until they are ready
+	inline void setStreaming( bool enabled ) { streaming = enabled; }
+	//! Start a new frame, resetting the time budget for uploading textures that finished loading
+	void beginFrame();
+
 	//! Debug function for getting info about a texture
 	QString info( const QModelIndex & iSource );
+	//! Get info about an external texture by file name, including memory use and load times
+	QString info( const QString & file ) const;
+
+	//! Statistics of the whole cache, see stats()
+	struct Stats
+	{
+		//! Number of textures and GPU memory used by them
+		int count = 0;
+		qint64 bytes = 0;
+		//! Binds of textures that were already uploaded, and binds that required loading
+		quint64 hits = 0;
+		quint64 misses = 0;
+		//! Number of textures evicted to stay within memoryBudget
+		quint64 evictions = 0;
+		//! Total time spent reading and decoding/uploading textures, in microseconds
+		qint64 readTime = 0;
+		qint64 uploadTime = 0;
+	};
+	Stats stats() const;
+	//! Summary of stats() as text
+	QString statsText() const;
 
 	//! Export pixel data to a file
 	bool exportFile( const QModelIndex & iSource, QString & filepath );
@@ -148,6 +208,15 @@ public:
 	static int	pbrCubeMapResolution;
 	static int	pbrImportanceSamples;
 	static int	hdrToneMapLevel;
+	//! Time in milliseconds that may be spent per frame on uploading textures
+	static int	uploadTimeBudget;
+	//! Texture memory in bytes above which least recently used textures are evicted, 0 for no limit
+	static qint64	memoryBudget;
+	//! Try other extensions if a texture is not found, snapshot of "Settings/Resources/Alternate Extensions".
+	// Textures are looked up on the loader threads, which may run while the settings are reloaded.
+	static std::atomic< bool >	alternateExtensions;
+	//! Incremented when the cube map filter settings change, to discard results filtered with the old ones
+	static quint32	cubeMapSettingsVersion;
 
 signals:
 	void sigRefresh();
@@ -163,9 +232,32 @@ public slots:
 	void setNifFolder( const QString & );
 
 protected:
+	//! Queue the file lookup and extraction of a texture on the loader threads, against the resources of 'nif'
+	void startLoad( Tex * tx, const NifModel * nif );
+	//! Upload a texture if its file data is ready and the frame budget allows it
+	bool finishLoad( Tex * tx, const NifModel * nif );
+	//! Emit sigRefresh from the GUI thread, at most once per event loop iteration
+	void requestRefresh();
+	//! Delete a texture and its GL objects
+	void deleteTex( Tex * tx );
+	//! Delete textures not bound in recent frames, least recently used first, until memoryBudget is met
+	void evict();
+	//! Get the content identity of a texture source that is a loose file, and return its path on disk
+	static QString getFileIdentity( const NifModel * nif, const QString & filepath, qint64 & fileSize, qint64 & fileTime );
+
 	QHash<QString, Tex *> textures;
 	QHash<QModelIndex, Tex *> embedTextures;
 
+	QThreadPool loaderPool;
+	bool streaming = false;
+	QString nifFolder;
+	quint32 generation = 0;
+	std::atomic< bool > refreshPending = false;
+	QElapsedTimer frameTimer;
+	int uploadsThisFrame = 0;
+	quint32 frameNumber = 0;
+	Stats counters;
+
 public:
 	inline const Tex * getTextureInfo( const QString & file ) const
 	{
@@ -44,11 +44,17 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QBuffer>
 #include <QByteArray>
+#include <QCache>
+#include <QCryptographicHash>
+#include <QMutex>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QModelIndex>
 #include <QOpenGLContext>
+#include <QSaveFile>
+#include <QStandardPaths>
 #include <QString>
 #include <QtEndian>
 
@@ -667,26 +673,134 @@ GLuint texLoadDDS( const QString & filepath, GLenum & target, GLuint & mipmaps,
 	return mipmaps;
 }
 
-static SFCubeMapCache	sfCubeMapCache;
+/*! Cache of prefiltered PBR cube maps
+ *
+ * Converted DDS images are stored on disk, keyed by a hash of the source image and the filtering
+ * parameters, with an in-memory cache of the most recently used ones in front of it.
+ * The cache is shared by the GUI thread and the texture loader threads.
+ */
+class PBRCubeMapCache
+{
+public:
+	//! Maximum size of the in-memory cache, and of the cache folder on disk
+	static constexpr int	memoryLimit = 256 << 20;
+	static constexpr qint64	diskLimit = qint64( 1024 ) << 20;
+
+	static QByteArray key( const QByteArray & data, const PBRFilterSettings & settings, float normalizeLevel )
+	{
+		QCryptographicHash	h( QCryptographicHash::Md5 );
+		h.addData( data );
+		std::int32_t	params[4] = {
+			settings.resolution, settings.importanceSamples, settings.toneMapLevel,
+			std::int32_t( normalizeLevel * 65536.0f + 0.5f )
+		};
+		h.addData( reinterpret_cast< const char * >( params ), int( sizeof( params ) ) );
+		return h.result().toHex();
+	}
+
+	bool find( const QByteArray & key, QByteArray & data )
+	{
+		QMutexLocker	lock( &mutex );
+		if ( const QByteArray * p = memCache.object( key ) ) {
+			data = *p;
+			return true;
+		}
+
+		QFile	f( filePath( key ) );
+		if ( !f.open( QIODevice::ReadOnly ) )
+			return false;
+		data = f.readAll();
+		if ( data.size() < 148 ) {
+			data.clear();
+			return false;
+		}
+		memCache.insert( key, new QByteArray( data ), data.size() );
+		return true;
+	}
+
+	void insert( const QByteArray & key, const QByteArray & data )
+	{
+		QMutexLocker	lock( &mutex );
+		memCache.insert( key, new QByteArray( data ), data.size() );
+
+		QDir	d;
+		if ( !d.mkpath( folder() ) )
+			return;
+		// written to a temporary file and renamed, so that other instances never read a partial file
+		QSaveFile	f( filePath( key ) );
+		if ( f.open( QIODevice::WriteOnly ) && f.write( data ) == data.size() && f.commit() )
+			prune();
+	}
+
+	void clear()
+	{
+		QMutexLocker	lock( &mutex );
+		memCache.clear();
+		QDir( folder() ).removeRecursively();
+	}
+
+protected:
+	QMutex	mutex;
+	QCache< QByteArray, QByteArray >	memCache{ memoryLimit };
+
+	static QString folder()
+	{
+		return QStandardPaths::writableLocation( QStandardPaths::CacheLocation ) + "/cubemaps";
+	}
+
+	static QString filePath( const QByteArray & key )
+	{
+		return folder() + "/" + QString::fromLatin1( key ) + ".dds";
+	}
+
+	//! Delete the least recently written files if the cache folder is over diskLimit
+	static void prune()
+	{
+		QFileInfoList	files = QDir( folder() ).entryInfoList( { "*.dds" }, QDir::Files, QDir::Time );
+		qint64	totalSize = 0;
+		for ( const auto & i : files ) {
+			totalSize += i.size();
+			if ( totalSize > diskLimit )
+				QFile::remove( i.absoluteFilePath() );
+		}
+	}
+};
+
+static PBRCubeMapCache	pbrCubeMapCache;
 
 void TexCache::clearCubeCache()
 {
-	sfCubeMapCache.clear();
+	pbrCubeMapCache.clear();
+	TexCache::cubeMapSettingsVersion++;
 }
 
-GLuint texLoadPBRCubeMap( const NifModel * nif, const QString & filepath, GLenum & target, GLuint & mipmaps, QByteArray & data, GLuint * id )
+// (public function, documented in gltexloaders.h)
+PBRFilterSettings PBRFilterSettings::current()
 {
+	PBRFilterSettings	s;
+	s.resolution = TexCache::pbrCubeMapResolution;
+	s.importanceSamples = TexCache::pbrImportanceSamples;
+	s.toneMapLevel = TexCache::hdrToneMapLevel;
+	return s;
+}
+
+// (public function, documented in gltexloaders.h)
+bool texPrefilterPBRCubeMap(
+	int bsVersion, QByteArray & data, QByteArray & diffuseData, const PBRFilterSettings & settings,
+	const std::atomic< bool > * cancel )
+{
+	diffuseData.clear();
 	if ( data.size() < 148 )
-		return 0;
+		return false;
 
-	const unsigned char *	dataPtr = reinterpret_cast< unsigned char * >( data.data() );
+	unsigned char *	dataPtr = reinterpret_cast< unsigned char * >( data.data() );
 	float	normalizeLevel = 1.0f / 12.0f;
 	bool	filterDisabled = false;
 	do {
 		if ( FileBuffer::readUInt64Fast( dataPtr ) == 0x4E41494441523F23ULL ) {	// "#?RADIAN"
-			normalizeLevel = float( ( 16 - TexCache::hdrToneMapLevel ) * ( 16 - TexCache::hdrToneMapLevel ) + 128 );
+			normalizeLevel = float( ( 16 - settings.toneMapLevel ) * ( 16 - settings.toneMapLevel ) + 128 );
 			normalizeLevel *= 3.0f / 4096.0f;
-			if ( nif->getBSVersion() >= 170 )	// not Fallout 76
+			if ( bsVersion >= 170 )	// not Fallout 76
 				break;
 			for ( size_t i = 0; i <= 144; i++ ) {
 				std::uint32_t	tmp = FileBuffer::readUInt32Fast( dataPtr + i );
@@ -707,46 +821,84 @@ GLuint texLoadPBRCubeMap( const NifModel * nif, const QString & filepath, GLenum
 				break;
 			}
 		}
-		return 0;
+		return false;
 	} while ( false );
 
-	if ( !filterDisabled ) {
-		std::uint32_t	width = std::uint32_t( TexCache::pbrCubeMapResolution );
+	// solid color cube maps are cheap to filter and are not worth caching
+	bool	useCache = ( settings.useCache && data.size() > 1024 );
+	QByteArray	cacheKey;
+	if ( useCache )
+		cacheKey = PBRCubeMapCache::key( data, settings, normalizeLevel );
+
+	// the filter itself cannot be interrupted, but stale jobs are abandoned before and between the passes
+	auto	isCancelled = [cancel]() {
+		return ( cancel && cancel->load( std::memory_order_relaxed ) );
+	};
+
+	if ( !filterDisabled && !( useCache && pbrCubeMapCache.find( cacheKey + 's', data ) ) ) {
+		if ( isCancelled() )
+			return false;
+		// a separate filter object per call allows converting multiple cube maps in parallel
+		SFCubeMapCache	sfCubeMapCache;
+		std::uint32_t	width = std::uint32_t( settings.resolution );
 		sfCubeMapCache.setOutputWidth( width );
 		sfCubeMapCache.setRoughnessTable( nullptr, 7 );
 		sfCubeMapCache.setNormalizeLevel( normalizeLevel );
-		sfCubeMapCache.setImportanceSamplingQuality( TexCache::pbrImportanceSamples );
+		sfCubeMapCache.setImportanceSamplingQuality( settings.importanceSamples );
 		size_t	dataSize = size_t( data.size() );
 		size_t	spaceRequired = width * width * 8 * 4 + 148;
 		if ( data.size() < qsizetype(spaceRequired) )
 			data.resize( spaceRequired );
 		size_t	newSize = sfCubeMapCache.convertImage( reinterpret_cast< unsigned char * >(data.data()), dataSize,
-														true, spaceRequired, TexCache::hdrToneMapLevel );
+														true, spaceRequired, settings.toneMapLevel );
 		data.resize( newSize );
+		if ( useCache && newSize >= 148 )
+			pbrCubeMapCache.insert( cacheKey + 's', data );
 	}
 
-	{
-		// generate and load second cube map for diffuse lighting
+	if ( !( useCache && pbrCubeMapCache.find( cacheKey + 'd', diffuseData ) ) ) {
+		if ( isCancelled() )
+			return false;
+		// generate second cube map for diffuse lighting
+		SFCubeMapCache	sfCubeMapCache;
 		std::uint32_t	width = 32;
-		QByteArray	tmpData( data );
-		size_t	dataSize = size_t( tmpData.size() );
+		diffuseData = data;
+		size_t	dataSize = size_t( diffuseData.size() );
 		size_t	spaceRequired = width * width * 8 * 4 + 148;
-		if ( tmpData.size() < qsizetype(spaceRequired) )
-			tmpData.resize( spaceRequired );
+		if ( diffuseData.size() < qsizetype(spaceRequired) )
+			diffuseData.resize( spaceRequired );
 		static const float  roughnessDiffuse = 1.0f;
 		sfCubeMapCache.setOutputWidth( width );
 		sfCubeMapCache.setRoughnessTable( &roughnessDiffuse, 1 );
+		sfCubeMapCache.setNormalizeLevel( normalizeLevel );
 		sfCubeMapCache.setImportanceSamplingQuality( -1 );
-		size_t	newSize = sfCubeMapCache.convertImage( reinterpret_cast< unsigned char * >(tmpData.data()), dataSize,
+		size_t	newSize = sfCubeMapCache.convertImage( reinterpret_cast< unsigned char * >(diffuseData.data()), dataSize,
 														true, spaceRequired );
-		tmpData.resize( newSize );
-		GLuint	tmpMipmaps = 0;
-		(void) texLoadDDS( filepath, target, tmpMipmaps, tmpData, id + 1 );
+		diffuseData.resize( newSize );
+		if ( useCache && newSize >= 148 )
+			pbrCubeMapCache.insert( cacheKey + 'd', diffuseData );
 	}
 
+	return true;
+}
+
+GLuint texLoadPBRCubeMap( const QString & filepath, GLenum & target, GLuint & mipmaps, QByteArray & data, QByteArray & diffuseData, GLuint * id )
+{
+	GLuint	tmpMipmaps = 0;
+	(void) texLoadDDS( filepath, target, tmpMipmaps, diffuseData, id + 1 );
+
 	return texLoadDDS( filepath, target, mipmaps, data, id );
 }
 
+GLuint texLoadPBRCubeMap( const NifModel * nif, const QString & filepath, GLenum & target, GLuint & mipmaps, QByteArray & data, GLuint * id )
+{
+	QByteArray	diffuseData;
+	if ( !texPrefilterPBRCubeMap( nif->getBSVersion(), data, diffuseData, PBRFilterSettings::current() ) )
+		return 0;
+
+	return texLoadPBRCubeMap( filepath, target, mipmaps, data, diffuseData, id );
+}
+
 bool texLoadColor( const NifModel * nif, const QString & filepath, GLenum & target, GLuint & width, GLuint & height, GLuint & mipmaps, QByteArray & data, GLuint * id )
 {
 	// generate 1x1 texture from an RGBA color in "#AABBGGRR" format
@@ -1273,6 +1425,12 @@ static void extract_pbr_lut_data( QByteArray & data )
 }
 
 bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt & format, GLenum & target, GLuint & width, GLuint & height, GLuint & mipmaps, QByteArray & data, GLuint * id )
+{
+	QByteArray	diffuseData;
+	return texLoad( nif, filepath, format, target, width, height, mipmaps, data, diffuseData, id );
+}
+
+bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt & format, GLenum & target, GLuint & width, GLuint & height, GLuint & mipmaps, QByteArray & data, QByteArray & diffuseData, GLuint * id )
 {
 	width = height = mipmaps = 0;
 
@@ -1310,7 +1468,9 @@ bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt &
 				isCubeMap = true;
 			}
 		}
-		if ( isCubeMap && nif && nif->getBSVersion() >= 151 ) {
+		if ( isCubeMap && !diffuseData.isEmpty() ) {
+			mipmaps = texLoadPBRCubeMap( filepath, target, mipmaps, data, diffuseData, id );
+		} else if ( isCubeMap && nif && nif->getBSVersion() >= 151 ) {
 			mipmaps = texLoadPBRCubeMap( nif, filepath, target, mipmaps, data, id );
 		} else {
 			mipmaps = texLoadDDS( filepath, target, mipmaps, data, id );
@@ -1332,6 +1492,7 @@ bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt &
 		f.close();
 	}
 	data.clear();
+	diffuseData.clear();
 
 	if ( mipmaps == 0 )
 		isSupported = false;
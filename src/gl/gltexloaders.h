@@ -45,6 +45,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma warning(pop)
 #endif
 
+#include <atomic>
+
 class QOpenGLContext;
 class QByteArray;
 class QModelIndex;
@@ -81,6 +83,34 @@ extern gli::texture load_if_valid( const char * data, unsigned int size );
  */
 extern bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt & format, GLenum & target, GLuint & width, GLuint & height, GLuint & mipmaps, GLuint * id );
 extern bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt & format, GLenum & target, GLuint & width, GLuint & height, GLuint & mipmaps, QByteArray & data, GLuint * id );
+//! Load a texture from data, with diffuseData set if it is a cube map already filtered by texPrefilterPBRCubeMap()
+extern bool texLoad( const NifModel * nif, const QString & filepath, TexCache::TexFmt & format, GLenum & target, GLuint & width, GLuint & height, GLuint & mipmaps, QByteArray & data, QByteArray & diffuseData, GLuint * id );
+
+//! Settings used for prefiltering PBR cube maps, copied so that filtering can run on another thread
+struct PBRFilterSettings
+{
+	int resolution = 512;
+	int importanceSamples = 256;
+	int toneMapLevel = 8;
+	//! Read and write the disk cache of filtered cube maps
+	bool useCache = true;
+
+	//! Get the current settings from TexCache
+	static PBRFilterSettings current();
+};
+
+/*! Prefilter a Fallout 76 or Starfield environment map for image based lighting
+ *
+ * Does not use OpenGL and may be called from any thread. The results are cached on disk.
+ *
+ * @param bsVersion		The BS version of the NIF that uses the cube map
+ * @param data			The DDS or Radiance HDR file, replaced with the filtered specular cube map
+ * @param diffuseData	The filtered diffuse cube map on success
+ * @param settings		Resolution, sample count and tone mapping
+ * @param cancel		Optional flag to abandon the work if it is no longer needed
+ * @return				True on success, false if the data is not a supported cube map or filtering was cancelled
+ */
+extern bool texPrefilterPBRCubeMap( int bsVersion, QByteArray & data, QByteArray & diffuseData, const PBRFilterSettings & settings, const std::atomic< bool > * cancel = nullptr );
 
 /*! A function for loading textures.
  *
@@ -87,6 +87,10 @@ protected:
 
 	QList<Controller *> controllers;
 
+	//! Scene time and version the controllers were last updated at
+	float controllerTime = 0.0f;
+	quint32 controllerVersion = quint32( -1 );
+
 	void registerController( const NifModel* nif, Controller *ctrl );
 
 	QString name;
@@ -66,6 +66,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QToolBar>
 
 #include <QOpenGLContext>
+#include <QScreen>
+#include <QWindow>
 #include <QOpenGLFunctions>
 #include <QOpenGLFramebufferObject>
 #include <QGLFormat>
@@ -80,12 +82,10 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 
-// NOTE: The FPS define is a frame limiter,
-//	NOT the guaranteed FPS in the viewport.
-//	Also the QTimer is integer milliseconds
-//	so 60 will give you 1000/60 = 16, not 16.666
-//	therefore it's really 62.5FPS
-#define FPS 144
+// NOTE: The view is only redrawn on demand, the timer driving animation
+//	and held keys runs at the refresh rate of the screen, or at FPS
+//	if it is unknown. The QTimer is integer milliseconds.
+#define FPS 60
 
 #define ZOOM_MIN 1.0
 #define ZOOM_MAX 1000.0
@@ -204,9 +204,10 @@ GLView::GLView( const QGLFormat & format, QWidget * p, const QGLWidget * shareWi
 	model = nullptr;
 
 	time = 0.0;
-	lastTime = QTime::currentTime();
+	lastTime.start();
 
 	textures = new TexCache( this );
+	textures->setStreaming( true );
 
 	updateSettings();
 
@@ -214,9 +215,9 @@ GLView::GLView( const QGLFormat & format, QWidget * p, const QGLWidget * shareWi
 	connect( textures, &TexCache::sigRefresh, this, static_cast<void (GLView::*)()>(&GLView::update) );
 	connect( scene, &Scene::sceneUpdated, this, static_cast<void (GLView::*)()>(&GLView::update) );
 
+	// Started by updateTimer() only while something animates
 	timer = new QTimer( this );
-	timer->setInterval( 1000 / FPS );
-	timer->start();
+	timer->setTimerType( Qt::PreciseTimer );
 	connect( timer, &QTimer::timeout, this, &GLView::advanceGears );
 
 	lightVisTimeout = 1500;
@@ -365,9 +366,10 @@ void GLView::updateAnimationState( bool checked )
 			animState &= ~opt;
 
 		scene->animate = (animState & AnimEnabled);
-		lastTime = QTime::currentTime();
+		lastTime.restart();
 
 		update();
+		updateTimer();
 	}
 }
 
@@ -490,10 +492,13 @@ void GLView::paintGL()
 	glDisable(GL_FRAMEBUFFER_SRGB);
 	glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT );
 
+	textures->beginFrame();
+
 
 	// Compile the model
 	if ( doCompile ) {
 		textures->setNifFolder( model->getFolder() );
+		textures->purge( model );
 		scene->make( model );
 		scene->transform( Transform(), scene->timeMin() );
 
@@ -539,6 +544,15 @@ void GLView::paintGL()
 	if ( view != ViewWalk )
 		viewTrans.translation[2] -= Dist * 2;
 
+	// Side planes of the view frustum, matching glProjection()
+	if ( perspectiveMode || (view == ViewWalk) ) {
+		float t = float( tan( ( cfg.fov / Zoom ) / 360 * M_PI ) );
+		scene->frustum = Frustum::perspective( t * float( aspect ), t );
+	} else {
+		float h2 = float( Dist / Zoom );
+		scene->frustum = Frustum::orthographic( h2 * float( aspect ), h2 );
+	}
+
 	scene->transform( viewTrans, time );
 
 	// Setup projection mode
@@ -781,6 +795,11 @@ void GLView::paintGL()
 	// Manually handle the buffer swap
 	swapBuffers();
 
+	frames++;
+
+	// Resumes animation after the window was hidden, and starts it after a model is compiled
+	updateTimer();
+
 #ifdef USE_GL_QPAINTER
 	painter.end();
 #endif
@@ -898,7 +917,7 @@ void GLView::setVisMode( Scene::VisMode mode, bool checked )
 
 typedef void (Scene::* DrawFunc)( void );
 
-int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc> drawFunc, int cycle, const QPointF & pos, int & furn )
+int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc> drawFunc, int cycle, const QPointF & pos, int & furn, float & depth )
 {
 	Q_UNUSED( model ); Q_UNUSED( cycle );
 	// Color Key O(1) selection
@@ -948,18 +967,20 @@ int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc
 	}
 	Node::SELECTING = 0;
 
-	fbo.release();
+	// Read back only the pixel under the cursor
+	QPoint p = pos.toPoint();
+	GLint x = std::clamp< GLint >( p.x(), 0, viewport[2] - 1 );
+	GLint y = std::clamp< GLint >( viewport[3] - 1 - p.y(), 0, viewport[3] - 1 );
+	GLubyte pixel[4] = { 0, 0, 0, 0 };
+	glReadPixels( x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel );
+	depth = 1.0f;
+	glReadPixels( x, y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &depth );
 
-	QImage img( fbo.toImage() );
-	QColor pixel = img.pixelColor( pos.toPoint() );
-
-#ifndef QT_NO_DEBUG
-	img.save( "fbo.png" );
-#endif
+	fbo.release();
 
 	// Encode RGB to Int
-	FloatVector4	rgba( pixel.redF(), pixel.greenF(), pixel.blueF(), pixel.alphaF() );
-	std::int32_t	a = std::int32_t( std::uint32_t( rgba * 255.0f ) );
+	std::int32_t	a = std::int32_t( std::uint32_t( pixel[0] ) | ( std::uint32_t( pixel[1] ) << 8 )
+								| ( std::uint32_t( pixel[2] ) << 16 ) | ( std::uint32_t( pixel[3] ) << 24 ) );
 
 	// Decode:
 	// R = (id & 0x000000FF) >> 0
@@ -979,65 +1000,101 @@ int indexAt( /*GLuint *buffer,*/ NifModel * model, Scene * scene, QList<DrawFunc
 		}
 	}
 
-	//qDebug() << "Key:" << a << " R" << pixel.red() << " G" << pixel.green() << " B" << pixel.blue();
+	//qDebug() << "Key:" << a << " R" << pixel[0] << " G" << pixel[1] << " B" << pixel[2];
 	return choose;
 }
 
+Ray GLView::pickRay( const QPointF & pos )
+{
+	float nx = float( 2.0 * pos.x() / std::max( width(), 1 ) - 1.0 );
+	float ny = float( 1.0 - 2.0 * pos.y() / std::max( height(), 1 ) );
+
+	// Must match glProjection()
+	if ( perspectiveMode || (view == ViewWalk) ) {
+		float t = float( tan( ( cfg.fov / Zoom ) / 360 * M_PI ) );
+		return Ray( Vector3(), Vector3( nx * t * float( aspect ), ny * t, -1.0f ) );
+	}
+
+	// The near plane of an orthographic view can be behind the eye
+	BoundSphere bs = scene->view * scene->bounds();
+	float z = std::max( bs.center[2] + bs.radius, 0.0f );
+	float h2 = float( Dist / Zoom );
+	return Ray( Vector3( nx * h2 * float( aspect ), ny * h2, z ), Vector3( 0.0f, 0.0f, -1.0f ) );
+}
+
 QModelIndex GLView::indexAt( const QPointF & pos, int cycle )
 {
 	if ( !(model && isVisible() && height()) )
 		return QModelIndex();
 
-	makeCurrent();
-	if ( !isValid() )
-		return {};
+	// Shapes are picked on the CPU against the triangles drawn in the last frame
+	Scene::RayHit hit = scene->rayCast( pickRay( pos ) );
 
-	glPushAttrib( GL_ALL_ATTRIB_BITS );
-	glMatrixMode( GL_PROJECTION );
-	glPushMatrix();
-	glMatrixMode( GL_MODELVIEW );
-	glPushMatrix();
+	QList<DrawFunc> df;
 
-	double	p = devicePixelRatioF();
-	int	wp = int( p * width() + 0.5 );
-	int	hp = int( p * height() + 0.5 );
-	QPointF	posScaled( pos );
-	posScaled *= p;
-	glViewport( 0, 0, wp, hp );
-	glProjection( int( posScaled.x() + 0.5 ), int( posScaled.y() + 0.5 ) );
+	if ( scene->isSelModeObject() ) {
+		if ( scene->hasOption(Scene::ShowCollision) )
+			df << &Scene::drawHavok;
 
-	QList<DrawFunc> df;
+		if ( scene->hasOption(Scene::ShowNodes) )
+			df << &Scene::drawNodes;
 
-	if ( scene->hasOption(Scene::ShowCollision) )
-		df << &Scene::drawHavok;
+		if ( scene->hasOption(Scene::ShowMarkers) )
+			df << &Scene::drawFurn;
+	}
 
-	if ( scene->hasOption(Scene::ShowNodes) )
-		df << &Scene::drawNodes;
+	int choose = -1, furn = -1;
 
-	if ( scene->hasOption(Scene::ShowMarkers) )
-		df << &Scene::drawFurn;
+	// Nodes, markers and collision objects still use the color key pass
+	if ( !df.isEmpty() ) {
+		makeCurrent();
+		if ( !isValid() )
+			return {};
 
-	df << &Scene::drawShapes;
+		glPushAttrib( GL_ALL_ATTRIB_BITS );
+		glMatrixMode( GL_PROJECTION );
+		glPushMatrix();
+		glMatrixMode( GL_MODELVIEW );
+		glPushMatrix();
 
-	int choose = -1, furn = -1;
-	choose = ::indexAt( model, scene, df, cycle, posScaled, /*out*/ furn );
+		double	p = devicePixelRatioF();
+		int	wp = int( p * width() + 0.5 );
+		int	hp = int( p * height() + 0.5 );
+		QPointF	posScaled( pos );
+		posScaled *= p;
+		glViewport( 0, 0, wp, hp );
+		glProjection( int( posScaled.x() + 0.5 ), int( posScaled.y() + 0.5 ) );
 
-	glPopAttrib();
-	glMatrixMode( GL_MODELVIEW );
-	glPopMatrix();
-	glMatrixMode( GL_PROJECTION );
-	glPopMatrix();
+		GLfloat proj[16];
+		glGetFloatv( GL_PROJECTION_MATRIX, proj );
+
+		float depth = 1.0f;
+		choose = ::indexAt( model, scene, df, cycle, posScaled, /*out*/ furn, /*out*/ depth );
+
+		glPopAttrib();
+		glMatrixMode( GL_MODELVIEW );
+		glPopMatrix();
+		glMatrixMode( GL_PROJECTION );
+		glPopMatrix();
+
+		// Keep the color key result only if it is in front of the shape hit
+		if ( choose != -1 && hit.shape ) {
+			Vector3 v = pickRay( pos ).at( hit.distance );
+			float z = proj[2] * v[0] + proj[6] * v[1] + proj[10] * v[2] + proj[14];
+			float w = proj[3] * v[0] + proj[7] * v[1] + proj[11] * v[2] + proj[15];
+			if ( w != 0.0f && depth > ( z / w ) * 0.5f + 0.5f ) {
+				choose = -1;
+				furn = -1;
+			}
+		}
+	}
 
 	QModelIndex chooseIndex;
 
 	if ( scene->isSelModeVertex() ) {
 		// Vertex
-		int block = choose >> 16;
-		int vert = choose & 0xFFFF;
-
-		auto shape = scene->shapes.value( block );
-		if ( shape )
-			chooseIndex = shape->vertexAt( vert );
+		if ( hit.shape )
+			chooseIndex = hit.shape->vertexAt( hit.vertex );
 	} else if ( choose != -1 ) {
 		// Block Index
 		chooseIndex = model->getBlockIndex( choose );
@@ -1046,6 +1103,8 @@ QModelIndex GLView::indexAt( const QPointF & pos, int cycle )
 			// Furniture Row @ Block Index
 			chooseIndex = model->index( furn, 0, model->index( 3, 0, chooseIndex ) );
 		}
+	} else if ( hit.shape ) {
+		chooseIndex = model->getBlockIndex( hit.block );
 	}
 
 	return chooseIndex;
@@ -1077,7 +1136,7 @@ void GLView::setCenter()
 
 	if ( node ) {
 		// Center on selected node
-		BoundSphere bs = node->bounds();
+		BoundSphere bs = scene->bounds( node );
 
 		this->setPosition( -bs.center );
 
@@ -1396,20 +1455,63 @@ void GLView::loadUserView()
 	settings.endGroup();
 }
 
+bool GLView::isPaused() const
+{
+	if ( !isVisible() )
+		return true;
+
+	const QWidget * w = window();
+	if ( w->isMinimized() )
+		return true;
+
+	const QWindow * wh = w->windowHandle();
+	return ( wh && !wh->isExposed() );
+}
+
+bool GLView::isAnimating() const
+{
+	return ( animState & AnimEnabled ) && ( animState & AnimPlay ) && scene->timeMin() != scene->timeMax();
+}
+
+void GLView::updateTimer()
+{
+	bool animating = isAnimating();
+
+	bool moving = !( mouseMov == Vector3() && mouseRot == Vector3() );
+	for ( bool pressed : kbd )
+		moving = moving || pressed;
+
+	if ( ( animating || moving ) && !isPaused() ) {
+		if ( !timer->isActive() ) {
+			// Pace the timer to the display
+			const QWindow * wh = window()->windowHandle();
+			const QScreen * screen = ( wh ? wh->screen() : QGuiApplication::primaryScreen() );
+			qreal rate = ( screen ? screen->refreshRate() : 0.0 );
+			if ( !( rate >= 1.0 ) )
+				rate = FPS;
+			timer->setInterval( std::max( int( 1000.0 / rate ), 1 ) );
+
+			// Do not count the time spent idle
+			lastTime.restart();
+			timer->start();
+		}
+	} else if ( timer->isActive() ) {
+		timer->stop();
+	}
+}
+
 void GLView::advanceGears()
 {
-	QTime t  = QTime::currentTime();
-	float dT = lastTime.msecsTo( t ) / 1000.0;
+	float dT = float( lastTime.restart() ) / 1000.0f;
 	dT = (dT < 0) ? 0 : ((dT > 1.0) ? 1.0 : dT);
 
-	lastTime = t;
-
-	if ( !isVisible() )
+	if ( isPaused() ) {
+		// paintGL() restarts the timer when the window is exposed again
+		timer->stop();
 		return;
+	}
 
-	if ( ( animState & AnimEnabled ) && ( animState & AnimPlay )
-		&& scene->timeMin() != scene->timeMax() )
-	{
+	if ( isAnimating() ) {
 		time += dT;
 
 		if ( time > scene->timeMax() ) {
@@ -1477,6 +1579,8 @@ void GLView::advanceGears()
 
 	// update display without movement
 	if ( kbd[ Qt::Key_M ] ) update();
+
+	updateTimer();
 }
 
 
@@ -1850,6 +1954,7 @@ void GLView::dropEvent( QDropEvent * e )
 void GLView::focusOutEvent( QFocusEvent * )
 {
 	kbd.clear();
+	updateTimer();
 }
 
 void GLView::keyPressEvent( QKeyEvent * event )
@@ -1872,6 +1977,7 @@ void GLView::keyPressEvent( QKeyEvent * event )
 	case Qt::Key_M:
 	case Qt::Key_Space:
 		kbd[event->key()] = true;
+		updateTimer();
 		break;
 	case Qt::Key_Escape:
 		doCompile = true;
@@ -1939,6 +2045,7 @@ void GLView::mouseMoveEvent( QMouseEvent * event )
 	}
 
 	lastPos = event->pos();
+	updateTimer();
 }
 
 void GLView::mousePressEvent( QMouseEvent * event )
@@ -2015,10 +2122,10 @@ void GLView::mouseReleaseEvent( QMouseEvent * event )
 
 void GLView::wheelEvent( QWheelEvent * event )
 {
-	if ( view == ViewWalk )
+	if ( view == ViewWalk ) {
 		mouseMov += Vector3( 0, 0, double( event->angleDelta().y() ) / 4.0 ) * scale();
-	else
-	{
+		updateTimer();
+	} else {
 		if (event->angleDelta().y() < 0)
 			setDistance( Dist / ZOOM_MOUSE_WHEEL_MULT );
 		else
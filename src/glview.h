@@ -39,6 +39,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QGLWidget> // Inherited
 #include <QGraphicsView>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QPersistentModelIndex>
 
 #include <math.h>
@@ -157,6 +158,13 @@ public:
 
 	QModelIndex indexAt( const QPointF & p, int cycle = 0 );
 
+	//! Returns the number of frames drawn so far, for checking that an idle view does not redraw
+	quint64 frameCount() const { return frames; }
+	//! True if an animation is playing, the view then redraws continuously unless it is paused
+	bool isAnimating() const;
+	//! Returns the view space ray through a point of the widget, as of the last frame
+	Ray pickRay( const QPointF & p );
+
 	// UI
 
 	QSize minimumSizeHint() const override final { return { 50, 50 }; }
@@ -245,9 +253,17 @@ private:
 	class TexCache * textures;
 
 	float time;
-	QTime lastTime;
+	QElapsedTimer lastTime;
 	QTimer * timer;
 
+	//! Number of frames drawn, the view is only redrawn on demand
+	quint64 frames = 0;
+
+	//! True if the view is hidden, minimized or occluded
+	bool isPaused() const;
+	//! Starts the timer while animating or moving, stops it otherwise
+	void updateTimer();
+
 	float Dist;
 	Vector3 Pos;
 	Vector3 Rot;
@@ -1,12 +1,17 @@
 #include "io/MeshFile.h"
+#include "gamemanager.h"
 #include "model/nifmodel.h"
 #include "qtcompat.h"
 
 #include <QByteArray>
-#include <QDataStream>
-#include <QBuffer>
+#include <QCache>
+#include <QHash>
+#include <QtEndian>
 #include "fp32vec4.hpp"
 
+#include <cstring>
+#include <mutex>
+
 #if 0
 // x/32767 matches the min/max bounds in BSGeometry more accurately on average
 double snormToDouble(int16_t x) { return x < 0 ? x / double(32768) : x / double(32767); }
@@ -47,166 +52,266 @@ void MeshFile::clear()
 	haveData = false;
 }
 
+namespace
+{
+//! Bounds checked little endian reader over a .mesh file buffer
+class MeshFileSpan
+{
+public:
+	MeshFileSpan( const void * data, size_t size )
+		: ptr( reinterpret_cast< const unsigned char * >( data ) ),
+		endp( reinterpret_cast< const unsigned char * >( data ) + size )
+	{
+	}
+
+	inline size_t remaining() const
+	{
+		return size_t( endp - ptr );
+	}
+
+	inline bool readUInt32( quint32 & n )
+	{
+		if ( remaining() < 4 )
+			return false;
+		n = qFromLittleEndian< quint32 >( ptr );
+		ptr += 4;
+		return true;
+	}
+
+	inline bool readFloat( float & f )
+	{
+		quint32	n;
+		if ( !readUInt32( n ) )
+			return false;
+		std::memcpy( &f, &n, sizeof( float ) );
+		return true;
+	}
+
+	//! Returns a pointer to the next 'count' elements of 'elementSize' bytes, or nullptr past the end of the buffer
+	inline const unsigned char * take( size_t count, size_t elementSize )
+	{
+		if ( count > remaining() / elementSize )
+			return nullptr;
+		const unsigned char *	p = ptr;
+		ptr += count * elementSize;
+		return p;
+	}
+
+private:
+	const unsigned char *	ptr;
+	const unsigned char *	endp;
+};
+
+static_assert( sizeof( Triangle ) == 6 );
+
+//! Reads a section of 'indicesSize' triangle indices with a single copy
+bool readTriangles( MeshFileSpan & in, quint32 indicesSize, QVector<Triangle> & triangles )
+{
+	const unsigned char *	p = in.take( indicesSize, 2 );
+	if ( !p )
+		return false;
+	triangles.resize( qsizetype( indicesSize / 3 ) );
+	if ( triangles.isEmpty() )
+		return true;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+	std::memcpy( triangles.data(), p, size_t( triangles.size() ) * sizeof( Triangle ) );
+#else
+	for ( auto & t : triangles ) {
+		t.set( qFromLittleEndian< quint16 >( p ), qFromLittleEndian< quint16 >( p + 2 ), qFromLittleEndian< quint16 >( p + 4 ) );
+		p += 6;
+	}
+#endif
+	return true;
+}
+
+inline std::uint64_t readUInt64( const unsigned char * p )
+{
+	return qFromLittleEndian< quint64 >( p );
+}
+
+inline std::uint64_t readUInt48( const unsigned char * p )
+{
+	return std::uint64_t( qFromLittleEndian< quint32 >( p ) ) | ( std::uint64_t( qFromLittleEndian< quint16 >( p + 4 ) ) << 32 );
+}
+}	// namespace
+
 void MeshFile::update( const void * data, size_t size )
 {
 	clear();
 	if ( !( data && size > 0 ) )
 		return;
 
-	QBuffer	f;
-	f.setData( reinterpret_cast< const char * >( data ), qsizetype( size ) );
-	if ( !f.open(QIODevice::ReadOnly) )
-		return;
-
-	QDataStream	in;
-	in.setDevice(&f);
-	in.setByteOrder(QDataStream::LittleEndian);
-	in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+	// The buffer is parsed in place: each section is bounds checked once, and the vertex data is
+	// converted in batches with FloatVector4 instead of reading every element through a QDataStream
+	MeshFileSpan	in( data, size );
 
 	quint32 magic;
-	in >> magic;
-	if ( magic > 2U )
+	if ( !in.readUInt32( magic ) || magic > 2U )
 		return;
 
 	quint32 indicesSize;
-	in >> indicesSize;
-	triangles.resize( indicesSize / 3 );
+	if ( !( in.readUInt32( indicesSize ) && readTriangles( in, indicesSize, triangles ) ) )
+		return;
 	haveData = true;
 
-	for ( quint32 i = 0; i < indicesSize / 3; i++ ) {
-		Triangle tri;
-		in >> tri;
-		triangles[i] = tri;
-	}
-
 	float scale;
-	in >> scale;
-	if ( scale <= 0.0f ) {
+	if ( !in.readFloat( scale ) || !( scale > 0.0f ) ) {
 		clear();
 		return; // From RE
 	}
 
 	quint32 numWeightsPerVertex;
-	in >> numWeightsPerVertex;
-	weightsPerVertex = numWeightsPerVertex;
-
 	quint32 numPositions;
-	in >> numPositions;
-	if ( !numPositions ) {
+	if ( !( in.readUInt32( numWeightsPerVertex ) && in.readUInt32( numPositions ) ) || !numPositions ) {
 		clear();
 		return;
 	}
-	positions.resize( numPositions );
-
-	for ( int i = 0; i < int(numPositions); i++ ) {
-		uint32_t	xy;
-		uint16_t	z;
+	weightsPerVertex = quint8( std::min< quint32 >( numWeightsPerVertex, 255 ) );
 
-		in >> xy;
-		in >> z;
-		FloatVector4	xyz(FloatVector4::convertInt16((std::uint64_t(z) << 32) | xy));
-		xyz /= 32767.0f;
-		xyz *= scale;
-
-		positions[i] = Vector3(xyz[0], xyz[1], xyz[2]);
+	const unsigned char *	p = in.take( numPositions, 6 );
+	if ( !p ) {
+		clear();
+		return;
+	}
+	positions.resize( qsizetype( numPositions ) );
+	{
+		Vector3 *	dst = positions.data();
+		FloatVector4	posScale( scale / 32767.0f );
+		qsizetype	n = positions.size();
+		qsizetype	i = 0;
+		// 8 byte loads are safe for all but the last position
+		for ( ; ( i + 1 ) < n; i++, p += 6 )
+			dst[i].fromFloatVector4( FloatVector4::convertInt16( readUInt64( p ) & 0x0000FFFFFFFFFFFFULL ) * posScale );
+		for ( ; i < n; i++, p += 6 )
+			dst[i] = Vector3( FloatVector4::convertInt16( readUInt48( p ) ) * posScale );
 	}
 
 	quint32 numCoord1;
-	in >> numCoord1;
-	coords.resize( numCoord1 );
-
-	for ( int i = 0; i < int(numCoord1); i++ ) {
-		uint32_t uv;
-
-		in >> uv;
-
-		coords[i] = Vector4(FloatVector4::convertFloat16(uv));
+	if ( !( in.readUInt32( numCoord1 ) && ( p = in.take( numCoord1, 4 ) ) != nullptr ) ) {
+		clear();
+		return;
+	}
+	coords.resize( qsizetype( numCoord1 ) );
+	{
+		Vector4 *	dst = coords.data();
+		qsizetype	n = coords.size();
+		qsizetype	i = 0;
+		// two UVs per conversion
+		for ( ; ( i + 2 ) <= n; i += 2, p += 8 ) {
+			FloatVector4	uv( FloatVector4::convertFloat16( readUInt64( p ) ) );
+			dst[i] = Vector4( uv[0], uv[1], 0.0f, 0.0f );
+			dst[i + 1] = Vector4( uv[2], uv[3], 0.0f, 0.0f );
+		}
+		if ( i < n )
+			dst[i] = Vector4( FloatVector4::convertFloat16( qFromLittleEndian< quint32 >( p ) ) );
 	}
 
 	quint32 numCoord2;
-	in >> numCoord2;
+	if ( !( in.readUInt32( numCoord2 ) && ( p = in.take( numCoord2, 4 ) ) != nullptr ) ) {
+		clear();
+		return;
+	}
 	numCoord2 = std::min( numCoord2, numCoord1 );
 	haveTexCoord2 = bool( numCoord2 );
-
-	for ( quint32 i = 0; i < numCoord2; i++ ) {
-		uint32_t uv;
-
-		in >> uv;
-		FloatVector4  uv_f(FloatVector4::convertFloat16(uv));
-
-		coords[i][2] = uv_f[0];
-		coords[i][3] = uv_f[1];
+	{
+		Vector4 *	dst = coords.data();
+		qsizetype	n = qsizetype( numCoord2 );
+		qsizetype	i = 0;
+		for ( ; ( i + 2 ) <= n; i += 2, p += 8 ) {
+			FloatVector4	uv( FloatVector4::convertFloat16( readUInt64( p ) ) );
+			dst[i][2] = uv[0];
+			dst[i][3] = uv[1];
+			dst[i + 1][2] = uv[2];
+			dst[i + 1][3] = uv[3];
+		}
+		if ( i < n ) {
+			FloatVector4	uv( FloatVector4::convertFloat16( qFromLittleEndian< quint32 >( p ) ) );
+			dst[i][2] = uv[0];
+			dst[i][3] = uv[1];
+		}
 	}
 
 	quint32 numColor;
-	in >> numColor;
-	if ( numColor > 0 ) {
-		colors.resize( numColor );
+	if ( !( in.readUInt32( numColor ) && ( p = in.take( numColor, 4 ) ) != nullptr ) ) {
+		clear();
+		return;
 	}
-	for ( quint32 i = 0; i < numColor; i++ ) {
-		uint32_t	bgra;
-		in >> bgra;
-		colors[i] = Color4( ( FloatVector4(bgra) / 255.0f ).shuffleValues( 0xC6 ) );	// 2, 1, 0, 3
+	if ( numColor > 0 ) {
+		colors.resize( qsizetype( numColor ) );
+		Color4 *	dst = colors.data();
+		for ( quint32 i = 0; i < numColor; i++, p += 4 ) {
+			std::uint32_t	bgra = qFromLittleEndian< quint32 >( p );
+			dst[i] = Color4( ( FloatVector4( bgra ) / 255.0f ).shuffleValues( 0xC6 ) );	// 2, 1, 0, 3
+		}
 	}
 
 	quint32 numNormal;
-	in >> numNormal;
-	if ( numNormal > 0 ) {
-		normals.resize( numNormal );
+	if ( !( in.readUInt32( numNormal ) && ( p = in.take( numNormal, 4 ) ) != nullptr ) ) {
+		clear();
+		return;
 	}
-	for ( int i = 0; i < int(numNormal); i++ ) {
-		std::uint32_t	n;
-		in >> n;
-		normals[i] = Vector3( UDecVector4(n) );
+	if ( numNormal > 0 ) {
+		normals.resize( qsizetype( numNormal ) );
+		Vector3 *	dst = normals.data();
+		quint32	i = 0;
+		for ( ; ( i + 1 ) < numNormal; i++, p += 4 )
+			dst[i].fromFloatVector4( FloatVector4::convertX10Y10Z10W2( qFromLittleEndian< quint32 >( p ) ) );
+		dst[i] = Vector3( FloatVector4::convertX10Y10Z10W2( qFromLittleEndian< quint32 >( p ) ) );
 	}
 
 	quint32 numTangent;
-	in >> numTangent;
-	if ( numTangent > 0 ) {
-		tangents.resize( numTangent );
-		bitangentsBasis.resize( numTangent );
+	if ( !( in.readUInt32( numTangent ) && ( p = in.take( numTangent, 4 ) ) != nullptr ) ) {
+		clear();
+		return;
 	}
-	for ( int i = 0; i < int(numTangent); i++ ) {
-		std::uint32_t	n;
-		in >> n;
-		UDecVector4	v( n );
-		tangents[i] = Vector3( v );
-		bitangentsBasis[i] = v[3];
+	if ( numTangent > 0 ) {
+		tangents.resize( qsizetype( numTangent ) );
+		bitangentsBasis.resize( qsizetype( numTangent ) );
+		Vector3 *	dstT = tangents.data();
+		float *	dstB = bitangentsBasis.data();
+		for ( quint32 i = 0; i < numTangent; i++, p += 4 ) {
+			FloatVector4	v( FloatVector4::convertX10Y10Z10W2( qFromLittleEndian< quint32 >( p ) ) );
+			dstT[i] = Vector3( v );
+			dstB[i] = v[3];
+		}
 	}
 
 	quint32 numWeights;
-	in >> numWeights;
-	if ( numWeights > 0 && numWeightsPerVertex > 0 ) {
-		weights.resize(numWeights / numWeightsPerVertex);
+	if ( !( in.readUInt32( numWeights ) && ( p = in.take( numWeights, 4 ) ) != nullptr ) ) {
+		clear();
+		return;
 	}
-	for ( int i = 0; i < weights.count(); i++ ) {
-		QVector<QPair<quint16, quint16>> weightsUNORM;
-		for ( quint32 j = 0; j < 8; j++ ) {
-			if ( j < numWeightsPerVertex ) {
-				quint16 b, w;
-				in >> b;
-				in >> w;
-				weightsUNORM.append({ b, w });
-			} else {
-				weightsUNORM.append({0, 0});
+	if ( numWeights > 0 && numWeightsPerVertex > 0 ) {
+		weights.resize( qsizetype( numWeights / numWeightsPerVertex ) );
+		quint32	n = std::min< quint32 >( numWeightsPerVertex, 8 );
+		for ( auto & w : weights ) {
+			w.weightsUNORM.resize( 8 );
+			for ( quint32 j = 0; j < n; j++ ) {
+				w.weightsUNORM[j] = BoneWeightUNORM16( qFromLittleEndian< quint16 >( p + j * 4 ),
+														qFromLittleEndian< quint16 >( p + j * 4 + 2 ) / 65535.0f );
 			}
+			p += numWeightsPerVertex * 4;
 		}
-		weights[i] = BoneWeightsUNorm(weightsUNORM, i);
 	}
 
 	if ( magic ) {
-		quint32 numLODs;
-		in >> numLODs;
-		lods.resize(numLODs);
-		for ( quint32 i = 0; i < numLODs; i++ ) {
+		quint32 numLODs = 0;
+		// a missing LOD count at the end of the file is treated as no LODs
+		if ( in.remaining() > 0 && !in.readUInt32( numLODs ) ) {
+			clear();
+			return;
+		}
+		// each LOD needs at least 4 bytes for its index count
+		if ( numLODs > in.remaining() / 4 ) {
+			clear();
+			return;
+		}
+		lods.resize( qsizetype( numLODs ) );
+		for ( auto & lod : lods ) {
 			quint32 indicesSize2;
-			in >> indicesSize2;
-			lods[i].resize(indicesSize2 / 3);
-
-			for ( quint32 j = 0; j < indicesSize2 / 3; j++ ) {
-				Triangle tri;
-				in >> tri;
-				lods[i][j] = tri;
+			if ( !( in.readUInt32( indicesSize2 ) && readTriangles( in, indicesSize2, lod ) ) ) {
+				clear();
+				return;
 			}
 		}
 	}
@@ -379,6 +484,91 @@ void MeshFile::update( const NifModel * nif, const QModelIndex & index )
 	}
 }
 
+namespace
+{
+struct MeshFileCacheEntry
+{
+	std::weak_ptr< MeshFile >	mesh;
+	std::uint32_t	generation = 0;
+};
+
+std::mutex	meshFileCacheMutex;
+// meshes currently in use, shared by all BSMesh objects and LODs that reference the same file
+QHash< QString, MeshFileCacheEntry >	meshFileCache;
+// strong references to recently used meshes, the cost is the size in kilobytes
+QCache< QString, std::shared_ptr< MeshFile > >	meshFileRecent( 128 << 10 );
+}	// namespace
+
+std::shared_ptr<MeshFile> MeshFile::get( const NifModel * nif, const QModelIndex & index )
+{
+	QString	meshPath;
+	if ( nif && index.isValid() ) {
+		auto	meshPathIndex = nif->getIndex( index, "Mesh Path" );
+		if ( meshPathIndex.isValid() )
+			meshPath = nif->get<QString>( meshPathIndex );
+	}
+	// internal geometry data is not cached
+	if ( meshPath.isEmpty() )
+		return std::make_shared<MeshFile>( nif, index );
+
+	std::string	fullPath( Game::GameManager::get_full_path( meshPath, "geometries/", ".mesh" ) );
+	const Game::GameManager::GameResources &	resources = Game::GameManager::getNIFResources( nif );
+	QString	key = QString::number( int( resources.game ) ) + QChar( '\n' ) + resources.dataPaths.join( QChar( '\n' ) )
+					+ QChar( '\n' ) + QString::fromStdString( fullPath );
+
+	std::uint32_t	generation = Game::GameManager::resource_generation();
+	{
+		std::lock_guard< std::mutex >	lock( meshFileCacheMutex );
+		auto	i = meshFileCache.find( key );
+		if ( i != meshFileCache.end() ) {
+			std::shared_ptr<MeshFile>	mesh;
+			if ( i->generation == generation )
+				mesh = i->mesh.lock();
+			if ( mesh ) {
+				(void) meshFileRecent.object( key );	// mark as recently used
+				return mesh;
+			}
+			meshFileCache.erase( i );
+			meshFileRecent.remove( key );
+		}
+	}
+
+	auto	mesh = std::make_shared<MeshFile>( nif, meshPath );
+	// do not cache failed loads and loose files that may be edited, or if the archives were reopened meanwhile
+	if ( !mesh->isValid() || Game::GameManager::resource_generation() != generation
+		|| !Game::GameManager::loose_file_path( nif, fullPath ).isEmpty() ) {
+		return mesh;
+	}
+
+	std::lock_guard< std::mutex >	lock( meshFileCacheMutex );
+	if ( meshFileCache.size() >= 1024 ) {
+		for ( auto i = meshFileCache.begin(); i != meshFileCache.end(); ) {
+			if ( i->mesh.expired() )
+				i = meshFileCache.erase( i );
+			else
+				i++;
+		}
+	}
+	meshFileCache.insert( key, { mesh, generation } );
+	int	cost = int( ( mesh->dataSize() + 1023 ) >> 10 );
+	if ( cost <= meshFileRecent.maxCost() / 4 )
+		meshFileRecent.insert( key, new std::shared_ptr<MeshFile>( mesh ), cost );
+	return mesh;
+}
+
+qint64 MeshFile::dataSize() const
+{
+	qint64	n = qint64( positions.size() + normals.size() + tangents.size() ) * qint64( sizeof( Vector3 ) );
+	n += qint64( colors.size() ) * qint64( sizeof( Color4 ) );
+	n += qint64( bitangentsBasis.size() ) * qint64( sizeof( float ) );
+	n += qint64( coords.size() ) * qint64( sizeof( Vector4 ) );
+	n += qint64( weights.size() ) * qint64( sizeof( BoneWeightsUNorm ) + 8 * sizeof( BoneWeightUNORM16 ) );
+	n += qint64( triangles.size() ) * qint64( sizeof( Triangle ) );
+	for ( const auto & l : lods )
+		n += qint64( l.size() ) * qint64( sizeof( Triangle ) );
+	return n;
+}
+
 void MeshFile::calculateBitangents( QVector<Vector3> & bitangents ) const
 {
 	bitangents.clear();
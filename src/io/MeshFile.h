@@ -6,6 +6,8 @@
 
 #include <QVector>
 
+#include <memory>
+
 class NifModel;
 
 
@@ -23,6 +25,17 @@ public:
 	void update( const NifModel * nif, const QString & path );
 	void update( const NifModel * nif, const QModelIndex & index );
 
+	//! Return a MeshFile for a BSMesh structure index, sharing the decoded data of .mesh files
+	/*!
+	 * Meshes loaded from .mesh files are cached by resource path and game data paths, so that
+	 * geometries and LODs referencing the same file use a single object. Recently released meshes
+	 * are kept for reuse after the scene is rebuilt, and the cache is invalidated when the archives
+	 * are reopened. The returned object must not be modified.
+	 */
+	static std::shared_ptr<MeshFile> get( const NifModel * nif, const QModelIndex & index );
+	//! Approximate memory used by the decoded data in bytes
+	qint64 dataSize() const;
+
 	void calculateBitangents( QVector<Vector3> & bitangents ) const;
 
 	//! Vertices
@@ -0,0 +1,484 @@
+#include "io/nifindex.h"
+#include "gamemanager.h"
+#include "model/nifmodel.h"
+#include "spells/fileextract.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QtEndian>
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+static constexpr quint32 indexMagic = 0x5849534E;	// "NSIX"
+static constexpr quint32 indexVersion = 2;
+
+static const QString gamePrefix = QStringLiteral( "game:" );
+
+//! Return the absolute path of a root folder
+static QString normalizeRoot( const QString & root )
+{
+	if ( root.startsWith( gamePrefix ) )
+		return root;
+	return QDir::cleanPath( QFileInfo( root ).absoluteFilePath() );
+}
+
+//! Normalize a resource path for comparison with the indexed paths
+static QString normalizeResourcePath( const QString & path )
+{
+	return QString( path ).replace( QChar('\\'), QChar('/') ).toLower();
+}
+
+QString NifIndex::Stats::toString() const
+{
+	double	seconds = double( std::max< qint64 >( msecs, 1 ) ) / 1000.0;
+	return QString( "%1 files, %2 MB in %3 s (%4 files/s)\n%5 indexed, %6 unchanged, %7 failed, %8 removed, %9 terms" )
+			.arg( files ).arg( double( bytes ) / 1048576.0, 0, 'f', 1 ).arg( seconds, 0, 'f', 2 )
+			.arg( double( indexed ) / seconds, 0, 'f', 1 )
+			.arg( indexed ).arg( unchanged ).arg( failed ).arg( removed ).arg( terms );
+}
+
+QString NifIndex::defaultFileName( const QString & root )
+{
+	QString	r = normalizeRoot( root );
+#ifdef Q_OS_WIN
+	r = r.toLower();
+#endif
+	QByteArray	h = QCryptographicHash::hash( r.toUtf8(), QCryptographicHash::Md5 ).toHex().left( 16 );
+	return QStandardPaths::writableLocation( QStandardPaths::CacheLocation ) + "/index/" + QString::fromLatin1( h ) + ".idx";
+}
+
+bool NifIndex::load( const QString & fileName )
+{
+	QFile	f( fileName );
+	if ( !f.open( QIODevice::ReadOnly ) )
+		return false;
+
+	QDataStream	in( &f );
+	in.setVersion( QDataStream::Qt_5_15 );
+	quint32	magic = 0;
+	quint32	version = 0;
+	in >> magic >> version;
+	if ( magic != indexMagic || version != indexVersion )
+		return false;
+
+	NifIndex	idx;
+	quint32	n = 0;
+	in >> idx.root >> idx.fields >> idx.headerOnly >> n;
+	for ( quint32 i = 0; i < n && in.status() == QDataStream::Ok; i++ ) {
+		FileEntry	e;
+		in >> e.path >> e.size >> e.stamp >> e.version >> e.userVersion >> e.bsVersion >> e.failed;
+		idx.files.append( e );
+	}
+	in >> n;
+	for ( quint32 i = 0; i < n && in.status() == QDataStream::Ok; i++ ) {
+		QString	t;
+		QVector<quint32>	p;
+		in >> t >> p;
+		idx.terms.append( t );
+		idx.postings.append( p );
+	}
+	if ( in.status() != QDataStream::Ok )
+		return false;
+	for ( const auto & p : idx.postings ) {
+		for ( quint32 i : p ) {
+			if ( i >= quint32( idx.files.size() ) )
+				return false;
+		}
+	}
+
+	*this = std::move( idx );
+	return true;
+}
+
+bool NifIndex::save( const QString & fileName ) const
+{
+	QDir().mkpath( QFileInfo( fileName ).absolutePath() );
+	QSaveFile	f( fileName );
+	if ( !f.open( QIODevice::WriteOnly ) )
+		return false;
+
+	QDataStream	out( &f );
+	out.setVersion( QDataStream::Qt_5_15 );
+	out << indexMagic << indexVersion;
+	out << root << fields << headerOnly << quint32( files.size() );
+	for ( const FileEntry & e : files )
+		out << e.path << e.size << e.stamp << e.version << e.userVersion << e.bsVersion << e.failed;
+	out << quint32( terms.size() );
+	for ( int i = 0; i < terms.size(); i++ )
+		out << terms.at( i ) << postings.at( i );
+
+	return out.status() == QDataStream::Ok && f.commit();
+}
+
+namespace
+{
+struct IndexJob
+{
+	NifIndex::FileEntry	entry;
+	//! Stamp of an archived file from the saved archive index, see GameManager::file_stamps()
+	Game::GameManager::FileStamp	source;
+	QStringList	terms;
+	//! Number of the entry of the file in the previous index, or -1
+	int	oldFile = -1;
+	bool	unchanged = false;
+};
+}
+
+//! Add the terms of a loaded model to 'terms'
+static void getModelTerms( QSet<QString> & terms, NifModel & nif, const QStringList & fields )
+{
+	for ( int b = 0; b < nif.getBlockCount(); b++ ) {
+		QModelIndex	iBlock = nif.getBlockIndex( b );
+		QString	type = nif.itemName( iBlock );
+		terms.insert( "block:" + type );
+
+		for ( const QString & field : fields ) {
+			int	i = field.indexOf( QChar('/') );
+			if ( !nif.inherits( type, field.left( i ) ) )
+				continue;
+			QModelIndex	iValue = nif.getIndex( iBlock, field.mid( i + 1 ) );
+			if ( !iValue.isValid() )
+				continue;
+			// integers are stored as decimal numbers for bit mask queries
+			NifValue	value = nif.getValue( iValue );
+			QString	s;
+			if ( value.isCount() && !value.isFloat() )
+				s = QString::number( qint64( value.toCount( nullptr, nullptr ) ) );
+			else if ( value.type() == NifValue::tStringIndex )
+				s = nif.resolveString( iValue );
+			else
+				s = value.toString();
+			terms.insert( "value:" + field + "=" + s );
+		}
+	}
+
+	std::set< std::string >	paths;
+	ResourceExtractor::findResourcePaths( paths, &nif );
+	for ( const auto & p : paths )
+		terms.insert( "resource:" + QString::fromStdString( p ) );
+}
+
+//! Load a file and find its terms, or copy them from the previous index if it has not changed
+static void indexFile( IndexJob & job, const NifIndex & old, const QString & root, const QStringList & fields, bool headerOnly )
+{
+	NifIndex::FileEntry &	e = job.entry;
+	bool	archived = root.startsWith( gamePrefix );
+	QString	filePath;
+	QByteArray	data;
+
+	auto	extract = [&]() {
+		auto	game = Game::ModeForString( root.mid( gamePrefix.size() ) );
+		return Game::GameManager::get_file( data, game, e.path.toStdString(), Game::GameManager::FileCacheBypass );
+	};
+	if ( archived && job.source.stamp ) {
+		e.size = job.source.size;
+		e.stamp = qint64( job.source.stamp );
+	} else if ( archived ) {
+		// the source of the file is not known, compare a hash of the contents instead
+		if ( !extract() ) {
+			e.failed = true;
+			return;
+		}
+		e.size = data.size();
+		// qHash() is seeded and may use CPU specific instructions, the index must be valid on any machine
+		QByteArray	h( QCryptographicHash::hash( data, QCryptographicHash::Md5 ) );
+		e.stamp = qFromLittleEndian< qint64 >( h.constData() );
+	} else {
+		filePath = QDir( root ).filePath( e.path );
+		QFileInfo	fi( filePath );
+		e.size = fi.size();
+		e.stamp = fi.lastModified().toMSecsSinceEpoch();
+	}
+
+	if ( job.oldFile >= 0 ) {
+		const NifIndex::FileEntry &	o = old.file( quint32( job.oldFile ) );
+		if ( o.size == e.size && o.stamp == e.stamp && !o.failed ) {
+			e = o;
+			job.unchanged = true;
+			return;
+		}
+	}
+
+	NifModel	nif;
+	nif.setMessageMode( BaseModel::MSG_TEST );
+	QSet<QString>	terms;
+	bool	loaded = false;
+	if ( headerOnly && !archived && nif.loadHeaderOnly( filePath ) && nif.getVersionNumber() >= 0x0A000100 ) {
+		for ( const QString & type : nif.getArray<QString>( nif.getHeaderItem(), "Block Types" ) )
+			terms.insert( "block:" + type );
+		loaded = true;
+	} else if ( archived ) {
+		if ( data.isEmpty() && !extract() ) {
+			e.failed = true;
+			return;
+		}
+		QBuffer	buf( &data );
+		std::string	fileName = e.path.toStdString();
+		loaded = buf.open( QIODevice::ReadOnly ) && nif.load( buf, fileName.c_str() );
+	} else {
+		loaded = nif.loadFromFile( filePath );
+	}
+	if ( !loaded ) {
+		e.failed = true;
+		return;
+	}
+	if ( terms.isEmpty() )
+		getModelTerms( terms, nif, fields );
+
+	e.version = nif.getVersionNumber();
+	e.userVersion = nif.getUserVersion();
+	e.bsVersion = nif.getBSVersion();
+	job.terms = terms.values();
+}
+
+NifIndex::Stats NifIndex::update( const QString & rootPath, const QStringList & indexFields, bool indexHeaderOnly,
+									int threads, const std::function< void ( int, int ) > & progress )
+{
+	QElapsedTimer	timer;
+	timer.start();
+
+	QString	newRoot = normalizeRoot( rootPath );
+	if ( newRoot != root || indexFields != fields || indexHeaderOnly != headerOnly )
+		*this = NifIndex();
+
+	// terms of the files in the previous index
+	QVector<QVector<int>>	oldTerms( files.size() );
+	for ( int t = 0; t < postings.size(); t++ ) {
+		for ( quint32 i : postings.at( t ) )
+			oldTerms[int(i)].append( t );
+	}
+	QHash<QString, int>	oldFiles;
+	for ( int i = 0; i < files.size(); i++ )
+		oldFiles.insert( files.at( i ).path, i );
+
+	QStringList	paths;
+	if ( newRoot.startsWith( gamePrefix ) ) {
+		std::set< std::string_view >	fileSet;
+		Game::GameManager::list_files(
+			fileSet, Game::ModeForString( newRoot.mid( gamePrefix.size() ) ),
+			[]( void *, const std::string_view & fileName ) { return fileName.ends_with( ".nif" ); } );
+		for ( const auto & f : fileSet )
+			paths.append( QString::fromUtf8( f.data(), qsizetype( f.size() ) ) );
+	} else {
+		QDir	dir( newRoot );
+		QDirIterator	it( newRoot, { "*.nif", "*.nifcache", "*.texcache", "*.pcpatch", "*.bto", "*.btr" },
+							QDir::Files, QDirIterator::Subdirectories );
+		while ( it.hasNext() )
+			paths.append( dir.relativeFilePath( it.next() ) );
+		paths.sort();
+	}
+
+	std::vector<IndexJob>	jobs( size_t( paths.size() ) );
+	for ( int i = 0; i < paths.size(); i++ ) {
+		jobs[size_t(i)].entry.path = paths.at( i );
+		jobs[size_t(i)].oldFile = oldFiles.value( paths.at( i ), -1 );
+	}
+	// archived files are only extracted if the archive or the file in it has changed
+	if ( newRoot.startsWith( gamePrefix ) ) {
+		auto	stamps = Game::GameManager::file_stamps( Game::ModeForString( newRoot.mid( gamePrefix.size() ) ), paths );
+		for ( size_t i = 0; i < jobs.size(); i++ )
+			jobs[i].source = stamps[i];
+	}
+
+	// Initialize static data on this thread before the models are created by the workers
+	{
+		NifModel	nif;
+	}
+
+	std::atomic<int>	done = 0;
+	QThreadPool	pool;
+	if ( threads > 0 )
+		pool.setMaxThreadCount( threads );
+	for ( IndexJob & job : jobs ) {
+		pool.start( [&, j = &job]() {
+			indexFile( *j, *this, newRoot, indexFields, indexHeaderOnly );
+			done++;
+		} );
+	}
+	while ( !pool.waitForDone( 100 ) ) {
+		if ( progress )
+			progress( done, int( jobs.size() ) );
+	}
+	if ( progress )
+		progress( int( jobs.size() ), int( jobs.size() ) );
+
+	// build the new index
+	Stats	stats;
+	NifIndex	idx;
+	idx.root = newRoot;
+	idx.fields = indexFields;
+	idx.headerOnly = indexHeaderOnly;
+	QHash<QString, int>	termIds;
+	int	reused = 0;
+	for ( const IndexJob & job : jobs ) {
+		quint32	n = quint32( idx.files.size() );
+		idx.files.append( job.entry );
+		stats.files++;
+		stats.bytes += job.entry.size;
+		if ( job.oldFile >= 0 )
+			reused++;
+		if ( job.entry.failed )
+			stats.failed++;
+		else if ( job.unchanged )
+			stats.unchanged++;
+		else
+			stats.indexed++;
+
+		auto	addTerm = [&]( const QString & t ) {
+			auto	it = termIds.find( t );
+			if ( it == termIds.end() ) {
+				it = termIds.insert( t, idx.terms.size() );
+				idx.terms.append( t );
+				idx.postings.append( {} );
+			}
+			idx.postings[it.value()].append( n );
+		};
+		if ( job.unchanged ) {
+			for ( int t : oldTerms.at( job.oldFile ) )
+				addTerm( terms.at( t ) );
+		} else {
+			for ( const QString & t : job.terms )
+				addTerm( t );
+		}
+	}
+	stats.removed = files.size() - reused;
+	stats.terms = idx.terms.size();
+
+	*this = std::move( idx );
+	stats.msecs = timer.elapsed();
+	return stats;
+}
+
+QVector<quint32> NifIndex::query( const QStringList & queryTerms, QString * error ) const
+{
+	std::vector<char>	result( size_t( files.size() ), 1 );
+	std::unique_ptr<NifModel>	schema;
+
+	for ( QString term : queryTerms ) {
+		bool	negate = term.startsWith( QChar('!') );
+		if ( negate )
+			term.remove( 0, 1 );
+
+		std::function<bool ( const QString & )>	match;
+		if ( term.startsWith( "block:" ) ) {
+			// the model is only used for the block inheritance in the XML
+			if ( !schema )
+				schema = std::make_unique<NifModel>();
+			QString	type = term.mid( 6 );
+			match = [&schema, type]( const QString & t ) {
+				return t.startsWith( "block:" ) && schema->inherits( t.mid( 6 ), type );
+			};
+		} else if ( term.startsWith( "resource:" ) ) {
+			QRegularExpression	re( QRegularExpression::wildcardToRegularExpression( normalizeResourcePath( term.mid( 9 ) ) ) );
+			match = [re]( const QString & t ) {
+				return t.startsWith( "resource:" ) && re.match( t.mid( 9 ) ).hasMatch();
+			};
+		} else if ( term.startsWith( "value:" ) ) {
+			int	slash = term.indexOf( QChar('/') );
+			int	op = ( slash >= 0 ) ? term.indexOf( QRegularExpression( "[=&]" ), slash ) : -1;
+			if ( op < 0 ) {
+				if ( error )
+					*error = "Invalid value term, the form is value:<block>/<field>=<value> or &<mask>: " + term;
+				return {};
+			}
+			QString	prefix = term.left( op ) + "=";
+			QString	arg = term.mid( op + 1 );
+			bool	isInt = false;
+			qint64	n = arg.toLongLong( &isInt, 0 );
+			if ( term.at( op ) == QChar('&') ) {
+				if ( !isInt ) {
+					if ( error )
+						*error = "Invalid bit mask: " + term;
+					return {};
+				}
+				match = [prefix, n]( const QString & t ) {
+					bool	ok = false;
+					return t.startsWith( prefix ) && ( t.mid( prefix.size() ).toLongLong( &ok ) & n ) && ok;
+				};
+			} else if ( isInt ) {
+				// also matches hexadecimal numbers
+				match = [prefix, n]( const QString & t ) {
+					bool	ok = false;
+					return t.startsWith( prefix ) && t.mid( prefix.size() ).toLongLong( &ok ) == n && ok;
+				};
+			} else {
+				QRegularExpression	re( QRegularExpression::wildcardToRegularExpression( arg ),
+										QRegularExpression::CaseInsensitiveOption );
+				match = [prefix, re]( const QString & t ) {
+					return t.startsWith( prefix ) && re.match( t.mid( prefix.size() ) ).hasMatch();
+				};
+			}
+		} else {
+			if ( error )
+				*error = "Unknown term, expected block:, resource: or value: " + term;
+			return {};
+		}
+
+		std::vector<char>	found( result.size(), 0 );
+		for ( int t = 0; t < terms.size(); t++ ) {
+			if ( match( terms.at( t ) ) ) {
+				for ( quint32 i : postings.at( t ) )
+					found[i] = 1;
+			}
+		}
+		for ( size_t i = 0; i < result.size(); i++ )
+			result[i] = result[i] && ( bool( found[i] ) != negate );
+	}
+
+	QVector<quint32>	matches;
+	for ( size_t i = 0; i < result.size(); i++ ) {
+		if ( result[i] && !files.at( int(i) ).failed )
+			matches.append( quint32( i ) );
+	}
+	return matches;
+}
+
+QSet<QString> NifIndex::excludedFiles( const QStringList & queryTerms, QString * error ) const
+{
+	QSet<QString>	excluded;
+	QString	queryError;
+	QVector<quint32>	matches = query( queryTerms, &queryError );
+	if ( !queryError.isEmpty() ) {
+		if ( error )
+			*error = queryError;
+		return excluded;
+	}
+	if ( root.startsWith( gamePrefix ) )
+		return excluded;
+
+	std::vector<char>	isMatch( size_t( files.size() ), 0 );
+	for ( quint32 i : matches )
+		isMatch[i] = 1;
+
+	QDir	dir( root );
+	for ( int i = 0; i < files.size(); i++ ) {
+		const FileEntry &	e = files.at( i );
+		if ( isMatch[size_t(i)] || e.failed )
+			continue;
+		// files changed since they were indexed may match now
+		QFileInfo	fi( dir.filePath( e.path ) );
+		if ( fi.size() == e.size && fi.lastModified().toMSecsSinceEpoch() == e.stamp )
+			excluded.insert( QDir::cleanPath( fi.absoluteFilePath() ) );
+	}
+	return excluded;
+}
+
+QString NifIndex::filePath( quint32 n ) const
+{
+	const QString &	path = files.at( int(n) ).path;
+	return root.startsWith( gamePrefix ) ? path : QDir( root ).filePath( path );
+}
@@ -0,0 +1,106 @@
+#ifndef NIFINDEX_H_INCLUDED
+#define NIFINDEX_H_INCLUDED
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+
+//! Persistent inverted index of the block types, field values and resource paths used by a set of NIF files
+/*!
+ * The indexed root is a folder, or "game:<name>" for the archives and data folders of a game
+ * in the GameManager. Each file is described by a set of terms:
+ *
+ * - "block:<type>" for each block type in the file
+ * - "resource:<path>" for each resource file referenced, as a lower case full path
+ * - "value:<block>/<field>=<value>" for each field selected when indexing, in blocks that
+ *   inherit <block>
+ *
+ * and the index stores the sorted list of file numbers for each term.
+ */
+class NifIndex final
+{
+public:
+	struct FileEntry
+	{
+		//! Path relative to the root folder, or the archived path
+		QString	path;
+		qint64	size = 0;
+		//! Modification time of loose files in ms. For archived files, the stamp of the source from
+		// GameManager::file_stamps(), or a hash of the contents if the source is not known.
+		qint64	stamp = 0;
+		quint32	version = 0;
+		quint32	userVersion = 0;
+		quint32	bsVersion = 0;
+		bool	failed = false;
+	};
+
+	struct Stats
+	{
+		int	files = 0;
+		int	indexed = 0;
+		int	unchanged = 0;
+		int	failed = 0;
+		int	removed = 0;
+		int	terms = 0;
+		qint64	bytes = 0;
+		qint64	msecs = 0;
+
+		QString toString() const;
+	};
+
+	//! Default index file of 'root', in the cache folder of the application
+	static QString defaultFileName( const QString & root );
+
+	//! Load an index saved with save(), returns false if the file does not exist or is not valid
+	bool load( const QString & fileName );
+	bool save( const QString & fileName ) const;
+
+	//! Index the NIF files of 'root' on 'threads' threads, only loading files that are new or changed.
+	// The index is rebuilt if 'root', 'fields' or 'headerOnly' differ from the loaded index. With
+	// 'headerOnly', only the block types listed in the file headers are indexed when possible.
+	// 'progress' is called on the calling thread with the number of files done and the total.
+	Stats update( const QString & root, const QStringList & fields, bool headerOnly, int threads = 0,
+					const std::function< void ( int, int ) > & progress = nullptr );
+
+	//! Return the numbers of the files matching all of 'terms'
+	/*!
+	 * Terms have the same form as the indexed terms, and can be negated with a '!' prefix:
+	 *
+	 * - "block:<type>" matches <type> and the block types inheriting it
+	 * - "resource:<path>" and "value:<block>/<field>=<value>" accept * and ? wildcards
+	 * - "value:<block>/<field>&<mask>" matches integer values with any of the bits of <mask> set
+	 *
+	 * On an invalid term, an empty list is returned and 'error' is set.
+	 */
+	QVector<quint32> query( const QStringList & terms, QString * error = nullptr ) const;
+
+	//! Return the absolute paths of the loose files that are indexed, unchanged, and do not match 'terms'
+	/*!
+	 * On an invalid term, an empty set is returned and 'error' is set.
+	 */
+	QSet<QString> excludedFiles( const QStringList & terms, QString * error = nullptr ) const;
+
+	int fileCount() const { return files.size(); }
+	const FileEntry & file( quint32 n ) const { return files.at( int(n) ); }
+	//! Absolute path of a loose file, or the archived path
+	QString filePath( quint32 n ) const;
+	QString rootPath() const { return root; }
+	//! Fields indexed as "value:" terms, in the form <block>/<field>
+	QStringList indexedFields() const { return fields; }
+
+private:
+	QString	root;
+	QStringList	fields;
+	bool	headerOnly = false;
+	QVector<FileEntry>	files;
+	QStringList	terms;
+	//! Sorted file numbers of each term
+	QVector<QVector<quint32>>	postings;
+};
+
+#endif
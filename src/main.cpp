@@ -31,20 +31,58 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ***** END LICENCE BLOCK *****/
 
 #include "nifskope.h"
+#include "gamemanager.h"
+#include "message.h"
+#include "selftest.h"
+#include "spellbook.h"
 #include "version.h"
 #include "data/nifvalue.h"
 #include "model/nifmodel.h"
 #include "model/kfmmodel.h"
+#include "io/nifindex.h"
+#include "spells/fileextract.h"
+#include "ui/widgets/xmlcheck.h"
 
 #include <QApplication>
+#include <QBuffer>
 #include <QCommandLineParser>
 #include <QDesktopServices>
 #include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
 #include <QSettings>
 #include <QStack>
+#include <QTextStream>
+#include <QThreadPool>
 #include <QUdpSocket>
 #include <QUrl>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#ifdef Q_OS_WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  define PSAPI_VERSION 2
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif
+
 
 QCoreApplication * createApplication( int &argc, char *argv[] )
 {
@@ -62,6 +100,1021 @@ QCoreApplication * createApplication( int &argc, char *argv[] )
 	return new QApplication( argc, argv );
 }
 
+//! Expand folders and wildcard patterns in 'args' to the NIF files they contain
+/*!
+ * If 'relativePaths' is not null, the path of each file relative to the folder or pattern
+ * it was found in is also returned, for creating the same folder structure in an output folder.
+ */
+static QStringList findNifFiles( const QStringList & args, QStringList * relativePaths = nullptr )
+{
+	QStringList files;
+	auto addFile = [&]( const QString & path, const QString & relativePath ) {
+		files.append( path );
+		if ( relativePaths )
+			relativePaths->append( relativePath );
+	};
+	for ( const QString & arg : args ) {
+		QFileInfo finfo( arg );
+		if ( finfo.isDir() ) {
+			QDir dir( arg );
+			QDirIterator it( arg, { "*.nif" }, QDir::Files, QDirIterator::Subdirectories );
+			while ( it.hasNext() ) {
+				QString path = it.next();
+				addFile( path, dir.relativeFilePath( path ) );
+			}
+		} else if ( finfo.fileName().contains( '*' ) || finfo.fileName().contains( '?' ) ) {
+			QDir dir( finfo.path() );
+			for ( const QString & name : dir.entryList( { finfo.fileName() }, QDir::Files, QDir::Name ) )
+				addFile( dir.filePath( name ), name );
+		} else {
+			addFile( arg, finfo.fileName() );
+		}
+	}
+	return files;
+}
+
+//! Command line mode: extract the resource files used by NIF files
+static int extractResources( const QString & folder, const QStringList & args, int threads )
+{
+	NifModel::loadXML();
+	(void) Game::GameManager::get();
+
+	QTextStream out( stdout );
+	QElapsedTimer timer;
+	timer.start();
+
+	ResourceExtractor extractor( folder, threads );
+	ResourceExtractor::Stats stats;
+	int loadErrors = 0;
+
+	// Models are kept until their files are extracted, extract in batches to limit memory usage
+	std::vector<std::unique_ptr<NifModel>> models;
+	auto extractBatch = [&]() {
+		stats += extractor.run();
+		models.clear();
+	};
+
+	for ( const QString & fname : findNifFiles( args ) ) {
+		auto nif = std::make_unique<NifModel>();
+		nif->setMessageMode( BaseModel::MSG_TEST );
+		if ( !nif->loadFromFile( fname ) ) {
+			out << "Error loading " << fname << Qt::endl;
+			loadErrors++;
+			continue;
+		}
+		extractor.addModel( nif.get() );
+		models.push_back( std::move( nif ) );
+		if ( models.size() >= 64 )
+			extractBatch();
+	}
+	extractBatch();
+
+	stats.msecs = timer.elapsed();
+	out << stats.toString() << Qt::endl;
+	return ( stats.failed || loadErrors ) ? 1 : 0;
+}
+
+//! Log of the file being processed by the current thread in command line batch mode
+struct BatchLog
+{
+	QJsonArray	messages;
+	int	errors = 0;
+};
+
+static thread_local BatchLog * batchLog = nullptr;
+static QtMessageHandler defaultMessageHandler = nullptr;
+
+//! Message handler for batch mode, attributes messages to the file processed by the calling thread
+static void batchMessageOutput( QtMsgType type, const QMessageLogContext & context, const QString & msg )
+{
+	if ( !batchLog ) {
+		if ( defaultMessageHandler )
+			defaultMessageHandler( type, context, msg );
+		return;
+	}
+	if ( type == QtDebugMsg )
+		return;
+
+	static const char * typeNames[5] = { "debug", "warning", "critical", "fatal", "info" };
+	batchLog->messages.append( QJsonObject{ { "type", typeNames[int(type) < 5 ? int(type) : 1] }, { "text", msg } } );
+	if ( type == QtCriticalMsg || type == QtFatalMsg )
+		batchLog->errors++;
+}
+
+//! Find a spell by "Page/Name", or by name alone if it is unique
+static SpellPtr findSpell( const QString & id )
+{
+	if ( SpellPtr spell = SpellBook::lookup( id ) )
+		return spell;
+
+	SpellPtr found;
+	for ( SpellPtr spell : SpellBook::spells() ) {
+		if ( spell->name() != id && spell->name().remove( "..." ) != id )
+			continue;
+		if ( found )
+			return nullptr;
+		found = spell;
+	}
+	return found;
+}
+
+//! Load a NIF file, cast 'spells' on it and save it to 'outputPath' if it is not empty
+static QJsonObject processBatchFile( const QString & path, const QString & outputPath, const QList<SpellPtr> & spells )
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	BatchLog log;
+	batchLog = &log;
+
+	QJsonObject result;
+	result["file"] = path;
+	QString error;
+	QJsonArray spellResults;
+	{
+		NifModel nif;
+		nif.setMessageMode( BaseModel::MSG_TEST );
+		if ( !nif.loadFromFile( path ) ) {
+			error = "load failed";
+		} else {
+			for ( const SpellPtr & spell : spells ) {
+				QJsonObject s;
+				s["spell"] = spell->page().isEmpty() ? spell->name() : ( spell->page() + "/" + spell->name() );
+				bool applicable = spell->isApplicable( &nif, QModelIndex() );
+				s["applied"] = applicable;
+				if ( applicable ) {
+					// same as SpellBook::cast()
+					bool noSignals = spell->batch();
+					if ( noSignals )
+						nif.setState( BaseModel::Processing );
+					try {
+						spell->cast( &nif, QModelIndex() );
+					} catch ( std::exception & e ) {
+						s["error"] = QString( e.what() );
+						error = "spell failed";
+					}
+					if ( noSignals )
+						nif.resetState();
+					nif.invalidateHeaderConditions();
+					nif.updateHeader();
+				}
+				spellResults.append( s );
+				if ( !error.isEmpty() )
+					break;
+			}
+
+			for ( const TestMessage & msg : nif.getMessages() ) {
+				log.messages.append( QJsonObject{
+					{ "type", msg.type() == QtCriticalMsg ? "critical" : ( msg.type() == QtInfoMsg ? "info" : "warning" ) },
+					{ "text", QString( msg ) } } );
+				if ( msg.type() == QtCriticalMsg )
+					log.errors++;
+			}
+
+			if ( error.isEmpty() && !outputPath.isEmpty() ) {
+				if ( !( QDir().mkpath( QFileInfo( outputPath ).absolutePath() ) && nif.saveToFile( outputPath ) ) )
+					error = "save failed";
+				else
+					result["output"] = outputPath;
+			}
+		}
+	}
+	batchLog = nullptr;
+
+	if ( error.isEmpty() && log.errors )
+		error = "errors reported";
+	result["status"] = error.isEmpty() ? "ok" : "failed";
+	if ( !error.isEmpty() )
+		result["error"] = error;
+	result["spells"] = spellResults;
+	if ( !log.messages.isEmpty() )
+		result["messages"] = log.messages;
+	result["msecs"] = timer.elapsed();
+	return result;
+}
+
+//! Command line mode: cast spells on NIF files in parallel, and print the results as JSON
+static int batchSpells( const QStringList & spellNames, bool sanitize, const QString & outputFolder,
+						const QStringList & args, int threads )
+{
+	NifModel::loadXML();
+	(void) Game::GameManager::get();
+
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	QList<SpellPtr> spells;
+	for ( const QString & name : spellNames ) {
+		SpellPtr spell = findSpell( name );
+		if ( !spell ) {
+			err << "Unknown or ambiguous spell: " << name << Qt::endl;
+			return 2;
+		}
+		spells.append( spell );
+	}
+	if ( sanitize )
+		spells.append( SpellBook::sanitizers() );
+
+	QStringList relativePaths;
+	QStringList files = findNifFiles( args, &relativePaths );
+	if ( files.isEmpty() ) {
+		err << "No files to process" << Qt::endl;
+		return 2;
+	}
+
+	// Initialize static data on this thread before the models are created by the workers
+	{
+		NifModel nif;
+	}
+	defaultMessageHandler = qInstallMessageHandler( batchMessageOutput );
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// Each file is a separate task, idle worker threads take the next file from the queue
+	std::vector<QJsonObject> results( size_t( files.size() ) );
+	std::atomic<int> done = 0;
+	QThreadPool pool;
+	if ( threads > 0 )
+		pool.setMaxThreadCount( threads );
+	for ( int i = 0; i < files.size(); i++ ) {
+		QString outputPath;
+		if ( !outputFolder.isEmpty() )
+			outputPath = QDir( outputFolder ).filePath( relativePaths.at( i ) );
+		pool.start( [&results, &done, &spells, i, path = files.at( i ), outputPath]() {
+			results[size_t( i )] = processBatchFile( path, outputPath, spells );
+			done++;
+		} );
+	}
+	while ( !pool.waitForDone( 1000 ) )
+		err << done << " / " << files.size() << " files" << Qt::endl;
+
+	qInstallMessageHandler( defaultMessageHandler );
+
+	QJsonArray fileResults;
+	int failed = 0;
+	for ( const QJsonObject & r : results ) {
+		if ( r["status"].toString() != "ok" )
+			failed++;
+		fileResults.append( r );
+	}
+	QJsonObject summary{
+		{ "files", files.size() },
+		{ "failed", failed },
+		{ "threads", pool.maxThreadCount() },
+		{ "msecs", timer.elapsed() }
+	};
+	out << QJsonDocument( QJsonObject{ { "summary", summary }, { "files", fileResults } } ).toJson();
+	out.flush();
+
+	return failed ? 1 : 0;
+}
+
+//! Command line mode: check files against the XML in parallel, and print the results as JSON Lines
+static int checkXml( const QCommandLineParser & parser, int threads, int timeout )
+{
+	QTextStream err( stderr );
+
+	FileChecker checker;
+	checker.blockMatch = parser.value( "block" );
+	checker.valueName = parser.value( "value" );
+	checker.valueMatch = parser.value( "match" );
+	if ( parser.isSet( "op" ) ) {
+		auto i = std::find( ops_ord.begin(), ops_ord.end(), parser.value( "op" ) );
+		if ( i == ops_ord.end() ) {
+			err << "Unknown operator: " << parser.value( "op" ) << Qt::endl;
+			return 2;
+		}
+		checker.op = OpType( i - ops_ord.begin() );
+	}
+	if ( parser.isSet( "nif-version" ) ) {
+		checker.verMatch = NifModel::version2number( parser.value( "nif-version" ) );
+		if ( !checker.verMatch ) {
+			err << "Invalid version: " << parser.value( "nif-version" ) << Qt::endl;
+			return 2;
+		}
+	}
+	checker.headerOnly = parser.isSet( "header-only" );
+	checker.checkFile = !parser.isSet( "no-error-check" );
+
+	QStringList args = parser.positionalArguments();
+	if ( args.isEmpty() ) {
+		err << "No files to check" << Qt::endl;
+		return 2;
+	}
+
+	NifModel::loadXML();
+	KfmModel::loadXML();
+	(void) Game::GameManager::get();
+
+	// Initialize static data on this thread before the models are created by the workers
+	{
+		NifModel nif;
+		KfmModel kfm;
+	}
+
+	return checker.checkAll( args, !parser.isSet( "no-recursive" ), threads, timeout );
+}
+//! Command line mode: create or update the corpus index of a folder or "game:<name>"
+static int buildIndex( const QString & root, const QString & indexFile, const QStringList & fields, bool headerOnly, int threads )
+{
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	for ( const QString & field : fields ) {
+		if ( field.indexOf( '/' ) <= 0 ) {
+			err << "Invalid field, the form is <block>/<field>: " << field << Qt::endl;
+			return 2;
+		}
+	}
+
+	NifModel::loadXML();
+	(void) Game::GameManager::get();
+
+	QString fileName = indexFile.isEmpty() ? NifIndex::defaultFileName( root ) : indexFile;
+	NifIndex index;
+	(void) index.load( fileName );
+	NifIndex::Stats stats = index.update( root, fields, headerOnly, threads, [&err]( int done, int total ) {
+		err << done << " / " << total << " files\r";
+		err.flush();
+	} );
+	err << Qt::endl;
+	if ( !index.save( fileName ) ) {
+		err << "Cannot write " << fileName << Qt::endl;
+		return 1;
+	}
+
+	out << stats.toString() << Qt::endl << "Index saved to " << fileName << Qt::endl;
+	return stats.failed ? 1 : 0;
+}
+
+//! Command line mode: print the files of a corpus index matching all of 'terms'
+static int queryIndex( const QString & root, const QString & indexFile, const QStringList & terms )
+{
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	if ( root.isEmpty() && indexFile.isEmpty() ) {
+		err << "No index to query, pass the indexed folder or --index-file" << Qt::endl;
+		return 2;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// the XML is only needed to find the block types inheriting a queried type
+	for ( const QString & term : terms ) {
+		if ( term.startsWith( "block:" ) || term.startsWith( "!block:" ) ) {
+			NifModel::loadXML();
+			break;
+		}
+	}
+
+	QString fileName = indexFile.isEmpty() ? NifIndex::defaultFileName( root ) : indexFile;
+	NifIndex index;
+	if ( !index.load( fileName ) ) {
+		err << "Cannot load index " << fileName << ", create it with --index" << Qt::endl;
+		return 2;
+	}
+
+	QString error;
+	QVector<quint32> matches = index.query( terms, &error );
+	if ( !error.isEmpty() ) {
+		err << error << Qt::endl;
+		return 2;
+	}
+	for ( quint32 n : matches )
+		out << index.filePath( n ) << '\n';
+	out.flush();
+	err << matches.size() << " of " << index.fileCount() << " files in " << timer.elapsed() << " ms" << Qt::endl;
+
+	return matches.isEmpty() ? 1 : 0;
+}
+
+/*
+ *  Benchmark mode
+ */
+
+#ifdef NIFSKOPE_COUNT_ALLOCATIONS
+//! Number of memory allocations made with operator new, for the --benchmark mode
+static std::atomic<quint64> allocationCount = 0;
+
+void * operator new( std::size_t size )
+{
+	allocationCount.fetch_add( 1, std::memory_order_relaxed );
+	if ( void * p = std::malloc( size ? size : 1 ) )
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete( void * p ) noexcept
+{
+	std::free( p );
+}
+
+void operator delete( void * p, std::size_t ) noexcept
+{
+	std::free( p );
+}
+#endif
+
+//! Peak resident set size of the process in bytes, or -1 if it is not known
+static qint64 peakResidentBytes()
+{
+#ifdef Q_OS_WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+		return qint64( pmc.PeakWorkingSetSize );
+	return -1;
+#else
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return -1;
+#  ifdef Q_OS_MACOS
+	return qint64( usage.ru_maxrss );
+#  else
+	return qint64( usage.ru_maxrss ) * 1024;
+#  endif
+#endif
+}
+
+//! Timing samples of a benchmark phase
+struct BenchmarkPhase
+{
+	std::vector<qint64> nsecs;
+	qint64 bytes = 0;
+	qint64 blocks = 0;
+	quint64 allocations = 0;
+
+	void add( qint64 t, qint64 b, qint64 blk, quint64 alloc )
+	{
+		nsecs.push_back( t );
+		bytes += b;
+		blocks += blk;
+		allocations += alloc;
+	}
+
+	//! Percentiles of the samples in milliseconds, and throughput
+	QJsonObject toJson() const
+	{
+		QJsonObject o;
+		if ( nsecs.empty() )
+			return o;
+		std::vector<qint64> s( nsecs );
+		std::sort( s.begin(), s.end() );
+		auto ms = []( qint64 t ) { return double( t ) / 1000000.0; };
+		// nearest rank percentile
+		auto at = [&s]( double p ) {
+			size_t n = size_t( std::ceil( p * double( s.size() ) ) );
+			return s[std::clamp< size_t >( n, 1, s.size() ) - 1];
+		};
+		qint64 total = 0;
+		for ( qint64 t : s )
+			total += t;
+		double seconds = std::max( double( total ) / 1000000000.0, 1e-9 );
+
+		o["samples"] = qint64( s.size() );
+		o["totalMsecs"] = ms( total );
+		o["min"] = ms( s.front() );
+		o["p50"] = ms( at( 0.5 ) );
+		o["p90"] = ms( at( 0.9 ) );
+		o["p99"] = ms( at( 0.99 ) );
+		o["max"] = ms( s.back() );
+		if ( bytes )
+			o["MBPerSecond"] = double( bytes ) / ( seconds * 1048576.0 );
+		if ( blocks )
+			o["blocksPerSecond"] = double( blocks ) / seconds;
+#ifdef NIFSKOPE_COUNT_ALLOCATIONS
+		o["allocations"] = qint64( allocations );
+#endif
+		return o;
+	}
+};
+
+//! Results of the benchmark for a set of files
+struct BenchmarkGroup
+{
+	int files = 0;
+	qint64 bytes = 0;
+	qint64 blocks = 0;
+	BenchmarkPhase read;
+	BenchmarkPhase header;
+	BenchmarkPhase load;
+	BenchmarkPhase save;
+
+	QJsonObject toJson() const
+	{
+		return QJsonObject{
+			{ "files", files },
+			{ "bytes", bytes },
+			{ "blocks", blocks },
+			{ "phases", QJsonObject{
+				{ "read", read.toJson() },
+				{ "loadHeaderOnly", header.toJson() },
+				{ "load", load.toJson() },
+				{ "save", save.toJson() }
+			} }
+		};
+	}
+};
+
+//! Command line mode: measure the load and save performance of NifModel over a set of NIF files
+/*!
+ * Files are read into memory first, so that the load and save phases do not include disk access.
+ * Each file is loaded and saved 'repeat' times on a single thread, and the saved data is compared
+ * with the original file. The results are printed as JSON, broken down by file version and block type.
+ */
+static int runBenchmark( const QStringList & args, int repeat )
+{
+	QTextStream err( stderr );
+
+	QStringList files = findNifFiles( args );
+	if ( files.isEmpty() ) {
+		err << "No files to process" << Qt::endl;
+		return 2;
+	}
+	repeat = std::max( repeat, 1 );
+
+	NifModel::loadXML();
+	(void) Game::GameManager::get();
+	{
+		NifModel nif;
+	}
+
+	auto allocations = []() -> quint64 {
+#ifdef NIFSKOPE_COUNT_ALLOCATIONS
+		return allocationCount.load( std::memory_order_relaxed );
+#else
+		return 0;
+#endif
+	};
+
+	struct BlockTypeStats
+	{
+		qint64 count = 0;
+		qint64 bytes = 0;
+		std::vector<qint64> nsecs;
+	};
+
+	QElapsedTimer total;
+	total.start();
+
+	BenchmarkGroup all;
+	QMap<QString, BenchmarkGroup> versions;
+	QMap<QString, BlockTypeStats> blockTypes;
+	QJsonArray failures;
+	int roundTripDifferences = 0;
+
+	for ( int i = 0; i < files.size(); i++ ) {
+		const QString & path = files.at( i );
+		err << i + 1 << " / " << files.size() << " files\r";
+
+		QElapsedTimer timer;
+		quint64 a = allocations();
+		timer.start();
+		QFile f( path );
+		QByteArray data;
+		if ( f.open( QIODevice::ReadOnly ) )
+			data = f.readAll();
+		qint64 readTime = timer.nsecsElapsed();
+		quint64 readAllocations = allocations() - a;
+		if ( data.isEmpty() ) {
+			failures.append( QJsonObject{ { "file", path }, { "error", "read failed" } } );
+			continue;
+		}
+
+		BenchmarkGroup fileStats;
+		fileStats.read.add( readTime, data.size(), 0, readAllocations );
+		QString error;
+		QString version;
+		qint64 blockCount = 0;
+		std::string fileName = path.toStdString();
+
+		for ( int r = 0; r < repeat && error.isEmpty(); r++ ) {
+			{
+				// the header is parsed from memory like the full load, the file I/O is measured by 'read'
+				NifModel nif;
+				QBuffer in( &data );
+				in.open( QIODevice::ReadOnly );
+				a = allocations();
+				timer.start();
+				bool ok = nif.loadHeaderOnly( in );
+				fileStats.header.add( timer.nsecsElapsed(), 0, 0, allocations() - a );
+				if ( !ok ) {
+					error = "header load failed";
+					break;
+				}
+			}
+
+			NifModel nif;
+			nif.setMessageMode( BaseModel::MSG_TEST );
+			nif.setBlockTimingEnabled( r == repeat - 1 );
+			QBuffer in( &data );
+			in.open( QIODevice::ReadOnly );
+			a = allocations();
+			timer.start();
+			bool ok = nif.load( in, fileName.c_str() );
+			qint64 loadTime = timer.nsecsElapsed();
+			quint64 loadAllocations = allocations() - a;
+			if ( !ok ) {
+				error = "load failed";
+				break;
+			}
+			blockCount = nif.getBlockCount();
+			fileStats.load.add( loadTime, data.size(), blockCount, loadAllocations );
+			version = QString( "%1 / %2 / %3" ).arg( nif.getVersion() ).arg( nif.getUserVersion() ).arg( nif.getBSVersion() );
+
+			QBuffer out;
+			out.open( QIODevice::WriteOnly );
+			a = allocations();
+			timer.start();
+			ok = nif.save( out );
+			qint64 saveTime = timer.nsecsElapsed();
+			quint64 saveAllocations = allocations() - a;
+			if ( !ok ) {
+				error = "save failed";
+				break;
+			}
+			fileStats.save.add( saveTime, out.data().size(), blockCount, saveAllocations );
+
+			if ( r == 0 && out.data() != data ) {
+				const QByteArray & saved = out.data();
+				qint64 n = std::min( saved.size(), data.size() );
+				qint64 offset = 0;
+				while ( offset < n && saved.at( offset ) == data.at( offset ) )
+					offset++;
+				roundTripDifferences++;
+				failures.append( QJsonObject{
+					{ "file", path }, { "error", "round trip differs" }, { "offset", offset },
+					{ "size", qint64( data.size() ) }, { "savedSize", qint64( saved.size() ) } } );
+			}
+
+			if ( r == repeat - 1 ) {
+				for ( int b = 0; b < blockCount; b++ ) {
+					BlockTypeStats & s = blockTypes[nif.itemName( nif.getBlockIndex( b ) )];
+					s.count++;
+					qint64 size = nif.getBlockSize( b );
+					if ( size >= 0 )
+						s.bytes += size;
+					qint64 t = nif.getBlockLoadTime( b );
+					if ( t >= 0 )
+						s.nsecs.push_back( t );
+				}
+			}
+		}
+
+		if ( !error.isEmpty() ) {
+			failures.append( QJsonObject{ { "file", path }, { "error", error } } );
+			continue;
+		}
+
+		fileStats.files = 1;
+		fileStats.bytes = data.size();
+		fileStats.blocks = blockCount;
+		for ( BenchmarkGroup * g : { &all, &versions[version] } ) {
+			g->files += fileStats.files;
+			g->bytes += fileStats.bytes;
+			g->blocks += fileStats.blocks;
+			for ( auto p : { &BenchmarkGroup::read, &BenchmarkGroup::header, &BenchmarkGroup::load, &BenchmarkGroup::save } ) {
+				const BenchmarkPhase & src = fileStats.*p;
+				BenchmarkPhase & dst = g->*p;
+				dst.nsecs.insert( dst.nsecs.end(), src.nsecs.begin(), src.nsecs.end() );
+				dst.bytes += src.bytes;
+				dst.blocks += src.blocks;
+				dst.allocations += src.allocations;
+			}
+		}
+	}
+	err << Qt::endl;
+
+	QJsonObject versionResults;
+	for ( auto i = versions.cbegin(); i != versions.cend(); i++ )
+		versionResults[i.key()] = i.value().toJson();
+
+	QJsonObject blockTypeResults;
+	for ( auto i = blockTypes.begin(); i != blockTypes.end(); i++ ) {
+		BenchmarkPhase p;
+		p.nsecs = std::move( i.value().nsecs );
+		p.bytes = i.value().bytes;
+		p.blocks = i.value().count;
+		blockTypeResults[i.key()] = QJsonObject{
+			{ "count", i.value().count },
+			{ "bytes", i.value().bytes },
+			{ "load", p.toJson() }
+		};
+	}
+
+	QJsonObject result = all.toJson();
+	result["nifskopeVersion"] = QString( NIFSKOPE_VERSION );
+	result["repeat"] = repeat;
+	result["failed"] = failures.size() - roundTripDifferences;
+	result["roundTripDifferences"] = roundTripDifferences;
+	result["totalMsecs"] = total.elapsed();
+	result["peakResidentBytes"] = peakResidentBytes();
+	result["versions"] = versionResults;
+	result["blockTypes"] = blockTypeResults;
+	if ( !failures.isEmpty() )
+		result["failures"] = failures;
+
+	QTextStream out( stdout );
+	out << QJsonDocument( result ).toJson();
+	out.flush();
+
+	return failures.isEmpty() ? 0 : 1;
+}
+
+
+/*
+ *  Daemon mode
+ */
+
+//! Default name of the local socket of the --daemon mode
+static const char * defaultDaemonName = "NifSkope";
+
+//! Dump the rows under 'parent' as a JSON array of { "name", "type", "value", "children" } objects
+static QJsonArray dumpModel( const NifModel & nif, const QModelIndex & parent )
+{
+	QJsonArray rows;
+	for ( int r = 0; r < nif.rowCount( parent ); r++ ) {
+		QModelIndex idx = nif.index( r, NifModel::NameCol, parent );
+		QJsonObject row;
+		row["name"] = nif.itemName( idx );
+		row["type"] = nif.itemStrType( idx );
+		QString value = nif.data( idx.siblingAtColumn( NifModel::ValueCol ), Qt::DisplayRole ).toString();
+		if ( !value.isEmpty() )
+			row["value"] = value;
+		if ( nif.rowCount( idx ) > 0 )
+			row["children"] = dumpModel( nif, idx );
+		rows.append( row );
+	}
+	return rows;
+}
+
+//! Process a request of the daemon protocol, called on a worker thread
+static QJsonObject processDaemonRequest( const QJsonObject & request )
+{
+	QElapsedTimer timer;
+	timer.start();
+
+	QString command = request.value( "command" ).toString();
+	QString path = request.value( "file" ).toString();
+	QString output = request.value( "output" ).toString();
+	QJsonObject result;
+
+	if ( command == "validate" ) {
+		FileChecker checker;
+		checker.headerOnly = request.value( "headerOnly" ).toBool();
+		checker.checkFile = request.value( "checkErrors" ).toBool( true );
+		NifModel nif;
+		KfmModel kfm;
+		result = checker.check( nif, kfm, path ).toJson( path );
+	} else if ( command == "spell" ) {
+		QList<SpellPtr> spells;
+		for ( const QJsonValue & name : request.value( "spells" ).toArray() ) {
+			SpellPtr spell = findSpell( name.toString() );
+			if ( !spell )
+				return QJsonObject{ { "status", "failed" }, { "error", "unknown or ambiguous spell: " + name.toString() } };
+			spells.append( spell );
+		}
+		if ( request.value( "sanitize" ).toBool() )
+			spells.append( SpellBook::sanitizers() );
+		result = processBatchFile( path, output, spells );
+	} else if ( command == "dump" ) {
+		NifModel nif;
+		nif.setMessageMode( BaseModel::MSG_TEST );
+		result["file"] = path;
+		if ( nif.loadFromFile( path ) ) {
+			result["status"] = "ok";
+			result["rows"] = dumpModel( nif, QModelIndex() );
+		} else {
+			result["status"] = "failed";
+			result["error"] = "load failed";
+		}
+	} else if ( command == "extract-resources" ) {
+		NifModel nif;
+		nif.setMessageMode( BaseModel::MSG_TEST );
+		result["file"] = path;
+		if ( output.isEmpty() ) {
+			result["status"] = "failed";
+			result["error"] = "no output folder";
+		} else if ( !nif.loadFromFile( path ) ) {
+			result["status"] = "failed";
+			result["error"] = "load failed";
+		} else {
+			ResourceExtractor extractor( output, 1 );
+			extractor.addModel( &nif );
+			ResourceExtractor::Stats stats = extractor.run();
+			result["status"] = ( stats.failed || stats.missing ) ? "failed" : "ok";
+			result["files"] = stats.files;
+			result["written"] = stats.written;
+			result["unchanged"] = stats.unchanged;
+			result["missing"] = stats.missing;
+			result["failed"] = stats.failed;
+			result["bytes"] = stats.bytes;
+		}
+	} else {
+		return QJsonObject{ { "status", "failed" }, { "error", "unknown command: " + command } };
+	}
+
+	result["msecs"] = timer.elapsed();
+	return result;
+}
+
+//! Command line mode: keep the XML, archives and caches loaded, and process requests from --send clients
+/*!
+ * Requests and responses are JSON objects, one per line, on a local socket named 'name'. Requests have a
+ * "command" (validate, spell, dump, extract-resources, status or shutdown) and a "file", and optionally
+ * "output", "spells", "sanitize", "headerOnly" and "checkErrors". The "id" of a request is copied to its
+ * response. Requests are processed concurrently, so responses may arrive in a different order.
+ */
+static int runDaemon( const QString & name, int threads )
+{
+	QTextStream err( stderr );
+
+	// Only remove the socket of a server that is no longer running
+	{
+		QLocalSocket probe;
+		probe.connectToServer( name );
+		if ( probe.waitForConnected( 1000 ) ) {
+			err << "A server is already running on " << name << Qt::endl;
+			return 2;
+		}
+		if ( probe.error() == QLocalSocket::ConnectionRefusedError )
+			QLocalServer::removeServer( name );
+	}
+
+	NifModel::loadXML();
+	KfmModel::loadXML();
+	(void) Game::GameManager::get();
+
+	// Open the archives and material databases of the enabled games in the background
+	for ( int game = Game::OTHER + 1; game < Game::NUM_GAMES; game++ ) {
+		if ( Game::GameManager::status( Game::GameMode( game ) ) )
+			(void) Game::GameManager::preload( Game::GameMode( game ) );
+	}
+
+	// Initialize static data on this thread before the models are created by the workers
+	{
+		NifModel nif;
+		KfmModel kfm;
+	}
+	defaultMessageHandler = qInstallMessageHandler( batchMessageOutput );
+
+	QLocalServer server;
+	server.setSocketOptions( QLocalServer::UserAccessOption );
+	if ( !server.listen( name ) ) {
+		err << "Cannot listen on " << name << ": " << server.errorString() << Qt::endl;
+		return 2;
+	}
+	err << "Listening on " << server.fullServerName() << Qt::endl;
+
+	QThreadPool pool;
+	if ( threads > 0 )
+		pool.setMaxThreadCount( threads );
+	QElapsedTimer uptime;
+	uptime.start();
+	int requests = 0;
+
+	QObject::connect( &server, &QLocalServer::newConnection, [&]() {
+		while ( QLocalSocket * socket = server.nextPendingConnection() ) {
+			QObject::connect( socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater );
+			QObject::connect( socket, &QLocalSocket::readyRead, socket, [&, socket]() {
+				while ( socket->canReadLine() ) {
+					QJsonParseError parseError;
+					QJsonDocument doc = QJsonDocument::fromJson( socket->readLine().trimmed(), &parseError );
+					QJsonObject request = doc.object();
+					QJsonValue id = request.value( "id" );
+					requests++;
+
+					auto reply = [socket = QPointer<QLocalSocket>( socket ), id]( QJsonObject response ) {
+						if ( !socket )
+							return;
+						if ( !id.isUndefined() )
+							response["id"] = id;
+						socket->write( QJsonDocument( response ).toJson( QJsonDocument::Compact ) + '\n' );
+					};
+
+					QString command = request.value( "command" ).toString();
+					if ( parseError.error != QJsonParseError::NoError || !doc.isObject() ) {
+						reply( { { "status", "failed" }, { "error", "invalid request" } } );
+					} else if ( command == "status" ) {
+						auto cache = Game::GameManager::file_cache_stats();
+						reply( {
+							{ "status", "ok" },
+							{ "uptimeMsecs", uptime.elapsed() },
+							{ "requests", requests },
+							{ "activeThreads", pool.activeThreadCount() },
+							{ "maxThreads", pool.maxThreadCount() },
+							{ "cachedFiles", cache.count },
+							{ "cachedBytes", cache.bytes },
+							{ "cacheHits", qint64( cache.hits ) },
+							{ "cacheMisses", qint64( cache.misses ) }
+						} );
+					} else if ( command == "shutdown" ) {
+						reply( { { "status", "ok" } } );
+						socket->flush();
+						server.close();
+						QCoreApplication::quit();
+					} else {
+						pool.start( [request, reply]() {
+							QJsonObject response = processDaemonRequest( request );
+							// the socket can only be written to on the main thread, and may have been closed by then
+							QMetaObject::invokeMethod( QCoreApplication::instance(), [reply, response]() { reply( response ); },
+														Qt::QueuedConnection );
+						} );
+					}
+				}
+			} );
+		}
+	} );
+
+	int result = QCoreApplication::exec();
+	pool.waitForDone();
+	qInstallMessageHandler( defaultMessageHandler );
+	return result;
+}
+
+//! Command line mode: send requests for the files to a --daemon process, and print the responses as JSON Lines
+static int sendToDaemon( const QString & name, const QString & command, const QStringList & args,
+						const QStringList & spellNames, bool sanitize, const QString & outputFolder )
+{
+	QTextStream err( stderr );
+
+	QLocalSocket socket;
+	socket.connectToServer( name );
+	if ( !socket.waitForConnected( 5000 ) ) {
+		err << "Cannot connect to " << name << ": " << socket.errorString() << Qt::endl;
+		return 2;
+	}
+
+	QList<QJsonObject> requests;
+	if ( command == "status" || command == "shutdown" ) {
+		requests.append( QJsonObject{ { "command", command } } );
+	} else {
+		QStringList relativePaths;
+		QStringList files = findNifFiles( args, &relativePaths );
+		if ( files.isEmpty() ) {
+			err << "No files to process" << Qt::endl;
+			return 2;
+		}
+		for ( int i = 0; i < files.size(); i++ ) {
+			// relative paths are resolved by the daemon in its own working directory
+			QJsonObject request{ { "command", command }, { "file", QFileInfo( files.at( i ) ).absoluteFilePath() } };
+			if ( !outputFolder.isEmpty() ) {
+				QString outputPath = ( command == "extract-resources" ) ? outputFolder : QDir( outputFolder ).filePath( relativePaths.at( i ) );
+				request["output"] = QFileInfo( outputPath ).absoluteFilePath();
+			}
+			if ( !spellNames.isEmpty() )
+				request["spells"] = QJsonArray::fromStringList( spellNames );
+			if ( sanitize )
+				request["sanitize"] = true;
+			requests.append( request );
+		}
+	}
+
+	for ( int i = 0; i < requests.size(); i++ ) {
+		requests[i]["id"] = i;
+		socket.write( QJsonDocument( requests.at( i ) ).toJson( QJsonDocument::Compact ) + '\n' );
+	}
+	socket.flush();
+
+	int failed = 0;
+	int received = 0;
+	while ( received < requests.size() ) {
+		if ( !socket.canReadLine() && !socket.waitForReadyRead( -1 ) ) {
+			err << "Connection lost: " << socket.errorString() << Qt::endl;
+			return 1;
+		}
+		while ( socket.canReadLine() ) {
+			QByteArray line = socket.readLine();
+			QJsonObject response = QJsonDocument::fromJson( line ).object();
+			QString status = response.value( "status" ).toString();
+			if ( status != "ok" && status != "skipped" )
+				failed++;
+			std::fwrite( line.constData(), 1, size_t( line.size() ), stdout );
+			received++;
+		}
+	}
+	std::fflush( stdout );
+
+	return failed ? 1 : 0;
+}
+
+//! Run the built-in checks, returns 0 if all of them pass
+/*! The idle redraw checks of the view are only run with 'withView', as they need a GUI application. */
+static int runSelfTests( bool withView, const QString & viewFile = QString() )
+{
+	QTextStream out( stdout );
+	QTextStream err( stderr );
+
+	int failures = SelfTest::rayCast( err );
+	if ( withView )
+		failures += SelfTest::idleRedraw( viewFile, 2000, err );
+
+	out << ( failures ? QString( "%1 check(s) failed" ).arg( failures ) : QString( "All checks passed" ) ) << Qt::endl;
+	return failures ? 1 : 0;
+}
+
 
 /*
  *  main
@@ -122,9 +1175,21 @@ int main( int argc, char * argv[] )
 		QCommandLineOption portOption( {"p", "port"}, "Port NifSkope listens on", "port" );
 		parser.addOption( portOption );
 
+		// Add self test option, the view checks need a window
+		QCommandLineOption selfTestOption( "self-test",
+			"Run the built-in checks, including that the view of the file (or an empty scene) does not redraw while idle" );
+		parser.addOption( selfTestOption );
+
 		// Process options
 		parser.process( *a );
 
+		if ( parser.isSet( selfTestOption ) ) {
+			QString file = parser.positionalArguments().value( 0 );
+			if ( !file.isEmpty() )
+				file = QDir::current().filePath( file );
+			return runSelfTests( true, file );
+		}
+
 		// Override port value
 		if ( parser.isSet( portOption ) )
 			port = parser.value( portOption ).toInt();
@@ -160,7 +1225,107 @@ int main( int argc, char * argv[] )
 			return 0;
 		}
 	} else {
-		// Future command line batch tools here
+		// Command line batch tools
+		app->setOrganizationName( "NifTools" );
+		app->setOrganizationDomain( "niftools.org" );
+		app->setApplicationName( "NifSkope " + NifSkopeVersion::rawToMajMin( NIFSKOPE_VERSION ) );
+		app->setApplicationVersion( NIFSKOPE_VERSION );
+
+		QCommandLineParser parser;
+		parser.setSingleDashWordOptionMode( QCommandLineParser::ParseAsLongOptions );
+		parser.addHelpOption();
+		parser.addVersionOption();
+		parser.addPositionalArgument( "files", "NIF files, wildcard patterns, or folders to search for NIF files" );
+
+		QCommandLineOption noGuiOption( "no-gui", "Run without the user interface" );
+		QCommandLineOption extractOption( "extract-resources", "Extract the resource files used by the NIF files to <folder>", "folder" );
+		QCommandLineOption threadsOption( "threads", "Number of worker threads, the default is one per CPU core", "count" );
+		QCommandLineOption spellOption( "spell", "Cast a spell on each NIF file, by name or \"Page/Name\", can be repeated", "name" );
+		QCommandLineOption sanitizeOption( "sanitize", "Cast all sanitizing spells on each NIF file" );
+		QCommandLineOption outputOption( "output", "Save the NIF files processed by --spell to <folder>, otherwise they are not saved", "folder" );
+		parser.addOption( noGuiOption );
+		parser.addOption( extractOption );
+		parser.addOption( threadsOption );
+		parser.addOption( spellOption );
+		parser.addOption( sanitizeOption );
+		parser.addOption( outputOption );
+
+		QCommandLineOption xmlCheckOption( "xml-check", "Check the files against the XML, and print the results as JSON Lines" );
+		QCommandLineOption timeoutOption( "timeout", "Give up on a file after <seconds> with --xml-check, the default is 60, 0 disables the timeout", "seconds", "60" );
+		parser.addOption( xmlCheckOption );
+		parser.addOption( timeoutOption );
+		QCommandLineOption blockOption( "block", "Only report files that contain blocks of <type> with --xml-check", "type" );
+		QCommandLineOption valueOption( "value", "Name of the field to compare with --match", "name" );
+		QCommandLineOption opOption( "op", "Operator to compare --value with --match: == != & \"& 1<<\" !& ^ $ !^ !$, the default is ==", "op" );
+		QCommandLineOption matchOption( "match", "Report blocks where the --value field matches <value>", "value" );
+		QCommandLineOption nifVersionOption( "nif-version", "Only check files of NIF version <version>", "version" );
+		QCommandLineOption headerOnlyOption( "header-only", "Only read the file headers with --xml-check" );
+		QCommandLineOption noErrorCheckOption( "no-error-check", "Do not check links and run the checker spells with --xml-check" );
+		QCommandLineOption noRecursiveOption( "no-recursive", "Do not search subfolders with --xml-check" );
+		parser.addOption( blockOption );
+		parser.addOption( valueOption );
+		parser.addOption( opOption );
+		parser.addOption( matchOption );
+		parser.addOption( nifVersionOption );
+		parser.addOption( headerOnlyOption );
+		parser.addOption( noErrorCheckOption );
+		parser.addOption( noRecursiveOption );
+
+		QCommandLineOption indexOption( "index", "Create or update the corpus index of a folder, or of \"game:<name>\"", "root" );
+		QCommandLineOption fieldOption( "field", "Index the values of a field with --index, can be repeated", "block/field" );
+		QCommandLineOption queryOption( "query", "Print the indexed files matching a term: block:<type>, resource:<path>, value:<block>/<field>=<value> "
+										"or value:<block>/<field>&<mask>, can be repeated and negated with '!'", "term" );
+		QCommandLineOption indexFileOption( "index-file", "Index file of --index and --query, the default is in the cache folder", "file" );
+		parser.addOption( indexOption );
+		parser.addOption( fieldOption );
+		parser.addOption( queryOption );
+		parser.addOption( indexFileOption );
+
+		QCommandLineOption benchmarkOption( "benchmark", "Measure the load and save performance over the files, and print the results as JSON" );
+		QCommandLineOption repeatOption( "repeat", "Number of times each file is loaded and saved by --benchmark", "count", "1" );
+		parser.addOption( benchmarkOption );
+		parser.addOption( repeatOption );
+
+		QCommandLineOption daemonOption( "daemon", "Keep the XML and resources loaded, and process requests sent with --send" );
+		QCommandLineOption sendOption( "send", "Send <command> for the files to a --daemon process: validate, spell, dump, extract-resources, status or shutdown", "command" );
+		QCommandLineOption serverOption( "server", "Name of the local socket of --daemon and --send", "name", defaultDaemonName );
+		parser.addOption( daemonOption );
+		parser.addOption( sendOption );
+		parser.addOption( serverOption );
+
+		QCommandLineOption selfTestOption( "self-test", "Run the built-in checks that do not need a GPU, run without -no-gui to also check the view" );
+		parser.addOption( selfTestOption );
+
+		parser.process( *app );
+
+		if ( parser.isSet( selfTestOption ) )
+			return runSelfTests( false );
+		if ( parser.isSet( extractOption ) )
+			return extractResources( parser.value( extractOption ), parser.positionalArguments(), parser.value( threadsOption ).toInt() );
+		if ( parser.isSet( benchmarkOption ) )
+			return runBenchmark( parser.positionalArguments(), parser.value( repeatOption ).toInt() );
+		if ( parser.isSet( indexOption ) ) {
+			return buildIndex( parser.value( indexOption ), parser.value( indexFileOption ), parser.values( fieldOption ),
+								parser.isSet( headerOnlyOption ), parser.value( threadsOption ).toInt() );
+		}
+		if ( parser.isSet( queryOption ) ) {
+			return queryIndex( parser.positionalArguments().value( 0 ), parser.value( indexFileOption ),
+								parser.values( queryOption ) );
+		}
+		if ( parser.isSet( daemonOption ) )
+			return runDaemon( parser.value( serverOption ), parser.value( threadsOption ).toInt() );
+		if ( parser.isSet( sendOption ) ) {
+			return sendToDaemon( parser.value( serverOption ), parser.value( sendOption ), parser.positionalArguments(),
+								parser.values( spellOption ), parser.isSet( sanitizeOption ), parser.value( outputOption ) );
+		}
+		if ( parser.isSet( xmlCheckOption ) )
+			return checkXml( parser, parser.value( threadsOption ).toInt(), parser.value( timeoutOption ).toInt() );
+		if ( parser.isSet( spellOption ) || parser.isSet( sanitizeOption ) ) {
+			return batchSpells( parser.values( spellOption ), parser.isSet( sanitizeOption ), parser.value( outputOption ),
+								parser.positionalArguments(), parser.value( threadsOption ).toInt() );
+		}
+
+		parser.showHelp( 1 );
 	}
 
 	return 0;
@@ -19,6 +19,22 @@ Message::Message() : QObject( nullptr )
 
 }
 
+//! In command line mode there are no message boxes, the messages are logged instead
+static bool logMessage( const QString & str, const QString & err, QMessageBox::Icon icon )
+{
+	if ( qobject_cast<QApplication *>( QCoreApplication::instance() ) )
+		return false;
+
+	QString msg = err.isEmpty() ? str : QString( "%1: %2" ).arg( str, err );
+	if ( icon == QMessageBox::Critical )
+		qCCritical( ns ).noquote() << msg;
+	else if ( icon == QMessageBox::Warning )
+		qCWarning( ns ).noquote() << msg;
+	else
+		qCInfo( ns ).noquote() << msg;
+	return true;
+}
+
 Message::~Message()
 {
 
@@ -27,6 +43,9 @@ Message::~Message()
 //! Static helper for message box without detail text
 QMessageBox* Message::message( QWidget * parent, const QString & str, QMessageBox::Icon icon )
 {
+	if ( logMessage( str, QString(), icon ) )
+		return nullptr;
+
 	auto msgBox = new QMessageBox( parent );
 	msgBox->setWindowFlags( msgBox->windowFlags() | Qt::Tool );
 	msgBox->setAttribute( Qt::WA_DeleteOnClose );
@@ -45,6 +64,9 @@ QMessageBox* Message::message( QWidget * parent, const QString & str, QMessageBo
 //! Static helper for message box with detail text
 QMessageBox* Message::message( QWidget * parent, const QString & str, const QString & err, QMessageBox::Icon icon )
 {
+	if ( logMessage( str, err, icon ) )
+		return nullptr;
+
 	if ( !parent )
 		parent = qApp->activeWindow();
 
@@ -166,6 +188,9 @@ void unregisterMessageBox( DetailsMessageBox * msgBox )
 
 void Message::append( QWidget * parent, const QString & str, const QString & err, QMessageBox::Icon icon )
 {
+	if ( logMessage( str, err, icon ) )
+		return;
+
 	if ( !parent )
 		parent = qApp->activeWindow();
 
@@ -42,6 +42,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QByteArray>
 #include <QColor>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QSettings>
@@ -377,6 +378,12 @@ void NifModel::clear()
 	filename = QString();
 	folder = QString();
 	bsVersion = 0;
+	blockOffsets.clear();
+	blockSizes.clear();
+	blockLoadTimes.clear();
+	lastBlockRead = -1;
+	lastBlockReadOffset = -1;
+	disconnect( pendingMeshImport );
 	root->killChildren();
 
 	NifData headerData = NifData( "NiHeader", "Header" );
@@ -1860,6 +1867,9 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 		if ( version >= 0x0303000d ) {
 			// read in the NiBlocks
 			QString prevblktyp;
+			QElapsedTimer blockTimer;
+			if ( blockTimingEnabled )
+				blockTimer.start();
 
 			for ( int c = 0; c < numblocks; c++ ) {
 				emit sigProgress( c + 1, numblocks );
@@ -1867,6 +1877,12 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 				if ( device.atEnd() )
 					throw tr( "unexpected EOF during load" );
 
+				qint64 blockPos = device.pos();
+				lastBlockRead = c;
+				lastBlockReadOffset = blockPos;
+				qint64 blockStart = blockTimingEnabled ? blockTimer.nsecsElapsed() : 0;
+				// the statistics are stored by block number in the model, which skips blocks not inserted
+				bool inserted = false;
 				QString blktyp;
 				quint32 size = UINT_MAX;
 				try
@@ -1924,6 +1940,7 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 					if ( isNiBlock( blktyp ) ) {
 						//qDebug() << "loading block" << c << ":" << blktyp );
 						QModelIndex newBlock = insertNiBlock( blktyp, -1 );
+						inserted = newBlock.isValid();
 
 						if ( !loadItem( root->child( c + 1 ), stream ) ) {
 							NifItem * child = root->child( c );
@@ -1975,6 +1992,12 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 					}
 				}
 
+				if ( inserted ) {
+					blockOffsets.append( blockPos );
+					blockSizes.append( device.pos() - blockPos );
+					if ( blockTimingEnabled )
+						blockLoadTimes.append( blockTimer.nsecsElapsed() - blockStart );
+				}
 				prevblktyp = blktyp;
 			}
 
@@ -2054,8 +2077,25 @@ bool NifModel::load( QIODevice & device, const char* fileName )
 	//qDebug() << t.msecsTo( QTime::currentTime() );
 	reset(); // notify model views that a significant change to the data structure has occurded
 
-	if ( getBSVersion() >= 170 && convertSFMeshes )
-		spMeshFileImport::processAllItems( this );
+	if ( getBSVersion() >= 170 && convertSFMeshes ) {
+		if ( Game::GameManager::can_wait_for_resources() || !gameResources->is_loading() ) {
+			spMeshFileImport::processAllItems( this );
+		} else {
+			// do not block the GUI thread until the archives are opened, convert the meshes when they are
+			pendingMeshImport = connect( Game::ResourceLoadNotifier::get(), &Game::ResourceLoadNotifier::loadFinished,
+											this, [this]() {
+				if ( gameResources->is_loading() )
+					return;
+				disconnect( pendingMeshImport );
+				spMeshFileImport::processAllItems( this );
+			}, Qt::QueuedConnection );
+			// the load may have finished before connecting
+			if ( !gameResources->is_loading() ) {
+				disconnect( pendingMeshImport );
+				spMeshFileImport::processAllItems( this );
+			}
+		}
+	}
 
 	return true;
 }
@@ -2168,7 +2208,14 @@ bool NifModel::loadHeaderOnly( const QString & fname )
 		return false;
 	}
 
-	NifIStream stream( this, &f );
+	return loadHeaderOnly( f );
+}
+
+bool NifModel::loadHeaderOnly( QIODevice & device )
+{
+	clear();
+
+	NifIStream stream( this, &device );
 
 	// read header
 	NifItem * header = getHeaderItem();
@@ -3083,16 +3130,19 @@ QString NifModel::findResourceFile( const QString & path, const char * archiveFo
 }
 
 bool NifModel::getResourceFile(
-	QByteArray & data, const QString & path, const char * archiveFolder, const char * extension ) const
+	QByteArray & data, const QString & path, const char * archiveFolder, const char * extension,
+	std::uint32_t flags ) const
 {
 	std::string	fullPath( Game::GameManager::get_full_path( path, archiveFolder, extension ) );
-	return gameResources->get_file( data, fullPath );
+	return gameResources->get_file( data, fullPath, flags );
 }
 
-CE2MaterialDB * NifModel::getCE2Materials() const
+CE2MaterialDB * NifModel::getCE2Materials( bool wait ) const
 {
 	if ( gameResources->sfMaterialDB_ID ) [[likely]]
 		return gameResources->sfMaterials;
+	if ( !wait && gameResources->is_loading() )
+		return nullptr;
 	return gameResources->init_materials();
 }
 
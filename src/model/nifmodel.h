@@ -121,6 +121,8 @@ public:
 	bool loadAndMapLinks( QIODevice & device, const QModelIndex &, const QMap<qint32, qint32> & map );
 	//! Loads the header from a filename
 	bool loadHeaderOnly( const QString & fname );
+	//! Loads the header from a QIODevice
+	bool loadHeaderOnly( QIODevice & device );
 
 	//! Returns the the estimated file offset of the model index
 	int fileOffset( const QModelIndex & ) const;
@@ -221,6 +223,19 @@ protected:
 public:
 	//! Get the number of NiBlocks
 	int getBlockCount() const;
+	//! Get the file offset of a block read by the last load(), or -1 if it is not known
+	qint64 getBlockOffset( int blockNum ) const;
+	//! Get the number of bytes read for a block by the last load(), or -1 if it is not known
+	qint64 getBlockSize( int blockNum ) const;
+	//! Get the number in the file of the last block the last load() started reading, or -1.
+	// Unlike getBlockCount() - 1, this also counts blocks that could not be inserted.
+	int getLastBlockRead() const { return lastBlockRead; }
+	//! Get the file offset of the block returned by getLastBlockRead(), or -1
+	qint64 getLastBlockReadOffset() const { return lastBlockReadOffset; }
+	//! Record the time spent loading each block in load(), for benchmarking
+	void setBlockTimingEnabled( bool enabled ) { blockTimingEnabled = enabled; }
+	//! Get the time in nanoseconds spent loading a block by the last load() with block timing enabled, or -1
+	qint64 getBlockLoadTime( int blockNum ) const;
 
 	//! Get the numerical index (or link) of the block an item belongs to.
 	// Return -1 if the item is the root or header or footer or null.
@@ -705,6 +720,18 @@ protected:
 	QHash<int, QList<int> > parentLinks;
 	QList<int> rootLinks;
 
+	//! File offsets and sizes of the blocks read by load(), by block number in the model
+	QVector<qint64> blockOffsets;
+	QVector<qint64> blockSizes;
+	//! Load times of the blocks in nanoseconds, if blockTimingEnabled is set
+	QVector<qint64> blockLoadTimes;
+	bool blockTimingEnabled = false;
+	//! Number in the file and offset of the last block load() started reading, including blocks not inserted
+	int lastBlockRead = -1;
+	qint64 lastBlockReadOffset = -1;
+	//! Converts Starfield meshes when the archives being loaded in the background are ready, see load()
+	QMetaObject::Connection pendingMeshImport;
+
 	bool lockUpdates;
 
 	enum UpdateType
@@ -743,16 +770,18 @@ public:
 	QString findResourceFile( const QString & path, const char * archiveFolder, const char * extension ) const;
 
 	//! Find and load resource file to 'data'. The return value is true on success.
-	inline bool getResourceFile( QByteArray & data, const std::string_view & fullPath ) const
+	// 'flags' is a combination of Game::GameManager::FileFlags.
+	inline bool getResourceFile( QByteArray & data, const std::string_view & fullPath, std::uint32_t flags = 0 ) const
 	{
-		return gameResources->get_file( data, fullPath );
+		return gameResources->get_file( data, fullPath, flags );
 	}
 	bool getResourceFile(
-		QByteArray & data, const QString & path, const char * archiveFolder, const char * extension ) const;
+		QByteArray & data, const QString & path, const char * archiveFolder, const char * extension,
+		std::uint32_t flags = 0 ) const;
 
 	//! Return pointer to Starfield material database, loading it first if necessary.
-	// On error, nullptr is returned.
-	CE2MaterialDB * getCE2Materials() const;
+	// On error, or if 'wait' is false and the database is still being loaded in the background, nullptr is returned.
+	CE2MaterialDB * getCE2Materials( bool wait = true ) const;
 
 	//! Returns a unique ID for the currently loaded material database (0 if none).
 	// Previously returned material pointers become invalid when this value changes.
@@ -926,6 +955,21 @@ inline int NifModel::getBlockCount() const
 	return std::max( lastBlockRow() - firstBlockRow() + 1, 0 );
 }
 
+inline qint64 NifModel::getBlockOffset( int blockNum ) const
+{
+	return ( blockNum >= 0 && blockNum < blockOffsets.size() ) ? blockOffsets.at( blockNum ) : -1;
+}
+
+inline qint64 NifModel::getBlockSize( int blockNum ) const
+{
+	return ( blockNum >= 0 && blockNum < blockSizes.size() ) ? blockSizes.at( blockNum ) : -1;
+}
+
+inline qint64 NifModel::getBlockLoadTime( int blockNum ) const
+{
+	return ( blockNum >= 0 && blockNum < blockLoadTimes.size() ) ? blockLoadTimes.at( blockNum ) : -1;
+}
+
 inline int NifModel::getBlockNumber( const QModelIndex & index ) const
 {
 	return getBlockNumber( getItem(index) );
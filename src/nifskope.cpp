@@ -33,6 +33,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "nifskope.h"
 #include "ui_nifskope.h"
 
+#include "gamemanager.h"
 #include "glview.h"
 #include "message.h"
 #include "spellbook.h"
@@ -71,6 +72,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QTreeView>
 #include <QStandardItemModel>
 
+#include <functional>
+
 #include "libfo76utils/src/ba2file.hpp"
 #include "bsamodel.h"
 
@@ -235,7 +238,31 @@ NifSkope::NifSkope()
 	connect( bsaView, &QTreeView::doubleClicked, this, &NifSkope::openArchiveFile );
 
 	bsaModel = new BSAModel( this );
-	bsaProxyModel = new BSAProxyModel( this );
+	bsaView->header()->setSortIndicator( 0, Qt::AscendingOrder );
+
+	// Filter, the model runs the filter on a worker thread
+	auto bsaFilterTimer = new QTimer( this );
+	bsaFilterTimer->setSingleShot( true );
+	connect( ui->bsaFilter, &QLineEdit::textChanged, [bsaFilterTimer]() { bsaFilterTimer->start( 300 ); } );
+	connect( bsaFilterTimer, &QTimer::timeout, [this]() { bsaModel->setFilter( ui->bsaFilter->text() ); } );
+	connect( ui->bsaFilenameOnly, &QCheckBox::toggled, bsaModel, &BSAModel::setFilterByNameOnly );
+	connect( bsaModel, &BSAModel::filterApplied, this, [this]( bool filtered ) {
+		// Expand the results unless there are too many of them
+		if ( !filtered || bsaModel->filterMatches() > 5000 )
+			return;
+		std::function<void (const QModelIndex &)> expandFolder = [this, &expandFolder]( const QModelIndex & parent ) {
+			while ( bsaModel->canFetchMore( parent ) )
+				bsaModel->fetchMore( parent );
+			for ( int i = 0; i < bsaModel->rowCount( parent ); i++ ) {
+				QModelIndex child = bsaModel->index( i, 0, parent );
+				if ( bsaModel->hasChildren( child ) ) {
+					expandFolder( child );
+					bsaView->expand( child );
+				}
+			}
+		};
+		expandFolder( QModelIndex() );
+	} );
 
 	// Empty Model for swapping out before model fill
 	emptyModel = new QStandardItemModel( this );
@@ -279,6 +306,20 @@ NifSkope::NifSkope()
 		qApp->processEvents();
 	} );
 
+	// Show the progress of opening the game archives in the background
+	auto	resourceNotifier = Game::ResourceLoadNotifier::get();
+	connect( resourceNotifier, &Game::ResourceLoadNotifier::loadProgress, this, [this]( const QString & msg, int c, int m ) {
+		if ( msg.isEmpty() )
+			ui->statusbar->clearMessage();
+		else
+			ui->statusbar->showMessage( QString( "%1 (%2/%3)" ).arg( msg ).arg( c + 1 ).arg( m ) );
+	} );
+	// Materials are skipped while rendering until they are loaded, and archived meshes and textures that
+	// are not in the saved index are not read by the GUI thread, so the scene is compiled again to retry them
+	connect( resourceNotifier, &Game::ResourceLoadNotifier::loadFinished, ogl, [this]() {
+		ogl->modelChanged();
+	} );
+
 	/*
 	 * UI Init
 	 * **********************
@@ -879,8 +920,6 @@ void NifSkope::openArchive( const QString & archive )
 {
 	// Clear memory from previously opened archives
 	bsaModel->clear();
-	bsaProxyModel->invalidate();
-	bsaProxyModel->setSourceModel( emptyModel );
 	bsaView->setModel( emptyModel );
 	bsaView->setSortingEnabled( false );
 
@@ -913,32 +952,22 @@ void NifSkope::openArchive( const QString & archive )
 	{
 		setCurrentArchive( isArchiveFolder );
 
-		// Models
-		bsaModel->init();
-
-		// Populate model from BSA
-		bsaModel->fillModel( currentArchive, "meshes" );
-
-		if ( bsaModel->rowCount() == 0 ) {
+		// Populate model from BSA, the model is sorted by name with folders first
+		if ( !bsaModel->fillModel( currentArchive, "meshes", { ".nif", ".bto", ".btr" } ) ) {
 			qCWarning( nsIo ) << "The BSA does not contain any meshes.";
 			clearCurrentArchive();
 			return;
 		}
 
-		// Set proxy and view only after filling source model
-		bsaProxyModel->setSourceModel( bsaModel );
-		bsaView->setModel( bsaProxyModel );
+		// Set view only after filling the model, the sort order selected in the header is applied
+		// by the same filter job as the filter below
+		bsaView->setModel( bsaModel );
 		bsaView->setSortingEnabled( true );
 
 		bsaView->hideColumn( 1 );
 		bsaView->setColumnWidth( 0, 300 );
 		bsaView->setColumnWidth( 2, 50 );
 
-		// Sort proxy after model/view is populated
-		bsaProxyModel->sort( 0, Qt::AscendingOrder );
-		bsaProxyModel->setFiletypes( { ".nif", ".bto", ".btr" } );
-		bsaProxyModel->resetFilter();
-
 		// Set filename label
 		ui->bsaName->setText( currentArchiveNames.back() );
 
@@ -948,28 +977,9 @@ void NifSkope::openArchive( const QString & archive )
 		// Bring tab to front
 		dBrowser->raise();
 
-		// Filter
-		auto filterTimer = new QTimer( this );
-		filterTimer->setSingleShot( true );
-
-		connect( ui->bsaFilter, &QLineEdit::textChanged, [filterTimer]() { filterTimer->start( 300 ); } );
-		connect( filterTimer, &QTimer::timeout, [this]() {
-			auto text = ui->bsaFilter->text();
-
-			bsaProxyModel->setFilterRegExp( QRegExp( text, Qt::CaseInsensitive, QRegExp::Wildcard ) );
-			bsaView->expandAll();
-
-			if ( text.isEmpty() ) {
-				bsaView->collapseAll();
-				bsaProxyModel->resetFilter();
-			}
-
-		} );
-
-		connect( ui->bsaFilenameOnly, &QCheckBox::toggled, bsaProxyModel, &BSAProxyModel::setFilterByNameOnly );
-
-		// Update filter when switching open archives
-		filterTimer->start( 0 );
+		// Update filter when switching open archives, the changes are batched into a single filter job
+		bsaModel->setFilterByNameOnly( ui->bsaFilenameOnly->isChecked() );
+		bsaModel->setFilter( ui->bsaFilter->text() );
 	}
 }
 
@@ -71,7 +71,6 @@ class SpellBook;
 class FSArchiveHandler;
 class BA2File;
 class BSAModel;
-class BSAProxyModel;
 class QStandardItemModel;
 class QAction;
 class QActionGroup;
@@ -444,7 +443,6 @@ private:
 	//QAction * idxBackAction;
 
 	BSAModel * bsaModel;
-	BSAProxyModel * bsaProxyModel;
 	QStandardItemModel * emptyModel;
 
 	QMenu * mRecentArchiveFiles;
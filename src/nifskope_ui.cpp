@@ -843,6 +843,9 @@ void NifSkope::onLoadComplete( bool success, QString & fname )
 
 		enableUi();
 
+		// open the archives of this game in the background at the next startup
+		Game::GameManager::set_last_game( Game::GameManager::get_game( nif ) );
+
 	} else {
 		// File failed to load
 		Message::append( this, NifModel::tr( readFail ),
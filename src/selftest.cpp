@@ -0,0 +1,159 @@
+#include "selftest.h"
+#include "glview.h"
+#include "nifskope.h"
+#include "gl/bvh.h"
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTimer>
+
+#include <cmath>
+
+
+namespace SelfTest
+{
+
+int rayCast( QTextStream & err )
+{
+	int failures = 0;
+
+	// two unit squares facing +Z at z = 0 and z = -2, and a 10 x 10 grid of unit squares at z = -5,
+	// x and y from 10 to 20, so that the tree has internal nodes
+	QVector<Vector3> verts;
+	QVector<Triangle> tris;
+	for ( float z : { 0.0f, -2.0f } ) {
+		quint16 v = quint16( verts.count() );
+		verts << Vector3( 0, 0, z ) << Vector3( 1, 0, z ) << Vector3( 1, 1, z ) << Vector3( 0, 1, z );
+		tris << Triangle( v, v + 1, v + 2 ) << Triangle( v, v + 2, v + 3 );
+	}
+	const int gridBase = verts.count();
+	for ( int y = 0; y <= 10; y++ ) {
+		for ( int x = 0; x <= 10; x++ )
+			verts << Vector3( float( 10 + x ), float( 10 + y ), -5.0f );
+	}
+	for ( int y = 0; y < 10; y++ ) {
+		for ( int x = 0; x < 10; x++ ) {
+			quint16 a = quint16( gridBase + y * 11 + x );
+			quint16 b = a + 1, c = a + 12, d = a + 11;
+			tris << Triangle( a, b, c ) << Triangle( a, c, d );
+		}
+	}
+
+	BVH tree;
+	tree.build( triangleBounds( tris, verts ) );
+
+	auto check = [&]( const char * name, const Vector3 & origin, const Vector3 & dir, float tMax,
+						int expTriangle, int expVertex, float expDist ) {
+		int triangle = -1, vertex = -1;
+		float t = tMax;
+		bool hit = rayCastTriangles( tree, tris, verts, Ray( origin, dir ), t, triangle, vertex );
+		bool ok;
+		if ( expTriangle < 0 )
+			ok = !hit && t == tMax;
+		else
+			ok = hit && triangle == expTriangle && vertex == expVertex && std::fabs( t - expDist ) < 1.0e-4f;
+		if ( !ok ) {
+			failures++;
+			err << "FAIL ray cast " << name << ": hit " << hit << ", triangle " << triangle << ", vertex " << vertex
+				<< ", distance " << t << Qt::endl;
+		}
+	};
+
+	// the nearest of the two squares, closest to vertex 1 at ( 1, 0 )
+	check( "front", Vector3( 0.75f, 0.25f, 5.0f ), Vector3( 0, 0, -1 ), FLT_MAX, 0, 1, 5.0f );
+	// the back of the first square, both sides are hit
+	check( "back facing", Vector3( 0.25f, 0.75f, -1.0f ), Vector3( 0, 0, 1 ), FLT_MAX, 1, 3, 1.0f );
+	// the square at z = 0 is behind the origin and must not be hit
+	check( "behind origin", Vector3( 0.75f, 0.25f, -1.0f ), Vector3( 0, 0, -1 ), FLT_MAX, 2, 5, 1.0f );
+	// cell ( 2, 5 ) of the grid, upper triangle, closest to its corner at ( 12, 16 )
+	check( "grid", Vector3( 12.3f, 15.6f, 0.0f ), Vector3( 0, 0, -1 ), FLT_MAX,
+			4 + 2 * ( 5 * 10 + 2 ) + 1, gridBase + 6 * 11 + 2, 5.0f );
+	// outside of all triangles
+	check( "miss", Vector3( 5.0f, 5.0f, 5.0f ), Vector3( 0, 0, -1 ), FLT_MAX, -1, -1, 0.0f );
+	// pointing away from the mesh
+	check( "miss away", Vector3( 0.75f, 0.25f, 5.0f ), Vector3( 0, 0, 1 ), FLT_MAX, -1, -1, 0.0f );
+	// the hit is further than the maximum distance
+	check( "miss tMax", Vector3( 0.75f, 0.25f, 5.0f ), Vector3( 0, 0, -1 ), 4.0f, -1, -1, 0.0f );
+
+	return failures;
+}
+
+//! Processes events for 'msecs'
+static void idle( int msecs )
+{
+	QEventLoop loop;
+	QTimer::singleShot( msecs, &loop, &QEventLoop::quit );
+	loop.exec();
+}
+
+//! Processes events until the view has drawn no frames for 500 ms, or for at most 10 seconds
+static void settle( const GLView * view )
+{
+	QElapsedTimer t;
+	t.start();
+	do {
+		quint64 n = view->frameCount();
+		idle( 500 );
+		if ( view->frameCount() == n )
+			break;
+	} while ( t.elapsed() < 10000 );
+}
+
+int idleRedraw( const QString & file, int msecs, QTextStream & err )
+{
+	int failures = 0;
+
+	NifSkope * window = NifSkope::createWindow( file );
+	GLView * view = window->getGLView();
+
+	if ( !file.isEmpty() ) {
+		// createWindow() queues the load, wait for it to complete
+		QEventLoop loop;
+		bool loaded = false;
+		QObject::connect( window, &NifSkope::completeLoading, &loop, [&loop, &loaded]( bool ok, QString & ) {
+			loaded = ok;
+			loop.quit();
+		} );
+		QTimer::singleShot( 60000, &loop, &QEventLoop::quit );
+		loop.exec();
+		if ( !loaded ) {
+			err << "FAIL idle redraw: could not load " << file << Qt::endl;
+			window->close();
+			return 1;
+		}
+	}
+
+	// let the initial frames after showing the window and compiling the scene be drawn
+	settle( view );
+
+	quint64 n = view->frameCount();
+	idle( msecs );
+	quint64 drawn = view->frameCount() - n;
+	if ( view->isAnimating() ) {
+		if ( !drawn ) {
+			failures++;
+			err << "FAIL idle redraw: no frames drawn in " << msecs << " ms while animating" << Qt::endl;
+		}
+	} else if ( drawn ) {
+		failures++;
+		err << "FAIL idle redraw: " << drawn << " frame(s) drawn in " << msecs << " ms of a static scene" << Qt::endl;
+	}
+
+	// a minimized view is paused, and must not redraw even while animating
+	window->showMinimized();
+	settle( view );
+
+	n = view->frameCount();
+	idle( msecs );
+	drawn = view->frameCount() - n;
+	if ( drawn ) {
+		failures++;
+		err << "FAIL idle redraw: " << drawn << " frame(s) drawn in " << msecs << " ms while minimized" << Qt::endl;
+	}
+
+	window->close();
+
+	return failures;
+}
+
+}
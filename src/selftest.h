@@ -0,0 +1,24 @@
+#ifndef SELFTEST_H_INCLUDED
+#define SELFTEST_H_INCLUDED
+
+#include <QString>
+#include <QTextStream>
+
+
+//! Built-in checks run with --self-test
+/*!
+ * Each check prints a line for every failure to 'err', and returns the number of failures.
+ */
+namespace SelfTest
+{
+	//! Ray casts against a triangle BVH, as used for picking, without a GPU
+	int rayCast( QTextStream & err );
+
+	//! Opens 'file' in a new window and checks that the view draws no frames while idle for 'msecs'
+	/*! Unless an animation is playing, the frame count must not grow with no input. Once the window is
+	 *  minimized, it must not grow even if the file is animated. Needs a GUI application.
+	 */
+	int idleRedraw( const QString & file, int msecs, QTextStream & err );
+}
+
+#endif
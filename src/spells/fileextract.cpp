@@ -1,12 +1,18 @@
+#include "fileextract.h"
+#include "message.h"
 #include "spellbook.h"
 
 #include <QDialog>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QGridLayout>
 #include <QLabel>
 #include <QProgressBar>
+#include <QProgressDialog>
 #include <QPushButton>
 #include <QSettings>
+#include <QThread>
+#include <QThreadPool>
 #include <QIODevice>
 #include <QBuffer>
 #include <QCryptographicHash>
@@ -18,6 +24,9 @@
 #include "io/nifstream.h"
 #include "qtcompat.h"
 
+#include <atomic>
+#include <memory>
+
 #ifdef Q_OS_WIN32
 #  include <direct.h>
 #else
@@ -255,54 +264,187 @@ QModelIndex spExtractAllResources::cast( NifModel * nif, const QModelIndex & ind
 	if ( !nif )
 		return index;
 
-	std::set< std::string >	fileSet;
-	for ( int b = 0; b < nif->getBlockCount(); b++ ) {
-		const NifItem * item = nif->getBlockItem( qint32(b) );
-		if ( item )
-			findPaths( fileSet, nif, item );
-	}
-	if ( fileSet.begin() == fileSet.end() )
-		return index;
-
 	std::string	dstPath( spResourceFileExtract::getOutputDirectory() );
 	if ( dstPath.empty() )
 		return index;
 
-	std::string	matFileData;
-	std::string	fullPath;
-	QByteArray	fileData;
+	ResourceExtractor	extractor( QString::fromStdString( dstPath ) );
 	try {
-		for ( std::set< std::string >::const_iterator i = fileSet.begin(); i != fileSet.end(); i++ ) {
-			matFileData.clear();
-			if ( nif->getBSVersion() >= 170 && i->ends_with( ".mat" ) && i->starts_with( "materials/" ) ) {
-				CE2MaterialDB *	materials = nif->getCE2Materials();
-				if ( materials ) {
-					(void) materials->loadMaterial( *i );
-					materials->getJSONMaterial( matFileData, *i );
-				}
-				if ( matFileData.empty() )
-					continue;
-			} else if ( nif->findResourceFile( QString::fromStdString( *i ), nullptr, nullptr ).isEmpty() ) {
-				continue;
-			}
-
-			fullPath = dstPath;
-			fullPath += *i;
-			if ( !matFileData.empty() ) {
-				matFileData += '\n';
-				spResourceFileExtract::writeFileWithPath( fullPath, matFileData.c_str(), qsizetype(matFileData.length()) );
-			} else if ( nif->getResourceFile( fileData, *i ) ) {
-				spResourceFileExtract::writeFileWithPath( fullPath, fileData.data(), fileData.size() );
-			}
-		}
+		extractor.addModel( nif );
 	} catch ( std::exception & e ) {
 		QMessageBox::critical( nullptr, "NifSkope error", QString("Error extracting file: %1" ).arg( e.what() ) );
+		return index;
 	}
+	if ( !extractor.queued() )
+		return index;
+
+	QProgressDialog	dlg( Spell::tr( "Extracting resource files..." ), QString(), 0, extractor.queued() );
+	dlg.setWindowModality( Qt::ApplicationModal );
+	dlg.setMinimumDuration( 500 );
+	ResourceExtractor::Stats	stats = extractor.run( [&dlg]( int done, int total ) {
+		dlg.setMaximum( total );
+		dlg.setValue( done );
+		QCoreApplication::processEvents();
+	} );
+	dlg.close();
+
+	Message::info( nullptr, Spell::tr( "Resource files extracted" ), stats.toString() );
 	return index;
 }
 
 REGISTER_SPELL( spExtractAllResources )
 
+ResourceExtractor::Stats & ResourceExtractor::Stats::operator+=( const Stats & s )
+{
+	files += s.files;
+	written += s.written;
+	unchanged += s.unchanged;
+	missing += s.missing;
+	failed += s.failed;
+	bytes += s.bytes;
+	bytesWritten += s.bytesWritten;
+	msecs += s.msecs;
+	return *this;
+}
+
+QString ResourceExtractor::Stats::toString() const
+{
+	double	seconds = double( std::max< qint64 >( msecs, 1 ) ) / 1000.0;
+	double	megabytes = double( bytes ) / 1048576.0;
+	return QString( "%1 files, %2 MB in %3 s (%4 MB/s)\n%5 written, %6 unchanged, %7 not found, %8 failed" )
+			.arg( files ).arg( megabytes, 0, 'f', 1 ).arg( seconds, 0, 'f', 2 ).arg( megabytes / seconds, 0, 'f', 1 )
+			.arg( written ).arg( unchanged ).arg( missing ).arg( failed );
+}
+
+ResourceExtractor::ResourceExtractor( const QString & outputFolder, int threads )
+	: outputFolder( QString( outputFolder ).replace( QChar('\\'), QChar('/') ).toStdString() ),
+		threadCount( threads > 0 ? threads : QThread::idealThreadCount() )
+{
+	if ( !this->outputFolder.empty() && !this->outputFolder.ends_with( '/' ) )
+		this->outputFolder += '/';
+}
+
+void ResourceExtractor::findResourcePaths( std::set< std::string > & fileSet, NifModel * nif )
+{
+	for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+		const NifItem * item = nif->getBlockItem( qint32(b) );
+		if ( item )
+			spExtractAllResources::findPaths( fileSet, nif, item );
+	}
+}
+
+void ResourceExtractor::addModel( NifModel * nif )
+{
+	std::set< std::string >	fileSet;
+	findResourcePaths( fileSet, nif );
+
+	Game::GameManager::GameResources &	resources = Game::GameManager::getNIFResources( nif );
+	// models in different data folders may use different files with the same path, the resources are identified
+	// by their game and data paths, as they can be deleted with the models between runs and their address reused
+	std::string	resourcesKey( QString( QString::number( int( resources.game ) ) + QChar( '\n' )
+										+ resources.dataPaths.join( QChar( '\n' ) ) ).toStdString() );
+	for ( const auto & i : fileSet ) {
+		if ( !knownFiles.emplace( resourcesKey, i ).second )
+			continue;
+		Job	job;
+		job.path = i;
+		job.resources = &resources;
+		if ( nif->getBSVersion() >= 170 && i.ends_with( ".mat" ) && i.starts_with( "materials/" ) ) {
+			// the material database is not thread-safe
+			CE2MaterialDB *	materials = nif->getCE2Materials();
+			if ( materials ) {
+				(void) materials->loadMaterial( i );
+				materials->getJSONMaterial( job.textData, i );
+			}
+			if ( job.textData.empty() )
+				continue;
+			job.textData += '\n';
+		}
+		jobs.push_back( std::move( job ) );
+	}
+}
+
+//! Returns true if 'fileName' exists and has the same size and hash as 'buf'
+static bool isFileUnchanged( const std::string & fileName, const char * buf, qsizetype bufSize )
+{
+	QFile	f( QString::fromStdString( fileName ) );
+	if ( f.size() != bufSize || !f.open( QIODevice::ReadOnly ) )
+		return false;
+	QCryptographicHash	h( QCryptographicHash::Sha1 );
+	if ( !h.addData( &f ) )
+		return false;
+	return h.result() == QCryptographicHash::hash( QByteArray::fromRawData( buf, int( bufSize ) ), QCryptographicHash::Sha1 );
+}
+
+ResourceExtractor::Stats ResourceExtractor::run( const std::function< void ( int, int ) > & progress )
+{
+	QElapsedTimer	timer;
+	timer.start();
+
+	std::atomic< int >	done = 0, written = 0, unchanged = 0, missing = 0, failed = 0;
+	std::atomic< qint64 >	bytes = 0, bytesWritten = 0;
+	int	total = int( jobs.size() );
+
+	QThreadPool	pool;
+	pool.setMaxThreadCount( threadCount );
+	for ( const Job & job : jobs ) {
+		pool.start( [&, job]() {
+			QByteArray	fileData;
+			const char *	buf = job.textData.c_str();
+			qsizetype	bufSize = qsizetype( job.textData.length() );
+			if ( job.textData.empty() ) {
+				if ( job.resources->find_file( job.path ).isEmpty() ) {
+					missing++;
+					done++;
+					return;
+				}
+				// files are only used once here, do not evict the files cached for rendering
+				if ( !job.resources->get_file( fileData, job.path, Game::GameManager::FileCacheNoInsert ) ) {
+					failed++;
+					done++;
+					return;
+				}
+				buf = fileData.constData();
+				bufSize = fileData.size();
+			}
+			bytes += bufSize;
+
+			std::string	fullPath( outputFolder + job.path );
+			try {
+				if ( isFileUnchanged( fullPath, buf, bufSize ) ) {
+					unchanged++;
+				} else {
+					spResourceFileExtract::writeFileWithPath( fullPath, buf, bufSize );
+					written++;
+					bytesWritten += bufSize;
+				}
+			} catch ( std::exception & e ) {
+				qWarning() << "Error extracting file" << fullPath.c_str() << ":" << e.what();
+				failed++;
+			}
+			done++;
+		} );
+	}
+	while ( !pool.waitForDone( 100 ) ) {
+		if ( progress )
+			progress( done, total );
+	}
+	if ( progress )
+		progress( total, total );
+	jobs.clear();
+
+	Stats	s;
+	s.files = total;
+	s.written = written;
+	s.unchanged = unchanged;
+	s.missing = missing;
+	s.failed = failed;
+	s.bytes = bytes;
+	s.bytesWritten = bytesWritten;
+	s.msecs = timer.elapsed();
+	return s;
+}
+
 //! Extract all Starfield materials
 class spExtractAllMaterials final : public Spell
 {
@@ -526,34 +668,149 @@ public:
 	}
 
 	static bool processItem( NifModel * nif, NifItem * item );
+	//! Convert all external geometry, files that fail to load are reported with NifModel::logMessage()
 	static bool processAllItems( NifModel * nif );
 	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
+
+private:
+	//! Mesh file data parsed into a separate model, which can be done on any thread
+	struct DecodedMesh
+	{
+		std::unique_ptr< NifModel >	model;
+		const NifItem *	meshData = nullptr;
+	};
+
+	//! Returns false if 'item' is not a BSGeometry block with external geometry, otherwise stores the mesh paths per LOD
+	static bool getMeshPaths( NifModel * nif, NifItem * item, QString * meshPaths );
+	//! Returns the header of 'nif' in file format, for decodeMeshData()
+	static QByteArray saveHeader( const NifModel * nif );
+	//! Parse a mesh file into a model created with 'header', and move the model to the thread of 'nif'
+	static bool decodeMeshData( DecodedMesh & mesh, const NifModel * nif, const QByteArray & header, const QByteArray & data );
+	//! Copy the values of a decoded mesh to 'dst', this is the same as NifModel::loadItem() without parsing
+	static bool copyItem( NifModel * nif, NifItem * dst, const NifItem * src );
+	//! Loads the decoded mesh data of all LODs into the model, and sets the internal geometry flag
+	static void loadMeshData( NifModel * nif, NifItem * item, const DecodedMesh * meshes );
 };
 
-bool spMeshFileImport::processItem( NifModel * nif, NifItem * item )
+bool spMeshFileImport::getMeshPaths( NifModel * nif, NifItem * item, QString * meshPaths )
 {
-	quint32	flags;
-	if ( !( item && item->name() == "BSGeometry" && ( (flags = nif->get<quint32>(item, "Flags")) & 0x0200 ) == 0 ) )
+	if ( !( item && item->name() == "BSGeometry" && ( nif->get<quint32>(item, "Flags") & 0x0200 ) == 0 ) )
 		return false;
 
-	QByteArray	meshData[4];
-
 	auto	meshesIndex = nif->getIndex( item, "Meshes" );
 	if ( meshesIndex.isValid() ) {
 		for ( int l = 0; l < 4; l++ ) {
 			auto	meshIndex = QModelIndex_child( meshesIndex, l );
 			if ( !( meshIndex.isValid() && nif->get<bool>(meshIndex, "Has Mesh") ) )
 				continue;
-			QString	meshPath = nif->get<QString>( nif->getIndex( meshIndex, "Mesh" ), "Mesh Path" );
-			if ( meshPath.isEmpty() )
-				continue;
-			if ( !nif->getResourceFile( meshData[l], meshPath, "geometries/", ".mesh" ) ) {
-				QMessageBox::critical( nullptr, "NifSkope error", QString("Failed to load mesh file '%1'" ).arg( meshPath ) );
-				return false;
+			meshPaths[l] = nif->get<QString>( nif->getIndex( meshIndex, "Mesh" ), "Mesh Path" );
+		}
+	}
+	return true;
+}
+
+bool spMeshFileImport::processItem( NifModel * nif, NifItem * item )
+{
+	QString	meshPaths[4];
+	if ( !getMeshPaths( nif, item, meshPaths ) )
+		return false;
+
+	QByteArray	header( saveHeader( nif ) );
+	DecodedMesh	meshes[4];
+	for ( int l = 0; l < 4; l++ ) {
+		if ( meshPaths[l].isEmpty() )
+			continue;
+		QByteArray	meshData;
+		if ( !( nif->getResourceFile( meshData, meshPaths[l], "geometries/", ".mesh" )
+				&& decodeMeshData( meshes[l], nif, header, meshData ) ) ) {
+			QMessageBox::critical( nullptr, "NifSkope error", QString("Failed to load mesh file '%1'" ).arg( meshPaths[l] ) );
+			return false;
+		}
+	}
+
+	loadMeshData( nif, item, meshes );
+	return true;
+}
+
+QByteArray spMeshFileImport::saveHeader( const NifModel * nif )
+{
+	QBuffer	buf;
+	buf.open( QIODevice::WriteOnly );
+	NifOStream	stream( nif, &buf );
+	nif->saveItem( nif->getHeaderItem(), stream );
+	return buf.data();
+}
+
+bool spMeshFileImport::decodeMeshData( DecodedMesh & mesh, const NifModel * nif, const QByteArray & header, const QByteArray & data )
+{
+	// the model has the same header, so that the conditions of the mesh data are evaluated in the same way
+	auto	tmp = std::make_unique< NifModel >();
+	tmp->setMessageMode( BaseModel::MSG_TEST );
+	QBuffer	headerBuf;
+	headerBuf.setData( header );
+	headerBuf.open( QIODevice::ReadOnly );
+	NifIStream	headerStream( tmp.get(), &headerBuf );
+	if ( !tmp->loadHeader( tmp->getHeaderItem(), headerStream ) )
+		return false;
+
+	NifData	meshDataType( "Mesh Data", "BSMeshData" );
+	meshDataType.setIsCompound( true );
+	meshDataType.setIsConditionless( true );
+	tmp->insertType( tmp->root, meshDataType );
+	NifItem *	meshItem = tmp->root->child( tmp->root->childCount() - 1 );
+	if ( !( meshItem && meshItem->hasStrType( "BSMeshData" ) ) )
+		return false;
+
+	QBuffer	meshBuf;
+	meshBuf.setData( data );
+	meshBuf.open( QIODevice::ReadOnly );
+	NifIStream	meshStream( tmp.get(), &meshBuf );
+	if ( !tmp->loadItem( meshItem, meshStream ) )
+		return false;
+
+	tmp->resetState();
+	if ( tmp->thread() != nif->thread() )
+		tmp->moveToThread( nif->thread() );
+	mesh.meshData = meshItem;
+	mesh.model = std::move( tmp );
+	return true;
+}
+
+bool spMeshFileImport::copyItem( NifModel * nif, NifItem * dst, const NifItem * src )
+{
+	for ( int i = 0; i < dst->childCount(); i++ ) {
+		NifItem *	child = dst->child( i );
+		const NifItem *	srcChild = src->child( i );
+		if ( !srcChild )
+			return false;
+
+		child->invalidateCondition();
+
+		if ( child->isAbstract() )
+			continue;
+
+		if ( nif->evalCondition( child ) ) {
+			if ( child->isArray() ) {
+				if ( !nif->updateArraySize( child ) )
+					return false;
+				if ( !copyItem( nif, child, srcChild ) )
+					return false;
+			} else if ( child->childCount() > 0 ) {
+				if ( !copyItem( nif, child, srcChild ) )
+					return false;
+			} else {
+				child->value() = srcChild->value();
 			}
 		}
 	}
 
+	return true;
+}
+
+void spMeshFileImport::loadMeshData( NifModel * nif, NifItem * item, const DecodedMesh * meshes )
+{
+	quint32	flags = nif->get<quint32>( item, "Flags" );
+
 	item->invalidateVersionCondition();
 	item->invalidateCondition();
 	nif->set<quint32>( item, "Flags", flags | 0x0200U );
@@ -565,26 +822,81 @@ bool spMeshFileImport::processItem( NifModel * nif, NifItem * item )
 			continue;
 
 		NifItem *	meshItem = nif->getItem( nif->getIndex( meshIndex, "Mesh" ), "Mesh Data" );
-		if ( !meshItem )
+		if ( !( meshItem && meshes[l].meshData ) )
 			continue;
 
-		QBuffer	meshBuf;
-		meshBuf.setData( meshData[l] );
-		meshBuf.open( QIODevice::ReadOnly );
-		{
-			NifIStream	nifStream( nif, &meshBuf );
-			nif->loadItem( meshItem, nifStream );
-		}
+		copyItem( nif, meshItem, meshes[l].meshData );
 	}
-
-	return true;
 }
 
 bool spMeshFileImport::processAllItems( NifModel * nif )
 {
+	struct Geometry
+	{
+		NifItem *	item;
+		QString	meshPaths[4];
+		DecodedMesh	meshes[4];
+		std::atomic< int >	failedLOD = -1;
+	};
+
+	// collect the mesh paths first, the model is not accessed by the worker threads
+	std::vector< std::unique_ptr< Geometry > >	geometries;
+	std::vector< std::pair< Geometry *, int > >	jobs;
+	for ( int b = 0; b < nif->getBlockCount(); b++ ) {
+		auto	g = std::make_unique< Geometry >();
+		g->item = nif->getBlockItem( qint32(b) );
+		if ( !getMeshPaths( nif, g->item, g->meshPaths ) )
+			continue;
+		for ( int l = 0; l < 4; l++ ) {
+			if ( !g->meshPaths[l].isEmpty() )
+				jobs.emplace_back( g.get(), l );
+		}
+		geometries.push_back( std::move( g ) );
+	}
+	if ( geometries.empty() )
+		return false;
+
+	// extract, decompress and parse the mesh files of all geometries and LODs in parallel
+	int	total = int( jobs.size() + geometries.size() );
+	std::atomic< int >	done = 0;
+	QByteArray	header( saveHeader( nif ) );
+	{
+		QThreadPool	pool;
+		for ( const auto & job : jobs ) {
+			pool.start( [nif, job, &header, &done]() {
+				Geometry &	g = *( job.first );
+				int	l = job.second;
+				QByteArray	meshData;
+				if ( !( nif->getResourceFile( meshData, g.meshPaths[l], "geometries/", ".mesh" )
+						&& decodeMeshData( g.meshes[l], nif, header, meshData ) ) ) {
+					g.failedLOD = l;
+				}
+				done++;
+			} );
+		}
+		while ( !pool.waitForDone( 50 ) )
+			emit nif->sigProgress( done, total );
+	}
+
+	// only copying the parsed values to the model is serialized
+	int	n = int( jobs.size() );
 	bool	r = false;
-	for ( int b = 0; b < nif->getBlockCount(); b++ )
-		r = r | processItem( nif, nif->getBlockItem( qint32(b) ) );
+	QStringList	failedPaths;
+	for ( const auto & g : geometries ) {
+		emit nif->sigProgress( ++n, total );
+		if ( g->failedLOD >= 0 ) {
+			failedPaths.append( g->meshPaths[g->failedLOD] );
+			continue;
+		}
+		loadMeshData( nif, g->item, g->meshes );
+		r = true;
+	}
+
+	// this is also called while loading a file, possibly without a GUI, so no message box is opened here
+	if ( !failedPaths.isEmpty() ) {
+		nif->logMessage( QString( "Failed to load %1 mesh file(s)" ).arg( failedPaths.size() ), failedPaths.join( "\n" ),
+							QMessageBox::Critical );
+	}
 	return r;
 }
 
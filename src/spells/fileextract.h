@@ -0,0 +1,72 @@
+#ifndef SPELL_FILEEXTRACT_H
+#define SPELL_FILEEXTRACT_H
+
+#include "gamemanager.h"
+
+#include <QString>
+
+#include <functional>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+class NifModel;
+
+//! Extracts the resource files used by NIF models to a folder on a pool of worker threads
+/*!
+ * Files are deduplicated across all models added, decompressed and written by the worker threads,
+ * and files that already exist in the output folder with identical contents are not rewritten.
+ * Used by spExtractAllResources and by the -no-gui --extract-resources command line mode.
+ */
+class ResourceExtractor final
+{
+public:
+	struct Stats
+	{
+		int	files = 0;
+		int	written = 0;
+		int	unchanged = 0;
+		int	missing = 0;
+		int	failed = 0;
+		//! Total size of the files extracted, and of the files actually written
+		qint64	bytes = 0;
+		qint64	bytesWritten = 0;
+		qint64	msecs = 0;
+
+		Stats & operator+=( const Stats & s );
+		QString toString() const;
+	};
+
+	//! 'outputFolder' is created if it does not exist, 'threads' <= 0 uses one thread per CPU core
+	explicit ResourceExtractor( const QString & outputFolder, int threads = 0 );
+
+	//! Queue the resource files used by 'nif', files that have been queued before from the same game and
+	// data paths are ignored. The model must not be deleted before run() returns.
+	void addModel( NifModel * nif );
+	//! Number of files queued for the next run()
+	int queued() const { return int( jobs.size() ); }
+	//! Extract the queued files, 'progress' is called on the calling thread with the number of files done
+	Stats run( const std::function< void ( int, int ) > & progress = nullptr );
+
+	//! Add the full paths of the resource files used by 'nif' to 'fileSet'
+	static void findResourcePaths( std::set< std::string > & fileSet, NifModel * nif );
+
+private:
+	struct Job
+	{
+		std::string	path;
+		Game::GameManager::GameResources *	resources = nullptr;
+		// Starfield materials are converted to JSON when queued
+		std::string	textData;
+	};
+
+	std::string	outputFolder;
+	int	threadCount;
+	//! Game and data paths of the resources, and the path of the files queued so far
+	std::set< std::pair< std::string, std::string > >	knownFiles;
+	std::vector< Job >	jobs;
+};
+
+#endif
@@ -2,10 +2,16 @@
 #include "gl/gltools.h"
 #include "qtcompat.h"
 
+#include <QApplication>
 #include <QDialog>
+#include <QElapsedTimer>
 #include <QGridLayout>
+#include <QProgressDialog>
 #include <QSettings>
+#include <QThreadPool>
+#include <atomic>
 #include <cfloat>
+#include <memory>
 #include <unordered_set>
 
 #include "libfo76utils/src/fp32vec4.hpp"
@@ -1657,16 +1663,121 @@ void spGenerateMeshlets::clearMeshlets( NifModel * nif, const QModelIndex & iMes
 		nif->updateArraySize( i );
 }
 
-void spGenerateMeshlets::updateMeshlets(
-	NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile )
+namespace
 {
-	int	meshletAlgorithm;
-	{
-		QSettings	settings;
-		meshletAlgorithm = settings.value( "Settings/Nif/Starfield Meshlet Algorithm", 0 ).toInt();
-		meshletAlgorithm = std::min< int >( std::max< int >( meshletAlgorithm, 0 ), 4 );
+//! Meshlets and reordered triangles of a mesh, generated without accessing the model
+struct MeshletData
+{
+	std::vector< meshopt_Meshlet >	meshlets;
+	QVector< Triangle >	triangles;
+	QString	error;
+};
+
+int getMeshletAlgorithm()
+{
+	QSettings	settings;
+	int	meshletAlgorithm = settings.value( "Settings/Nif/Starfield Meshlet Algorithm", 0 ).toInt();
+	return std::min< int >( std::max< int >( meshletAlgorithm, 0 ), 4 );
+}
+
+//! Generates meshlets for 'meshFile', this can be called from worker threads
+void buildMeshlets( MeshletData & o, const MeshFile & meshFile, int meshletAlgorithm )
+{
+	o.meshlets.clear();
+	o.triangles.clear();
+	o.error.clear();
+	if ( !( meshFile.positions.size() > 0 && meshFile.triangles.size() > 0 ) )
+		return;
+
+	try {
+		size_t	vertexCnt = size_t( meshFile.positions.size() );
+		size_t	triangleCnt = size_t( meshFile.triangles.size() );
+		if ( meshletAlgorithm < 4 ) {
+			std::vector< unsigned int >	indices( triangleCnt * 3 );
+			size_t	k = 0;
+			for ( const auto & t : meshFile.triangles ) {
+				if ( t[0] >= vertexCnt || t[1] >= vertexCnt || t[2] >= vertexCnt )
+					throw FO76UtilsError( "vertex number is out of range" );
+				indices[k] = t[0];
+				indices[k + 1] = t[1];
+				indices[k + 2] = t[2];
+				k = k + 3;
+			}
+			size_t	maxMeshlets = meshopt_buildMeshletsBound( triangleCnt * 3, 96, 128 );
+			o.meshlets.resize( maxMeshlets );
+			std::vector< unsigned int >	meshletVertices( maxMeshlets * 96 );
+			std::vector< unsigned char >	meshletTriangles( maxMeshlets * 128 * 3 );
+			size_t	meshletCnt;
+			if ( meshletAlgorithm & 2 ) {
+				std::vector< unsigned int >	indicesOpt( triangleCnt * 3 );
+				meshopt_spatialSortTriangles( indicesOpt.data(), indices.data(), triangleCnt * 3,
+												&( meshFile.positions.at(0)[0] ), vertexCnt, sizeof( Vector3 ) );
+				meshopt_optimizeVertexCache( indices.data(), indicesOpt.data(), triangleCnt * 3, vertexCnt );
+				meshletCnt =
+					meshopt_buildMeshletsScan( o.meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+												indices.data(), triangleCnt * 3, vertexCnt, 96, 128 );
+			} else {
+				meshletCnt =
+					meshopt_buildMeshlets( o.meshlets.data(), meshletVertices.data(), meshletTriangles.data(),
+											indices.data(), triangleCnt * 3, &( meshFile.positions.at(0)[0] ),
+											vertexCnt, sizeof( Vector3 ), 96, 128, 0.0625f );
+			}
+			o.meshlets.resize( meshletCnt );
+			if ( meshletAlgorithm & 1 ) {
+				for ( const auto & m : o.meshlets ) {
+					meshopt_optimizeMeshlet( meshletVertices.data() + m.vertex_offset,
+											meshletTriangles.data() + m.triangle_offset,
+											m.triangle_count, m.vertex_count );
+				}
+			}
+			o.triangles.reserve( qsizetype( triangleCnt ) );
+			for ( const auto & m : o.meshlets ) {
+				unsigned int	n = m.triangle_count;
+				const unsigned int *	v = meshletVertices.data() + m.vertex_offset;
+				const unsigned char *	p = meshletTriangles.data() + m.triangle_offset;
+				for ( ; n; n--, p = p + 3 )
+					o.triangles.append( Triangle( quint16( v[p[0]] ), quint16( v[p[1]] ), quint16( v[p[2]] ) ) );
+			}
+		} else {
+			std::vector< DirectX::Meshlet >	tmpMeshlets;
+			std::vector< std::uint16_t >	newIndices;
+			int	err = DirectX::ComputeMeshlets( meshFile.triangles.data(), triangleCnt,
+												meshFile.positions.data(), vertexCnt,
+												tmpMeshlets, newIndices, 96, 128 );
+			if ( err ) {
+				throw FO76UtilsError( err == ERANGE ? "vertex number is out of range"
+													: ( err == ENOMEM ? "std::bad_alloc" : "invalid argument" ) );
+			}
+			o.meshlets.resize( tmpMeshlets.size() );
+			std::uint32_t	vertexOffset = 0;
+			std::uint32_t	triangleOffset = 0;
+			for ( const auto & m : tmpMeshlets ) {
+				meshopt_Meshlet &	meshlet = o.meshlets[&m - tmpMeshlets.data()];
+				meshlet.vertex_offset = vertexOffset;
+				meshlet.triangle_offset = triangleOffset;
+				meshlet.vertex_count = m.VertCount;
+				vertexOffset = vertexOffset + meshlet.vertex_count;
+				meshlet.triangle_count = m.PrimCount;
+				triangleOffset = ( triangleOffset + ( meshlet.triangle_count * 3U ) + 3U ) & ~3U;
+			}
+			if ( newIndices.size() < triangleCnt * 3 )
+				throw FO76UtilsError( "triangle number is out of range" );
+			o.triangles.resize( qsizetype( triangleCnt ) );
+			for ( size_t i = 0; i < triangleCnt; i++ )
+				o.triangles[qsizetype(i)] = Triangle( newIndices[i * 3], newIndices[i * 3 + 1], newIndices[i * 3 + 2] );
+		}
+		if ( size_t( o.triangles.size() ) != triangleCnt )
+			throw FO76UtilsError( "triangle number is out of range" );
+	} catch ( std::exception & e ) {
+		o.meshlets.clear();
+		o.triangles.clear();
+		o.error = QString::fromUtf8( e.what() );
 	}
+}
 
+//! Stores the meshlets and reordered triangles generated by buildMeshlets() in the model
+void setMeshletData( NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile, MeshletData & d )
+{
 	NifItem *	item = nif->getItem( iMeshData );
 	if ( !item )
 		return;
@@ -1674,101 +1785,18 @@ void spGenerateMeshlets::updateMeshlets(
 	item->invalidateCondition();
 	nif->set<quint32>( iMeshData, "Version", 2 );
 
-	std::vector< meshopt_Meshlet >	meshletData;
-	if ( meshFile.positions.size() > 0 && meshFile.triangles.size() > 0 ) {
-		try {
-			size_t	vertexCnt = size_t( meshFile.positions.size() );
-			size_t	triangleCnt = size_t( meshFile.triangles.size() );
-			auto	iTriangles = nif->getIndex( iMeshData, "Triangles" );
-			if ( !iTriangles.isValid() || size_t( nif->rowCount( iTriangles ) ) != triangleCnt )
-				throw FO76UtilsError( "invalid triangle data" );
-			if ( meshletAlgorithm < 4 ) {
-				std::vector< unsigned int >	indices( triangleCnt * 3 );
-				size_t	k = 0;
-				for ( const auto & t : meshFile.triangles ) {
-					if ( t[0] >= vertexCnt || t[1] >= vertexCnt || t[2] >= vertexCnt )
-						throw FO76UtilsError( "vertex number is out of range" );
-					indices[k] = t[0];
-					indices[k + 1] = t[1];
-					indices[k + 2] = t[2];
-					k = k + 3;
-				}
-				size_t	maxMeshlets = meshopt_buildMeshletsBound( triangleCnt * 3, 96, 128 );
-				meshletData.resize( maxMeshlets );
-				std::vector< unsigned int >	meshletVertices( maxMeshlets * 96 );
-				std::vector< unsigned char >	meshletTriangles( maxMeshlets * 128 * 3 );
-				size_t	meshletCnt;
-				if ( meshletAlgorithm & 2 ) {
-					std::vector< unsigned int >	indicesOpt( triangleCnt * 3 );
-					meshopt_spatialSortTriangles( indicesOpt.data(), indices.data(), triangleCnt * 3,
-													&( meshFile.positions.at(0)[0] ), vertexCnt, sizeof( Vector3 ) );
-					meshopt_optimizeVertexCache( indices.data(), indicesOpt.data(), triangleCnt * 3, vertexCnt );
-					meshletCnt =
-						meshopt_buildMeshletsScan( meshletData.data(), meshletVertices.data(), meshletTriangles.data(),
-													indices.data(), triangleCnt * 3, vertexCnt, 96, 128 );
-				} else {
-					meshletCnt =
-						meshopt_buildMeshlets( meshletData.data(), meshletVertices.data(), meshletTriangles.data(),
-												indices.data(), triangleCnt * 3, &( meshFile.positions.at(0)[0] ),
-												vertexCnt, sizeof( Vector3 ), 96, 128, 0.0625f );
-				}
-				meshletData.resize( meshletCnt );
-				if ( meshletAlgorithm & 1 ) {
-					for ( const auto & m : meshletData ) {
-						meshopt_optimizeMeshlet( meshletVertices.data() + m.vertex_offset,
-												meshletTriangles.data() + m.triangle_offset,
-												m.triangle_count, m.vertex_count );
-					}
-				}
-				k = 0;
-				for ( const auto & m : meshletData ) {
-					unsigned int	n = m.triangle_count;
-					const unsigned int *	v = meshletVertices.data() + m.vertex_offset;
-					const unsigned char *	p = meshletTriangles.data() + m.triangle_offset;
-					for ( ; n; n--, k++, p = p + 3 ) {
-						auto	iTriangle = QModelIndex_child( iTriangles, int(k) );
-						if ( !iTriangle.isValid() )
-							throw FO76UtilsError( "triangle number is out of range" );
-						quint16	v0 = quint16( v[p[0]] );
-						quint16	v1 = quint16( v[p[1]] );
-						quint16	v2 = quint16( v[p[2]] );
-						Triangle	t( v0, v1, v2 );
-						nif->set<Triangle>( iTriangle, t );
-					}
-				}
-			} else {
-				std::vector< DirectX::Meshlet >	tmpMeshlets;
-				std::vector< std::uint16_t >	newIndices;
-				int	err = DirectX::ComputeMeshlets( meshFile.triangles.data(), triangleCnt,
-													meshFile.positions.data(), vertexCnt,
-													tmpMeshlets, newIndices, 96, 128 );
-				if ( err ) {
-					throw FO76UtilsError( err == ERANGE ? "vertex number is out of range"
-														: ( err == ENOMEM ? "std::bad_alloc" : "invalid argument" ) );
-				}
-				meshletData.resize( tmpMeshlets.size() );
-				std::uint32_t	vertexOffset = 0;
-				std::uint32_t	triangleOffset = 0;
-				for ( const auto & m : tmpMeshlets ) {
-					meshopt_Meshlet &	o = meshletData[&m - tmpMeshlets.data()];
-					o.vertex_offset = vertexOffset;
-					o.triangle_offset = triangleOffset;
-					o.vertex_count = m.VertCount;
-					vertexOffset = vertexOffset + o.vertex_count;
-					o.triangle_count = m.PrimCount;
-					triangleOffset = ( triangleOffset + ( o.triangle_count * 3U ) + 3U ) & ~3U;
-				}
-				for ( int i = 0; i < int(triangleCnt); i++ ) {
-					Triangle	t( newIndices[i * 3], newIndices[i * 3 + 1], newIndices[i * 3 + 2] );
-					nif->set<Triangle>( QModelIndex_child( iTriangles, i ), t );
-				}
-			}
-		} catch ( std::exception & e ) {
-			meshletData.clear();
-			QMessageBox::critical( nullptr, "NifSkope error", QString("Meshlet generation failed: %1").arg(e.what()) );
-		}
+	if ( d.error.isEmpty() && !d.triangles.isEmpty() ) {
+		auto	iTriangles = nif->getIndex( iMeshData, "Triangles" );
+		if ( !iTriangles.isValid() || nif->rowCount( iTriangles ) != int( d.triangles.size() ) )
+			d.error = QString( "invalid triangle data" );
+		else
+			nif->setArray<Triangle>( iTriangles, d.triangles );
 	}
-	int	meshletCount = int( meshletData.size() );
+	if ( !d.error.isEmpty() ) {
+		d.meshlets.clear();
+		QMessageBox::critical( nullptr, "NifSkope error", QString("Meshlet generation failed: %1").arg( d.error ) );
+	}
+	int	meshletCount = int( d.meshlets.size() );
 
 	nif->set<quint32>( iMeshData, "Num Meshlets", quint32(meshletCount) );
 	auto	iMeshlets = nif->getIndex( iMeshData, "Meshlets" );
@@ -1776,56 +1804,226 @@ void spGenerateMeshlets::updateMeshlets(
 	for ( int i = 0; i < meshletCount; i++ ) {
 		auto	iMeshlet = QModelIndex_child( iMeshlets, i );
 		if ( iMeshlet.isValid() ) {
-			nif->set<quint32>( iMeshlet, "Vertex Count", meshletData[i].vertex_count );
-			nif->set<quint32>( iMeshlet, "Vertex Offset", meshletData[i].vertex_offset );
-			nif->set<quint32>( iMeshlet, "Triangle Count", meshletData[i].triangle_count );
-			nif->set<quint32>( iMeshlet, "Triangle Offset", meshletData[i].triangle_offset );
+			nif->set<quint32>( iMeshlet, "Vertex Count", d.meshlets[i].vertex_count );
+			nif->set<quint32>( iMeshlet, "Vertex Offset", d.meshlets[i].vertex_offset );
+			nif->set<quint32>( iMeshlet, "Triangle Count", d.meshlets[i].triangle_count );
+			nif->set<quint32>( iMeshlet, "Triangle Offset", d.meshlets[i].triangle_offset );
 		}
 	}
 
 	updateCullData( nif, iMeshData, meshFile );
 }
 
-QModelIndex spGenerateMeshlets::cast( NifModel * nif, const QModelIndex & index )
+//! Mesh data structures of the BSGeometry blocks at 'index', or of all blocks if 'index' is not valid
+struct MeshletJob
+{
+	QPersistentModelIndex	iMeshData;
+	MeshFile	meshFile;
+	MeshletData	result;
+
+	MeshletJob( NifModel * nif, const QModelIndex & iMesh )
+		: iMeshData( nif->getIndex( iMesh, "Mesh Data" ) ), meshFile( nif, iMesh )
+	{
+	}
+};
+
+void findMeshletJobs(
+	std::vector< std::unique_ptr< MeshletJob > > & jobs, QVector< QPersistentModelIndex > & blocks,
+	NifModel * nif, const QModelIndex & index, bool internalOnly = true )
 {
-	if ( !( nif && nif->getBSVersion() >= 170 ) )
-		return index;
 	if ( !index.isValid() ) {
-		// process all shapes
 		for ( int n = 0; n < nif->getBlockCount(); n++ ) {
-			QModelIndex idx = nif->getBlockIndex( n );
+			QModelIndex	idx = nif->getBlockIndex( n );
 			if ( idx.isValid() )
-				cast( nif, idx );
+				findMeshletJobs( jobs, blocks, nif, idx, internalOnly );
+		}
+		return;
+	}
+	if ( !nif->blockInherits( index, "BSGeometry" ) )
+		return;
+	blocks.append( index );
+
+	auto	meshes = nif->getIndex( index, "Meshes" );
+	if ( !meshes.isValid() || ( internalOnly && ( nif->get<quint32>(index, "Flags") & 0x0200 ) == 0 ) )
+		return;
+	for ( int i = 0; i <= 3; i++ ) {
+		auto mesh = QModelIndex_child( meshes, i );
+		if ( !mesh.isValid() )
+			continue;
+		auto hasMesh = nif->getIndex( mesh, "Has Mesh" );
+		if ( !hasMesh.isValid() || nif->get<quint8>( hasMesh ) == 0 )
+			continue;
+		mesh = nif->getIndex( mesh, "Mesh" );
+		if ( !mesh.isValid() )
+			continue;
+		auto	job = std::make_unique< MeshletJob >( nif, mesh );
+		if ( job->iMeshData.isValid() || !internalOnly )
+			jobs.push_back( std::move( job ) );
+	}
+}
+
+//! Runs 'f' for each job on a thread pool, with a progress dialog if the application has a GUI
+template < typename F >
+void runMeshletJobs( const std::vector< std::unique_ptr< MeshletJob > > & jobs, const QString & label, F f )
+{
+	std::atomic< int >	done = 0;
+	QThreadPool	pool;
+	for ( const auto & job : jobs ) {
+		MeshletJob *	j = job.get();
+		pool.start( [j, &f, &done]() {
+			f( *j );
+			done++;
+		} );
+	}
+
+	std::unique_ptr< QProgressDialog >	dlg;
+	if ( qobject_cast< QApplication * >( QCoreApplication::instance() ) ) {
+		dlg = std::make_unique< QProgressDialog >( label, QString(), 0, int( jobs.size() ) );
+		dlg->setWindowModality( Qt::ApplicationModal );
+		dlg->setMinimumDuration( 500 );
+	}
+	while ( !pool.waitForDone( 50 ) ) {
+		if ( dlg ) {
+			dlg->setValue( done );
+			QCoreApplication::processEvents();
 		}
+	}
+}
+}	// namespace
+
+void spGenerateMeshlets::updateMeshlets(
+	NifModel * nif, const QPersistentModelIndex & iMeshData, const MeshFile & meshFile )
+{
+	MeshletData	d;
+	buildMeshlets( d, meshFile, getMeshletAlgorithm() );
+	setMeshletData( nif, iMeshData, meshFile, d );
+}
+
+QModelIndex spGenerateMeshlets::cast( NifModel * nif, const QModelIndex & index )
+{
+	if ( !( nif && nif->getBSVersion() >= 170 ) )
 		return index;
+
+	// the meshes and LODs are independent, only reading the mesh data and storing the results uses the model
+	std::vector< std::unique_ptr< MeshletJob > >	jobs;
+	QVector< QPersistentModelIndex >	blocks;
+	findMeshletJobs( jobs, blocks, nif, index );
+
+	int	meshletAlgorithm = getMeshletAlgorithm();
+	runMeshletJobs( jobs, Spell::tr( "Generating meshlets..." ), [meshletAlgorithm]( MeshletJob & j ) {
+		buildMeshlets( j.result, j.meshFile, meshletAlgorithm );
+	} );
+
+	for ( const auto & j : jobs )
+		setMeshletData( nif, j->iMeshData, j->meshFile, j->result );
+	for ( const auto & b : blocks ) {
+		if ( b.isValid() )
+			spUpdateBounds::cast_Starfield( nif, b );
 	}
 
-	if ( !nif->blockInherits( index, "BSGeometry" ) )
+	return index;
+}
+
+REGISTER_SPELL( spGenerateMeshlets )
+
+//! Compares the speed and quality of the meshlet generation algorithms on the meshes of a Starfield NIF
+class spBenchmarkMeshlets final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Benchmark Meshlet Algorithms" ); }
+	QString page() const override final { return Spell::tr( "Mesh" ); }
+	bool constant() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return ( nif && nif->getBSVersion() >= 170 && !index.isValid() );
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final;
+};
+
+QModelIndex spBenchmarkMeshlets::cast( NifModel * nif, const QModelIndex & index )
+{
+	static const char *	algorithmNames[5] = {
+		"meshopt_buildMeshlets", "meshopt_buildMeshlets (optimized)",
+		"meshopt_buildMeshletsScan", "meshopt_buildMeshletsScan (optimized)", "DirectXMesh"
+	};
+
+	// meshes stored in .mesh files are included, the model is not modified
+	std::vector< std::unique_ptr< MeshletJob > >	jobs;
+	QVector< QPersistentModelIndex >	blocks;
+	findMeshletJobs( jobs, blocks, nif, index, false );
+	qint64	triangleCnt = 0;
+	for ( const auto & j : jobs )
+		triangleCnt += j->meshFile.triangles.size();
+	if ( !triangleCnt )
 		return index;
 
-	auto	meshes = nif->getIndex( index, "Meshes" );
-	if ( meshes.isValid() && ( nif->get<quint32>(index, "Flags") & 0x0200 ) != 0 ) {
-		for ( int i = 0; i <= 3; i++ ) {
-			auto mesh = QModelIndex_child( meshes, i );
-			if ( !mesh.isValid() )
+	QString	s = Spell::tr( "%1 meshes, %2 triangles\n" ).arg( jobs.size() ).arg( triangleCnt );
+	for ( int a = 0; a < 5; a++ ) {
+		// per mesh run times are summed, so that the results do not depend on the number of threads
+		std::atomic< qint64 >	nsecs = 0;
+		runMeshletJobs( jobs, Spell::tr( "Testing %1..." ).arg( algorithmNames[a] ), [a, &nsecs]( MeshletJob & j ) {
+			QElapsedTimer	t;
+			t.start();
+			buildMeshlets( j.result, j.meshFile, a );
+			nsecs += t.nsecsElapsed();
+		} );
+
+		qint64	meshletCnt = 0;
+		qint64	vertexCnt = 0;
+		// triangles of the meshes the algorithm succeeded on, the fill and culling rates are relative to these
+		qint64	builtTriangleCnt = 0;
+		int	errors = 0;
+		// expected fraction of triangles rejected by cone culling for a uniformly distributed view direction
+		double	coneCulled = 0.0;
+		for ( const auto & j : jobs ) {
+			const MeshletData &	d = j->result;
+			if ( !d.error.isEmpty() ) {
+				errors++;
 				continue;
-			auto hasMesh = nif->getIndex( mesh, "Has Mesh" );
-			if ( !hasMesh.isValid() || nif->get<quint8>( hasMesh ) == 0 )
-				continue;
-			mesh = nif->getIndex( mesh, "Mesh" );
-			if ( !mesh.isValid() )
-				continue;
-			MeshFile	meshFile( nif, mesh );
-			auto	meshData = nif->getIndex( mesh, "Mesh Data" );
-			if ( meshData.isValid() )
-				updateMeshlets( nif, meshData, meshFile );
+			}
+			builtTriangleCnt += j->meshFile.triangles.size();
+			const QVector< Vector3 > &	positions = j->meshFile.positions;
+			qsizetype	k = 0;
+			std::vector< unsigned int >	indices;
+			for ( const auto & m : d.meshlets ) {
+				meshletCnt++;
+				vertexCnt += m.vertex_count;
+				indices.clear();
+				for ( unsigned int n = 0; n < m.triangle_count && k < d.triangles.size(); n++, k++ ) {
+					const Triangle &	t = d.triangles.at( k );
+					indices.insert( indices.end(), { t[0], t[1], t[2] } );
+				}
+				if ( indices.empty() )
+					continue;
+				meshopt_Bounds	b = meshopt_computeClusterBounds(
+										indices.data(), indices.size(), &( positions.at(0)[0] ),
+										size_t( positions.size() ), sizeof( Vector3 ) );
+				if ( b.cone_cutoff < 1.0f )
+					coneCulled += double( 1.0f - b.cone_cutoff ) * 0.5 * double( indices.size() / 3 );
+			}
+		}
+
+		s += QString( "\n%1:\n" ).arg( algorithmNames[a] );
+		if ( errors )
+			s += Spell::tr( "  failed on %1 meshes\n" ).arg( errors );
+		s += Spell::tr( "  time: %1 ms\n" ).arg( double( nsecs ) / 1000000.0, 0, 'f', 2 );
+		s += Spell::tr( "  meshlets: %1\n" ).arg( meshletCnt );
+		if ( meshletCnt && builtTriangleCnt ) {
+			s += Spell::tr( "  vertex fill: %1%, triangle fill: %2%\n" )
+					.arg( double( vertexCnt ) * 100.0 / ( double( meshletCnt ) * 96.0 ), 0, 'f', 1 )
+					.arg( double( builtTriangleCnt ) * 100.0 / ( double( meshletCnt ) * 128.0 ), 0, 'f', 1 );
+			s += Spell::tr( "  cone culling efficiency: %1%\n" )
+					.arg( coneCulled * 100.0 / double( builtTriangleCnt ), 0, 'f', 1 );
 		}
 	}
 
-	return spUpdateBounds::cast_Starfield( nif, index );
+	Message::info( nullptr, Spell::tr( "Meshlet benchmark results" ), s );
+	return index;
 }
 
-REGISTER_SPELL( spGenerateMeshlets )
+REGISTER_SPELL( spBenchmarkMeshlets )
 
 
 //! Update Triangles on Data from Skin
@@ -1,7 +1,9 @@
 #include "texture.h"
 
 #include "spellbook.h"
+#include "message.h"
 #include "gl/gltex.h"
+#include "gl/gltexloaders.h"
 #include "spells/blocks.h"
 #include "ui/widgets/fileselect.h"
 #include "ui/widgets/nifeditors.h"
@@ -16,6 +18,7 @@
 #include <QCheckBox>
 #include <QColorDialog>
 #include <QComboBox>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QGridLayout>
 #include <QLabel>
@@ -892,6 +895,64 @@ public:
 REGISTER_SPELL( spTexInfo )
 #endif
 
+//! Measure the time needed to prefilter the default PBR cube map with different settings
+class spBenchmarkCubeMap final : public Spell
+{
+public:
+	QString name() const override final { return Spell::tr( "Benchmark Cube Map Filter" ); }
+	QString page() const override final { return Spell::tr( "Texture" ); }
+	bool constant() const override final { return true; }
+
+	bool isApplicable( const NifModel * nif, const QModelIndex & index ) override final
+	{
+		return nif && !index.isValid() && nif->getBSVersion() >= 151;
+	}
+
+	QModelIndex cast( NifModel * nif, const QModelIndex & index ) override final
+	{
+		bool isStarfield = ( nif->getBSVersion() >= 170 );
+		QSettings settings;
+		QString cubeMapPath = !isStarfield
+			? settings.value( "Settings/Render/General/Cube Map Path FO 76", "textures/shared/cubemaps/mipblur_defaultoutside1.dds" ).toString()
+			: settings.value( "Settings/Render/General/Cube Map Path STF", "textures/cubemaps/cell_cityplazacube.dds" ).toString();
+
+		QByteArray source;
+		if ( !nif->getResourceFile( source, cubeMapPath, "textures", nullptr ) || source.isEmpty() ) {
+			Message::critical( nullptr, Spell::tr( "Could not load cube map '%1'" ).arg( cubeMapPath ) );
+			return index;
+		}
+
+		QApplication::setOverrideCursor( Qt::WaitCursor );
+		QString result = QString( "%1\n\nResolution\tSamples\tTime (ms)\n" ).arg( cubeMapPath );
+		for ( int resolution : { 256, 512, 1024 } ) {
+			for ( int samples : { 64, 256, 1024 } ) {
+				PBRFilterSettings s = PBRFilterSettings::current();
+				s.resolution = resolution;
+				s.importanceSamples = samples;
+				s.useCache = false;
+
+				QByteArray data( source );
+				QByteArray diffuseData;
+				QElapsedTimer t;
+				t.start();
+				bool ok = texPrefilterPBRCubeMap( int( nif->getBSVersion() ), data, diffuseData, s );
+				qint64 ms = t.elapsed();
+
+				QString line = QString( "%1\t%2\t%3\n" ).arg( resolution ).arg( samples ).arg( ok ? QString::number( ms ) : QString( "failed" ) );
+				result += line;
+			}
+		}
+		QApplication::restoreOverrideCursor();
+
+		Message::info( nullptr, result );
+		return index;
+	}
+};
+
+#ifndef QT_NO_DEBUG
+REGISTER_SPELL( spBenchmarkCubeMap )
+#endif
+
 //! Export a packed NiPixelData texture
 class spExportTexture final : public Spell
 {
@@ -519,6 +519,7 @@ SettingsResources::SettingsResources( QWidget * parent ) :
 	connect( ui->foldersList, &QListView::doubleClicked, this, &SettingsPane::modifyPane );
 	connect( ui->chkAlternateExt, &QCheckBox::clicked, this, &SettingsPane::modifyPane );
 	connect( ui->chkOtherGamesFallback, &QCheckBox::clicked, this, &SettingsPane::modifyPane );
+	connect( ui->spnFileCacheSize, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged), this, &SettingsPane::modifyPane );
 
 	// Move Up / Move Down Behavior
 	connect( ui->foldersList->selectionModel(), &QItemSelectionModel::currentChanged,
@@ -553,6 +554,7 @@ void SettingsResources::read()
 
 	ui->chkAlternateExt->setChecked( settings.value( "Settings/Resources/Alternate Extensions", false ).toBool() );
 	ui->chkOtherGamesFallback->setChecked( settings.value("Settings/Resources/Other Games Fallback", false ).toBool() );
+	ui->spnFileCacheSize->setValue( settings.value( "Settings/Resources/File Cache Size", 256 ).toInt() );
 
 	setModified( false );
 }
@@ -569,6 +571,9 @@ void SettingsResources::write()
 	QSettings settings;
 	settings.setValue( "Settings/Resources/Alternate Extensions", ui->chkAlternateExt->isChecked() );
 	settings.setValue( "Settings/Resources/Other Games Fallback", ui->chkOtherGamesFallback->isChecked() );
+	settings.setValue( "Settings/Resources/File Cache Size", ui->spnFileCacheSize->value() );
+	GameManager::update_file_cache_size( ui->spnFileCacheSize->value() );
+	TexCache::loadSettings( settings );
 
 	setModified( false );
 
@@ -34,7 +34,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "gl/glnode.h"
 #include "gl/glscene.h"
+#include "gl/gltex.h"
 #include "model/nifmodel.h"
+#include "qtcompat.h"
 
 #include <QApplication>
 #include <QBuffer>
@@ -108,6 +110,11 @@ public:
 	QLabel * lenLabel;
 	QLineEdit * lenText;
 	QPushButton * refreshBtn;
+
+	QGroupBox * texGroup;
+	QTextEdit * texText;
+	//! Selected block, which may be a texture instead of a node
+	QPersistentModelIndex textureBlock;
 };
 
 InspectViewInternal::~InspectViewInternal()
@@ -154,6 +161,7 @@ InspectViewInternal::~InspectViewInternal()
 	if ( lenLabel != 0 )   delete lenLabel;
 	if ( lenText != 0 )    delete lenText;
 	if ( refreshBtn != 0 ) delete refreshBtn;
+	if ( texGroup != 0 )   delete texGroup;
 }
 
 InspectView::InspectView( QWidget * parent, Qt::WindowFlags f )
@@ -294,6 +302,16 @@ InspectView::InspectView( QWidget * parent, Qt::WindowFlags f )
 	impl->refreshBtn->setText( tr( "Refresh" ) );
 	impl->refreshBtn->setFocus();
 
+	impl->texGroup = new QGroupBox( this );
+	impl->texGroup->setTitle( tr( "Textures" ) );
+	impl->texText = new QTextEdit( this );
+	impl->texText->setLineWrapMode( QTextEdit::NoWrap );
+	impl->texText->setReadOnly( true );
+
+	QGridLayout * texGrid = new QGridLayout;
+	impl->texGroup->setLayout( texGrid );
+	texGrid->addWidget( impl->texText );
+
 	QGridLayout * grid = new QGridLayout;
 	this->setLayout( grid );
 	grid->addWidget( impl->nameLabel,   0, 0 );
@@ -313,6 +331,7 @@ InspectView::InspectView( QWidget * parent, Qt::WindowFlags f )
 	grid->addWidget( impl->lenLabel,    8, 0 );
 	grid->addWidget( impl->lenText,     8, 1 );
 	grid->addWidget( impl->refreshBtn,  9, 1 );
+	grid->addWidget( impl->texGroup,    10, 0, 1, 2 );
 
 	connect( impl->localCheck, &QCheckBox::stateChanged, this, &InspectView::update );
 	connect( impl->invertCheck, &QCheckBox::stateChanged, this, &InspectView::update );
@@ -342,9 +361,11 @@ void InspectView::updateSelection( const QModelIndex & select )
 	impl->needUpdate = true;
 
 	if ( !scene || !nif ) {
+		impl->textureBlock = QModelIndex();
 		clear();
 	} else {
 		selection = nif->getBlockIndex( select );
+		impl->textureBlock = selection;
 		Node * node = scene->getNode( nif, selection );
 
 		if ( !node ) {
@@ -353,6 +374,8 @@ void InspectView::updateSelection( const QModelIndex & select )
 			refresh();
 		}
 	}
+
+	updateTextures();
 }
 
 void InspectView::updateTime( float t, float, float )
@@ -376,6 +399,8 @@ void InspectView::update()
 
 	impl->needUpdate = false;
 
+	updateTextures();
+
 	if ( !scene || !nif || !selection.isValid() ) {
 		clear();
 		return;
@@ -454,6 +479,43 @@ void InspectView::clear()
 	impl->lenText->setText( empty );
 }
 
+void InspectView::updateTextures()
+{
+	if ( this->isHidden() )
+		return;
+
+	if ( !scene || !scene->textures ) {
+		impl->texText->clear();
+		return;
+	}
+
+	const TexCache * textures = scene->textures;
+	QString text = textures->statsText();
+
+	Game::GameManager::FileCacheStats files = Game::GameManager::file_cache_stats();
+	quint64 reads = files.hits + files.misses;
+	text += QString( "\nCached archive files: %1, %2 MB, hit rate: %3% (%4 reads)" )
+			.arg( files.count ).arg( double( files.bytes ) / 1048576.0, 0, 'f', 1 )
+			.arg( reads ? double( files.hits ) * 100.0 / double( reads ) : 0.0, 0, 'f', 1 ).arg( reads );
+
+	QModelIndex iBlock = impl->textureBlock;
+	if ( nif && iBlock.isValid() ) {
+		if ( nif->isNiBlock( iBlock, "NiSourceTexture" ) ) {
+			if ( nif->get<quint8>( iBlock, "Use External" ) != 0 )
+				text += "\n\n" + textures->info( nif->get<QString>( iBlock, "File Name" ) );
+		} else {
+			QModelIndex iTextures = nif->getIndex( iBlock, "Textures" );
+			for ( int i = 0; iTextures.isValid() && i < nif->rowCount( iTextures ); i++ ) {
+				QString file = nif->get<QString>( QModelIndex_child( iTextures, i ) );
+				if ( !file.isEmpty() )
+					text += "\n\n" + textures->info( file );
+			}
+		}
+	}
+
+	impl->texText->setPlainText( text );
+}
+
 void InspectView::setVisible( bool visible )
 {
 	impl->needUpdate = visible;
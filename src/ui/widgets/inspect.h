@@ -71,6 +71,9 @@ public slots:
 	void copyTransformToMimedata();
 
 private:
+	//! Show texture cache statistics and the textures of the selected block
+	void updateTextures();
+
 	InspectViewInternal * impl;
 	NifModel * nif;
 	Scene * scene;
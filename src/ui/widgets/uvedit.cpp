@@ -125,6 +125,8 @@ UVWidget::UVWidget( QWidget * parent )
 	setFocusPolicy( Qt::StrongFocus );
 
 	textures = new TexCache( this );
+	textures->setStreaming( true );
+	connect( textures, &TexCache::sigRefresh, this, &UVWidget::updateGL );
 
 	zoom = 1.2;
 
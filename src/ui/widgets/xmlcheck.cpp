@@ -1,6 +1,7 @@
 #include "xmlcheck.h"
 
 #include "message.h"
+#include "io/nifindex.h"
 #include "model/kfmmodel.h"
 #include "model/nifmodel.h"
 #include "ui/widgets/fileselect.h"
@@ -18,6 +19,7 @@
 #include <QLineEdit>
 #include <QMenu>
 #include <QMouseEvent>
+#include <QProcess>
 #include <QProgressBar>
 #include <QPushButton>
 #include <QSettings>
@@ -25,8 +27,25 @@
 #include <QTextBrowser>
 #include <QToolButton>
 #include <QComboBox>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QQueue>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #define NUM_THREADS 4
 
 
@@ -99,6 +118,12 @@ TestShredder::TestShredder()
 	//Version Check
 	verMatch = new QLineEdit( this );
 
+	indexQuery = new QLineEdit( this );
+	indexQuery->setToolTip( tr( "Only check the files that match these terms in the corpus index of the folder, "
+								"created with --index. The terms are block:<type>, resource:<path>, "
+								"value:<block>/<field>=<value> or &<mask>, and can be negated with '!'. "
+								"Files that are not indexed or have changed since are always checked." ) );
+
 	text = new QTextBrowser();
 	text->setHidden( false );
 	text->setReadOnly( true );
@@ -151,6 +176,10 @@ TestShredder::TestShredder()
 	hbox->addWidget( new QLabel( tr( "Version Match:" ) ) );
 	hbox->addWidget( verMatch );
 
+	lay->addLayout( hbox = new QHBoxLayout() );
+	hbox->addWidget( new QLabel( tr( "Index Query:" ) ) );
+	hbox->addWidget( indexQuery );
+
 	lay->addWidget( text );
 
 	lay->addLayout( hbox = new QHBoxLayout() );
@@ -253,7 +282,49 @@ void TestShredder::run()
 	if ( chkKfm->isChecked() )
 		extensions << "*.kfm";
 
-	queue.init( directory->text(), extensions, recursive->isChecked() );
+	// Skip the files that an up to date corpus index lists without a matching block, value or query term
+	QSet<QString> excluded;
+	QStringList terms = QProcess::splitCommand( indexQuery->text() );
+	NifIndex index;
+	if ( index.load( NifIndex::defaultFileName( directory->text() ) ) ) {
+		if ( !blockMatch->text().isEmpty() ) {
+			terms << "block:" + blockMatch->text();
+			// the value can only be matched if the field was selected when indexing
+			QString field = blockMatch->text() + "/" + valueName->text();
+			if ( !valueName->text().isEmpty() && !valueMatch->text().isEmpty() && index.indexedFields().contains( field ) ) {
+				switch ( OpType( valueOps->currentIndex() ) ) {
+				case OP_EQ:
+					terms << "value:" + field + "=" + valueMatch->text();
+					break;
+				case OP_AND:
+					terms << "value:" + field + "&" + valueMatch->text();
+					break;
+				case OP_AND_S:
+					if ( int bit = valueMatch->text().toInt( nullptr, 0 ); bit >= 0 && bit < 63 )
+						terms << "value:" + field + "&" + QString::number( 1LL << bit );
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		QString error;
+		if ( !terms.isEmpty() )
+			excluded = index.excludedFiles( terms, &error );
+		if ( !error.isEmpty() ) {
+			text->append( error.toHtmlEscaped() );
+			btRun->setChecked( false );
+			return;
+		}
+	} else if ( !terms.isEmpty() ) {
+		text->append( tr( "The index query needs a corpus index of %1, create it with --index" ).arg( directory->text() ).toHtmlEscaped() );
+		btRun->setChecked( false );
+		return;
+	}
+
+	queue.init( directory->text(), extensions, recursive->isChecked(), [&excluded]( const QString & path ) {
+		return excluded.isEmpty() || !excluded.contains( QDir::cleanPath( QFileInfo( path ).absoluteFilePath() ) );
+	} );
 
 	time = QDateTime::currentDateTime();
 
@@ -379,9 +450,12 @@ QQueue<QString> FileQueue::make( const QString & dname, const QStringList & exte
 	return paths;
 }
 
-void FileQueue::init( const QString & dname, const QStringList & extensions, bool recursive )
+void FileQueue::init( const QString & dname, const QStringList & extensions, bool recursive,
+					const std::function<bool ( const QString & )> & filter )
 {
 	QQueue<QString> paths = make( dname, extensions, recursive );
+	if ( filter )
+		paths.erase( std::remove_if( paths.begin(), paths.end(), [&filter]( const QString & p ) { return !filter( p ); } ), paths.end() );
 
 	mutex.lock();
 	this->queue = paths;
@@ -438,154 +512,486 @@ void TestThread::run()
 	while ( !filepath.isEmpty() ) {
 		emit sigStart( filepath );
 
-		BaseModel * model = &nif;
-		QReadWriteLock * lock = &nif.XMLlock;
+		FileCheckResult r = check( nif, kfm, filepath );
+		if ( r.checked ) {
+			QString result = QString( "<a href=\"nif:%1\">%1</a> (%2, %3, %4)" )
+				.arg( filepath, r.version ).arg( r.userVersion ).arg( r.bsVersion );
+
+			bool rep = reportAll || (r.blockMatch && valueMatch.isEmpty());
 
-		if ( filepath.endsWith( ".KFM", Qt::CaseInsensitive ) ) {
-			model = &kfm;
-			lock  = &kfm.XMLlock;
+			// Don't show anything if block match is on but the requested type wasn't found & we're in block match mode
+			if ( blockMatch.isEmpty() == true || r.blockMatch == true || r.valueMatch == true ) {
+				for ( const auto & msg : r.messages ) {
+					if ( msg.type != QtDebugMsg ) {
+						result += "<br>" + msg.text;
+						rep |= true;
+						emit incrementError();
+					}
+				}
+
+				if ( rep )
+					emit sigReady( result );
+			}
+		} else if ( !blockMatch.isEmpty() && !verMatch ) {
+			// Do not silently fail on unrecognized NIFs
+			emit sigReady( QString("Did not recognize file as a NIF: %1").arg(filepath) );
 		}
 
-		bool kf = ( filepath.endsWith( ".KF", Qt::CaseInsensitive ) || filepath.endsWith( ".KFA", Qt::CaseInsensitive ) );
+		if ( quit.tryLock() )
+			quit.unlock();
+		else
+			break;
 
-		{
-			// lock the XML lock
-			QReadLocker lck( lock );
-
-			QString result;
-			if ( model == &nif && nif.earlyRejection( filepath, blockMatch, verMatch ) ) {
-				bool loaded = (headerOnly) ? nif.loadHeaderOnly(filepath) : model->loadFromFile(filepath);
-
-				result = QString( "<a href=\"nif:%1\">%1</a> (%2, %3, %4)" )
-					.arg( filepath, model->getVersion() ).arg( nif.getUserVersion() ).arg( nif.getBSVersion() );
-				QList<TestMessage> messages = model->getMessages();
-
-				bool blk_match = false;
-				bool val_match = false;
-
-				if ( !headerOnly && loaded && model == &nif ) {
-					for ( int b = 0; b < nif.getBlockCount(); b++ ) {
-						auto blk = nif.getBlockIndex( b );
-						bool current_match = !blockMatch.isEmpty() && nif.inherits(nif.itemName(blk), blockMatch);
-						blk_match |= current_match;
-
-						NifValue value;
-						if ( (blockMatch.isEmpty() || current_match) && !valueName.isEmpty() && !valueMatch.isEmpty() ) {
-							auto nameIdx = nif.getIndex(blk, valueName);
-							bool hasName = nameIdx.isValid();
-							if ( hasName ) {
-								value = nif.getValue(nameIdx);
-
-								bool isInt = value.isCount() && !value.isFloat();
-								bool isStr = value.isString() || value.type() == NifValue::tStringIndex || value.isFloat();
-
-								qint64 asInt = qint64( value.toCount( nullptr, nullptr) );
-								auto asStr = ( value.type() == NifValue::tStringIndex ) ? nif.resolveString(nameIdx) : value.toString();
-
-								bool current_match = false;
-
-								switch ( op ) {
-								case OP_EQ:
-									if ( isInt )
-										current_match = (asInt == valueMatch.toInt(nullptr, 0));
-									else if ( isStr )
-										current_match = (asStr == valueMatch);
-									break;
-								case OP_NEQ:
-									if ( isInt )
-										current_match = (asInt != valueMatch.toInt(nullptr, 0));
-									else if ( isStr )
-										current_match = (asStr != valueMatch);
-									break;
-								case OP_AND:
-									if ( !isInt )
-										break;
-									current_match = (asInt & valueMatch.toInt(nullptr, 0));
-									break;
-								case OP_AND_S:
-									if ( !isInt )
-										break;
-									current_match = (asInt & (1 << valueMatch.toInt(nullptr, 0)));
-									break;
-								case OP_NAND:
-									if ( !isInt )
-										break;
-									current_match = !(asInt & valueMatch.toInt(nullptr, 0));
-									break;
-								case OP_STR_S:
-									current_match = asStr.startsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_STR_E:
-									current_match = asStr.endsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_STR_NS:
-									current_match = !asStr.startsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_STR_NE:
-									current_match = !asStr.endsWith(valueMatch, Qt::CaseInsensitive);
-									break;
-								case OP_CONT:
-									current_match = asStr.contains(valueMatch, Qt::CaseInsensitive);
-									break;
-								default:
-									current_match = false;
-									break;
-								}
-
-								if ( current_match )
-									messages += TestMessage( QtInfoMsg ) <<
-												QString( "[%1] Found Match: %2 %3 %4 | Value: %5" ).arg(b)
-												.arg(valueName).arg(ops_ord[int(op)].toHtmlEscaped())
-												.arg(valueMatch).arg(asStr);
-							} else {
-								current_match = false;
-							}
-
-							val_match |= current_match;
-						}
-
-						if ( checkFile ) {
-							messages += checkLinks(&nif, blk, kf);
-						}
-					}
+		filepath = queue->dequeue();
+	}
+}
 
-					if ( checkFile ) {
-						for ( auto checker : SpellBook::checkers() )
-							checker->castIfApplicable(&nif, {});
-						messages += nif.getMessages();
-					}
+/*
+ *  File Checker
+ */
 
-				}
+FileCheckResult FileChecker::check( NifModel & nif, KfmModel & kfm, const QString & filepath ) const
+{
+	FileCheckResult r;
+
+	BaseModel * model = &nif;
+	QReadWriteLock * lock = &nif.XMLlock;
+
+	if ( filepath.endsWith( ".KFM", Qt::CaseInsensitive ) ) {
+		model = &kfm;
+		lock  = &kfm.XMLlock;
+	}
 
-				bool rep = reportAll || (blk_match && valueMatch.isEmpty());
+	bool kf = ( filepath.endsWith( ".KF", Qt::CaseInsensitive ) || filepath.endsWith( ".KFA", Qt::CaseInsensitive ) );
 
-				// Don't show anything if block match is on but the requested type wasn't found & we're in block match mode
-				if ( blockMatch.isEmpty() == true || blk_match == true || val_match == true ) {
-					for ( const TestMessage& msg : messages ) {
-						if ( msg.type() != QtDebugMsg ) {
-							result += "<br>" + msg;
-							rep |= true;
-							emit incrementError();
-						}
+	// lock the XML lock
+	QReadLocker lck( lock );
+
+	if ( !( model == &nif && nif.earlyRejection( filepath, blockMatch, verMatch ) ) )
+		return r;
+
+	auto addMessages = [&r]( const QList<TestMessage> & messages, int block, qint64 offset ) {
+		for ( const TestMessage & msg : messages )
+			r.messages.append( { msg.type(), msg, block, offset } );
+	};
+
+	r.checked = true;
+	r.loaded = (headerOnly) ? nif.loadHeaderOnly(filepath) : model->loadFromFile(filepath);
+	r.version = model->getVersion();
+	r.userVersion = nif.getUserVersion();
+	r.bsVersion = nif.getBSVersion();
+	addMessages( model->getMessages(), -1, -1 );
+
+	if ( !headerOnly && !r.loaded && nif.getLastBlockRead() >= 0 ) {
+		// the block that failed to load is the last one read, it may not have been inserted
+		r.failedBlock = nif.getLastBlockRead();
+		r.failedOffset = nif.getLastBlockReadOffset();
+	}
+
+	if ( !headerOnly && r.loaded && model == &nif ) {
+		for ( int b = 0; b < nif.getBlockCount(); b++ ) {
+			auto blk = nif.getBlockIndex( b );
+			qint64 offset = nif.getBlockOffset( b );
+			bool current_match = !blockMatch.isEmpty() && nif.inherits(nif.itemName(blk), blockMatch);
+			r.blockMatch |= current_match;
+
+			NifValue value;
+			if ( (blockMatch.isEmpty() || current_match) && !valueName.isEmpty() && !valueMatch.isEmpty() ) {
+				auto nameIdx = nif.getIndex(blk, valueName);
+				bool hasName = nameIdx.isValid();
+				if ( hasName ) {
+					value = nif.getValue(nameIdx);
+
+					bool isInt = value.isCount() && !value.isFloat();
+					bool isStr = value.isString() || value.type() == NifValue::tStringIndex || value.isFloat();
+
+					qint64 asInt = qint64( value.toCount( nullptr, nullptr) );
+					auto asStr = ( value.type() == NifValue::tStringIndex ) ? nif.resolveString(nameIdx) : value.toString();
+
+					bool current_match = false;
+
+					switch ( op ) {
+					case OP_EQ:
+						if ( isInt )
+							current_match = (asInt == valueMatch.toInt(nullptr, 0));
+						else if ( isStr )
+							current_match = (asStr == valueMatch);
+						break;
+					case OP_NEQ:
+						if ( isInt )
+							current_match = (asInt != valueMatch.toInt(nullptr, 0));
+						else if ( isStr )
+							current_match = (asStr != valueMatch);
+						break;
+					case OP_AND:
+						if ( !isInt )
+							break;
+						current_match = (asInt & valueMatch.toInt(nullptr, 0));
+						break;
+					case OP_AND_S:
+						if ( !isInt )
+							break;
+						current_match = (asInt & (1 << valueMatch.toInt(nullptr, 0)));
+						break;
+					case OP_NAND:
+						if ( !isInt )
+							break;
+						current_match = !(asInt & valueMatch.toInt(nullptr, 0));
+						break;
+					case OP_STR_S:
+						current_match = asStr.startsWith(valueMatch, Qt::CaseInsensitive);
+						break;
+					case OP_STR_E:
+						current_match = asStr.endsWith(valueMatch, Qt::CaseInsensitive);
+						break;
+					case OP_STR_NS:
+						current_match = !asStr.startsWith(valueMatch, Qt::CaseInsensitive);
+						break;
+					case OP_STR_NE:
+						current_match = !asStr.endsWith(valueMatch, Qt::CaseInsensitive);
+						break;
+					case OP_CONT:
+						current_match = asStr.contains(valueMatch, Qt::CaseInsensitive);
+						break;
+					default:
+						current_match = false;
+						break;
 					}
 
-					if ( rep )
-						emit sigReady( result );
+					if ( current_match ) {
+						r.messages.append( { QtInfoMsg,
+											QString( "[%1] Found Match: %2 %3 %4 | Value: %5" ).arg(b)
+											.arg(valueName).arg(ops_ord[int(op)].toHtmlEscaped())
+											.arg(valueMatch).arg(asStr),
+											b, offset } );
+					}
+				} else {
+					current_match = false;
 				}
-			} else if ( !blockMatch.isEmpty() && !verMatch ) {
-				// Do not silently fail on unrecognized NIFs
-				result += QString("Did not recognize file as a NIF: %1").arg(filepath);
-				emit sigReady(result);
+
+				r.valueMatch |= current_match;
+			}
+
+			if ( checkFile ) {
+				addMessages( checkLinks(&nif, blk, kf), b, offset );
 			}
 		}
 
-		if ( quit.tryLock() )
-			quit.unlock();
-		else
-			break;
+		if ( checkFile ) {
+			for ( auto checker : SpellBook::checkers() )
+				checker->castIfApplicable(&nif, {});
+			addMessages( nif.getMessages(), -1, -1 );
+		}
+	}
 
-		filepath = queue->dequeue();
+	return r;
+}
+
+namespace
+{
+//! Files to check, filled by a thread scanning the folders while the files found are being checked
+class CheckQueue final
+{
+public:
+	void push( const QString & path )
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			if ( aborted )
+				return;
+			queue.push_back( path );
+		}
+		cond.notify_one();
+	}
+
+	//! Drop the files not checked yet and ignore further ones, returns the number of files dropped
+	int abort()
+	{
+		int n;
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			n = int( queue.size() );
+			queue.clear();
+			aborted = true;
+			closed = true;
+		}
+		cond.notify_all();
+		return n;
+	}
+
+	bool isAborted()
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		return aborted;
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			closed = true;
+		}
+		cond.notify_all();
+	}
+
+	//! Wait for the next file, returns false when the queue is closed and empty
+	bool pop( QString & path )
+	{
+		std::unique_lock<std::mutex> lock( mutex );
+		cond.wait( lock, [this]() { return !queue.empty() || closed; } );
+		if ( queue.empty() )
+			return false;
+		path = std::move( queue.front() );
+		queue.pop_front();
+		return true;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<QString> queue;
+	bool closed = false;
+	bool aborted = false;
+};
+
+//! State of a checker thread, shared with the watchdog on the main thread
+struct CheckWorker
+{
+	std::mutex mutex;
+	QString file;
+	qint64 fileStart = -1;	// -1 if idle
+	bool abandoned = false;
+	std::atomic<bool> finished = false;
+};
+
+//! Writes JSON Lines results from several threads
+class CheckOutput final
+{
+public:
+	void write( const QJsonObject & o )
+	{
+		QByteArray line = QJsonDocument( o ).toJson( QJsonDocument::Compact );
+		line += '\n';
+		std::lock_guard<std::mutex> lock( mutex );
+		std::fwrite( line.constData(), 1, size_t( line.size() ), stdout );
+		std::fflush( stdout );
+	}
+
+private:
+	std::mutex mutex;
+};
+
+struct CheckStats
+{
+	std::atomic<int> files = 0;
+	//! Files not checked, because they were rejected early or the run was aborted
+	std::atomic<int> skipped = 0;
+	std::atomic<int> errors = 0;
+	std::atomic<int> messages = 0;
+	std::atomic<int> timeouts = 0;
+	std::atomic<qint64> bytes = 0;
+};
+}	// namespace
+
+QJsonObject FileCheckResult::toJson( const QString & filepath ) const
+{
+	static const char * typeNames[5] = { "debug", "warning", "critical", "fatal", "info" };
+
+	QJsonObject o;
+	o["type"] = "file";
+	o["file"] = filepath;
+	if ( !checked ) {
+		o["status"] = "skipped";
+		return o;
+	}
+
+	QJsonArray jsonMessages;
+	bool haveErrors = !loaded;
+	for ( const auto & msg : messages ) {
+		if ( msg.type == QtDebugMsg )
+			continue;
+		haveErrors |= ( msg.type != QtInfoMsg );
+		QJsonObject m;
+		m["type"] = typeNames[int(msg.type) < 5 ? int(msg.type) : 1];
+		m["text"] = msg.text;
+		if ( msg.block >= 0 )
+			m["block"] = msg.block;
+		if ( msg.offset >= 0 )
+			m["offset"] = msg.offset;
+		jsonMessages.append( m );
+	}
+
+	o["status"] = haveErrors ? "error" : "ok";
+	o["version"] = version;
+	o["userVersion"] = qint64( userVersion );
+	o["bsVersion"] = qint64( bsVersion );
+	o["loaded"] = loaded;
+	if ( blockMatch )
+		o["blockMatch"] = true;
+	if ( valueMatch )
+		o["valueMatch"] = true;
+	if ( failedBlock >= 0 ) {
+		o["failedBlock"] = failedBlock;
+		if ( failedOffset >= 0 )
+			o["failedOffset"] = failedOffset;
+	}
+	if ( !jsonMessages.isEmpty() )
+		o["messages"] = jsonMessages;
+	return o;
+}
+
+int FileChecker::checkAll( const QStringList & paths, bool recursive, int threads, int timeoutSecs ) const
+{
+	const QStringList extensions = {
+		"*.nif", "*.nifcache", "*.texcache", "*.pcpatch", "*.bto", "*.btr", "*.item", "*.nif_wii", "*.cat",
+		"*.kf", "*.kfa", "*.kfm"
+	};
+	if ( threads <= 0 )
+		threads = QThread::idealThreadCount();
+
+	QElapsedTimer timer;
+	timer.start();
+
+	// shared_ptr, because an abandoned thread may outlive this function until the process exits
+	auto queue = std::make_shared<CheckQueue>();
+	auto output = std::make_shared<CheckOutput>();
+	auto stats = std::make_shared<CheckStats>();
+	auto checker = std::make_shared<FileChecker>( *this );
+
+	std::thread scanner( [queue, paths, extensions, recursive]() {
+		for ( const QString & path : paths ) {
+			if ( QFileInfo( path ).isDir() ) {
+				QDirIterator it( path, extensions, QDir::Files,
+								recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags );
+				while ( it.hasNext() && !queue->isAborted() )
+					queue->push( it.next() );
+			} else {
+				queue->push( path );
+			}
+		}
+		queue->close();
+	} );
+
+	auto startWorker = [&]() {
+		auto w = std::make_shared<CheckWorker>();
+		std::thread( [w, queue, output, stats, checker, timer]() {
+			NifModel nif;
+			KfmModel kfm;
+			QString filepath;
+			while ( queue->pop( filepath ) ) {
+				{
+					std::lock_guard<std::mutex> lock( w->mutex );
+					w->file = filepath;
+					w->fileStart = timer.elapsed();
+				}
+				qint64 bytes = QFileInfo( filepath ).size();
+				QElapsedTimer t;
+				t.start();
+				FileCheckResult r = checker->check( nif, kfm, filepath );
+				QJsonObject o = r.toJson( filepath );
+				if ( r.checked ) {
+					o["bytes"] = bytes;
+					o["msecs"] = t.elapsed();
+				}
+
+				std::lock_guard<std::mutex> lock( w->mutex );
+				// the watchdog has already reported the file as timed out
+				if ( w->abandoned )
+					return;
+				w->fileStart = -1;
+				if ( !r.checked ) {
+					stats->skipped++;
+					output->write( o );
+					continue;
+				}
+				stats->files++;
+				stats->bytes += bytes;
+				if ( o.value( "status" ).toString() == "error" )
+					stats->errors++;
+				stats->messages += o.value( "messages" ).toArray().size();
+				output->write( o );
+			}
+			w->finished = true;
+		} ).detach();
+		return w;
+	};
+
+	std::vector<std::shared_ptr<CheckWorker>> workers;
+	for ( int i = 0; i < threads; i++ )
+		workers.push_back( startWorker() );
+
+	// watchdog, abandoned threads keep running until the file is loaded, so they are only replaced until as many
+	// have been abandoned as there are checker threads, after that the pool shrinks, and the run is aborted when
+	// no checker thread is left
+	int abandonedCount = 0;
+	bool aborted = false;
+	while ( true ) {
+		bool running = false;
+		for ( size_t i = 0; i < workers.size(); ) {
+			auto & w = workers[i];
+			if ( w->finished ) {
+				i++;
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> lock( w->mutex );
+				if ( timeoutSecs <= 0 || w->fileStart < 0 || ( timer.elapsed() - w->fileStart ) <= qint64( timeoutSecs ) * 1000 ) {
+					running = true;
+					i++;
+					continue;
+				}
+				w->abandoned = true;
+				abandonedCount++;
+				stats->files++;
+				stats->errors++;
+				stats->timeouts++;
+				output->write( QJsonObject{
+					{ "type", "file" }, { "file", w->file }, { "status", "timeout" },
+					{ "msecs", timer.elapsed() - w->fileStart } } );
+			}
+			// the thread is left to finish in the background, a new one takes over the queue
+			if ( abandonedCount < threads ) {
+				w = startWorker();
+				running = true;
+				i++;
+			} else {
+				workers.erase( workers.begin() + std::ptrdiff_t( i ) );
+			}
+		}
+		if ( !running ) {
+			if ( workers.empty() ) {
+				aborted = true;
+				stats->skipped += queue->abort();
+			}
+			break;
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+	}
+	scanner.join();
+
+	double secs = std::max( double( timer.elapsed() ) / 1000.0, 0.001 );
+	output->write( QJsonObject{
+		{ "type", "summary" },
+		{ "files", int( stats->files ) },
+		{ "skipped", int( stats->skipped ) },
+		{ "errors", int( stats->errors ) },
+		{ "messages", int( stats->messages ) },
+		{ "timeouts", int( stats->timeouts ) },
+		{ "bytes", qint64( stats->bytes ) },
+		{ "msecs", timer.elapsed() },
+		{ "filesPerSecond", double( stats->files ) / secs },
+		{ "megabytesPerSecond", double( stats->bytes ) / ( secs * 1048576.0 ) },
+		{ "threads", threads },
+		{ "aborted", aborted }
+	} );
+
+	int exitCode = ( stats->errors > 0 || aborted ) ? 1 : 0;
+	if ( abandonedCount > 0 ) {
+		// abandoned threads may still be using the models, skip the destruction of static data
+		std::fflush( stdout );
+		std::_Exit( exitCode );
 	}
+	return exitCode;
 }
 
 static QString linkId( const NifModel * nif, QModelIndex idx )
@@ -600,7 +1006,7 @@ static QString linkId( const NifModel * nif, QModelIndex idx )
 	return id;
 }
 
-QList<TestMessage> TestThread::checkLinks( const NifModel * nif, const QModelIndex & iParent, bool kf )
+QList<TestMessage> FileChecker::checkLinks( const NifModel * nif, const QModelIndex & iParent, bool kf )
 {
 	QList<TestMessage> messages;
 
@@ -615,7 +1021,7 @@ QList<TestMessage> TestThread::checkLinks( const NifModel * nif, const QModelInd
 				// if ( ! isChildLink && ! kf )
 				//	messages.append( Message() << tr("unassigned parent link") << linkId( nif, idx ) );
 			} else if ( l >= nif->getBlockCount() ) {
-				messages.append( TestMessage() << tr( "invalid link" ) << linkId( nif, idx ) );
+				messages.append( TestMessage() << QCoreApplication::translate( "TestThread", "invalid link" ) << linkId( nif, idx ) );
 			} else {
 				QString tmplt = nif->itemTempl( idx );
 
@@ -623,7 +1029,8 @@ QList<TestMessage> TestThread::checkLinks( const NifModel * nif, const QModelInd
 					QModelIndex iBlock = nif->getBlockIndex( l );
 
 					if ( !nif->blockInherits( iBlock, tmplt ) )
-						messages.append( TestMessage() << tr( "link" ) << linkId( nif, idx ) << tr( "points to wrong block type" ) << nif->itemName( iBlock ) );
+						messages.append( TestMessage() << QCoreApplication::translate( "TestThread", "link" ) << linkId( nif, idx )
+										<< QCoreApplication::translate( "TestThread", "points to wrong block type" ) << nif->itemName( iBlock ) );
 				}
 			}
 		}
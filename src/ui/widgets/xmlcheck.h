@@ -11,6 +11,7 @@
 
 #include <map>
 #include <array>
+#include <functional>
 
 
 class QCheckBox;
@@ -24,6 +25,10 @@ class QTextBrowser;
 
 class TestMessage;
 class FileSelector;
+class NifModel;
+class KfmModel;
+class QModelIndex;
+class QJsonObject;
 
 
 enum OpType
@@ -69,7 +74,9 @@ public:
 	bool isEmpty() { return count() == 0; }
 	int count();
 
-	void init( const QString & directory, const QStringList & extensions, bool recursive );
+	//! Queue the files in 'directory', skipping those for which 'filter' returns false
+	void init( const QString & directory, const QStringList & extensions, bool recursive,
+				const std::function<bool ( const QString & )> & filter = nullptr );
 	void clear();
 
 protected:
@@ -79,23 +86,72 @@ protected:
 	QQueue<QString> queue;
 };
 
-class TestThread final : public QThread
+//! Result of checking a single file, see FileChecker::check()
+struct FileCheckResult
 {
-	Q_OBJECT
+	struct Entry
+	{
+		QtMsgType type;
+		QString text;
+		//! Block number and file offset the message refers to, or -1
+		int block = -1;
+		qint64 offset = -1;
+	};
+
+	//! False if the file was rejected by NifModel::earlyRejection() and not loaded
+	bool checked = false;
+	bool loaded = false;
+	bool blockMatch = false;
+	bool valueMatch = false;
+	QString version;
+	quint32 userVersion = 0;
+	quint32 bsVersion = 0;
+	//! Block that failed to load, and its file offset, or -1
+	int failedBlock = -1;
+	qint64 failedOffset = -1;
+	QList<Entry> messages;
+
+	//! Result as a JSON object, with the status "ok", "error", or "skipped" if the file was not checked
+	QJsonObject toJson( const QString & filepath ) const;
+};
 
+//! Checks files for errors and matches, used by TestThread and the -no-gui --xml-check command line mode
+class FileChecker
+{
 public:
-	TestThread( QObject * o, FileQueue * q );
-	~TestThread();
-
 	QString blockMatch;
 	QString valueName;
 	QString valueMatch;
-	OpType op;
+	OpType op = OP_EQ;
 	quint32 verMatch = 0;
 	bool reportAll = true;
 	bool headerOnly = false;
 	bool checkFile = true;
 
+	//! Load and check 'filepath' with 'nif' or 'kfm', holding the XML read lock
+	FileCheckResult check( NifModel & nif, KfmModel & kfm, const QString & filepath ) const;
+
+	//! Check files and folders on 'threads' threads, printing the results as JSON Lines to stdout
+	/*!
+	 * Folders are scanned on a separate thread while the files found are already being checked.
+	 * A file that takes longer than 'timeoutSecs' to check is reported as timed out, and its
+	 * thread is abandoned and replaced, up to 'threads' times. Further timeouts reduce the number
+	 * of threads, and the run is aborted when none is left. Returns the process exit code.
+	 */
+	int checkAll( const QStringList & paths, bool recursive, int threads, int timeoutSecs ) const;
+
+protected:
+	static QList<TestMessage> checkLinks( const NifModel * nif, const QModelIndex & iParent, bool kf );
+};
+
+class TestThread final : public QThread, public FileChecker
+{
+	Q_OBJECT
+
+public:
+	TestThread( QObject * o, FileQueue * q );
+	~TestThread();
+
 signals:
 	void sigStart( const QString & file );
 	void sigReady( const QString & result );
@@ -104,8 +160,6 @@ signals:
 protected:
 	void run() override final;
 
-	QList<TestMessage> checkLinks( const class NifModel * nif, const class QModelIndex & iParent, bool kf );
-
 	FileQueue * queue;
 
 	QMutex quit;
@@ -147,6 +201,7 @@ protected:
 	QCheckBox * repErr, * hdrOnly;
 	QSpinBox * count;
 	QLineEdit * verMatch;
+	QLineEdit * indexQuery;
 	QTextBrowser * text;
 	QProgressBar * progress;
 	QLabel * label;